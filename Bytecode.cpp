@@ -0,0 +1,1376 @@
+//
+// Compilation of AST nodes to bytecode and the VM running it
+//
+
+#include "Tree.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+static const char * opcodeNames[] = {
+#define MILA_OPCODE_NAME(name) #name,
+        MILA_OPCODES(MILA_OPCODE_NAME)
+#undef MILA_OPCODE_NAME
+};
+
+static bool isBooleanType(const shared_ptr <Type> & type) {
+    return dynamic_pointer_cast<Boolean>(type) != nullptr;
+}
+
+/**
+ * @brief Instruction only writes register a, the register can be replaced by variable its result is assigned to
+ */
+static bool writesRegisterA(Opcode op) {
+    switch (op) {
+        case Opcode::Move:
+        case Opcode::LoadK:
+        case Opcode::LoadG:
+        case Opcode::LoadP:
+        case Opcode::Addr:
+        case Opcode::LoadItemL:
+        case Opcode::LoadItemG:
+        case Opcode::LoadItemP:
+        case Opcode::Add:
+        case Opcode::Sub:
+        case Opcode::Mul:
+        case Opcode::Div:
+        case Opcode::Mod:
+        case Opcode::And:
+        case Opcode::Or:
+        case Opcode::Xor:
+        case Opcode::AddK:
+        case Opcode::SubK:
+        case Opcode::MulK:
+        case Opcode::DivK:
+        case Opcode::ModK:
+        case Opcode::Neg:
+        case Opcode::Not:
+        case Opcode::BoolNot:
+        case Opcode::NotZero:
+        case Opcode::Eq:
+        case Opcode::Ne:
+        case Opcode::Lt:
+        case Opcode::Le:
+        case Opcode::Gt:
+        case Opcode::Ge:
+        case Opcode::Call:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Instruction can write memory other than registers of current frame
+ */
+static bool writesMemory(Opcode op) {
+    switch (op) {
+        case Opcode::StoreG:
+        case Opcode::StoreP:
+        case Opcode::StoreItemG:
+        case Opcode::StoreItemP:
+        case Opcode::Copy:
+        case Opcode::AddG:
+        case Opcode::SubG:
+        case Opcode::AddGK:
+        case Opcode::Call:
+        case Opcode::TailCall:
+        case Opcode::Read:
+        case Opcode::ReadArray:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void setTarget(Instruction & instruction, int target) {
+    switch (instruction.op) {
+        case Opcode::Jump:
+            instruction.a = target;
+            break;
+        case Opcode::JumpZ:
+        case Opcode::JumpNZ:
+            instruction.b = target;
+            break;
+        default:
+            instruction.c = target;
+    }
+}
+
+int BytecodeCompiler::declareFunction(const string & name, const vector <shared_ptr<Var>> & params,
+                                      shared_ptr <Type> returnType) {
+    auto known = functions.find(name);
+    if (known != functions.end())
+        return known->second.index;
+    int index = (int) program.functions.size();
+    BytecodeFunction function;
+    function.name = name;
+    function.params = params;
+    program.functions.push_back(function);
+    functions[name] = {index, params, returnType};
+    if (name == "main")
+        program.main = index;
+    return index;
+}
+
+void BytecodeCompiler::beginFunction(int index) {
+    current = index;
+    code().clear();
+    top = locals = barrier = 0;
+    result = -1;
+    pure = false;
+    loops.clear();
+    addressTaken.clear();
+}
+
+void BytecodeCompiler::endFunction() {
+//TAIL CALLS - call whose result is returned reuses the frame, unless frame has address taken or memo table is involved
+    bool addressTaken = false;
+    for (auto & instruction: code())
+        addressTaken |= instruction.op == Opcode::Addr;
+    for (size_t i = 1; i < code().size() && !addressTaken; i++) {
+        Instruction & call = code()[i - 1];
+        if (call.op == Opcode::Call &&
+            ((code()[i].op == Opcode::Return && code()[i].a == call.a) || code()[i].op == Opcode::ReturnVoid) &&
+            !program.functions[call.b].pure)
+            call.op = Opcode::TailCall;
+    }
+    program.functions[current].defined = true;
+    current = -1;
+}
+
+int BytecodeCompiler::allocateVariable(int count) {
+    int reg = allocate(count);
+    locals = top;
+    return reg;
+}
+
+int BytecodeCompiler::allocate(int count) {
+    int reg = top;
+    top += count;
+    program.functions[current].frameSize = max(program.functions[current].frameSize, top);
+    return reg;
+}
+
+void BytecodeCompiler::release(int top, int locals) {
+    this->top = top;
+    this->locals = locals;
+}
+
+int BytecodeCompiler::emit(Opcode op, int a, int b, int c) {
+    code().push_back({op, a, b, c});
+    return (int) code().size() - 1;
+}
+
+int BytecodeCompiler::label() {
+    barrier = (int) code().size();
+    return barrier;
+}
+
+void BytecodeCompiler::patch(const vector <int> & jumps, int target) {
+    for (int jump: jumps)
+        setTarget(code()[jump], target);
+}
+
+bool BytecodeCompiler::takeConstant(int reg, int & value) {
+    if ((int) code().size() <= barrier || !isTemp(reg))
+        return false;
+    Instruction & last = code().back();
+    if (last.op != Opcode::LoadK || last.a != reg)
+        return false;
+    value = last.b;
+    code().pop_back();
+    return true;
+}
+
+int BytecodeCompiler::load(const Place & place) {
+    if (place.kind == Place::Kind::Register)
+        return place.base;
+    int reg = allocate();
+    switch (place.kind) {
+        case Place::Kind::Constant:
+            emit(Opcode::LoadK, reg, place.base);
+            break;
+        case Place::Kind::Global:
+            emit(Opcode::LoadG, reg, place.base);
+            break;
+        case Place::Kind::Pointer:
+            emit(Opcode::LoadP, reg, place.base);
+            break;
+        case Place::Kind::LocalItem:
+            emit(Opcode::LoadItemL, reg, place.base, place.offset);
+            break;
+        case Place::Kind::GlobalItem:
+            emit(Opcode::LoadItemG, reg, place.base, place.offset);
+            break;
+        default:
+            emit(Opcode::LoadItemP, reg, place.base, place.offset);
+    }
+    return reg;
+}
+
+void BytecodeCompiler::store(const Place & place, int reg) {
+    int last = (int) code().size() - 1;
+    switch (place.kind) {
+        case Place::Kind::Register:
+//result of last instruction goes straight to the variable, x := x + 1 is one AddK
+            if (last >= barrier && isTemp(reg) && code()[last].a == reg && writesRegisterA(code()[last].op))
+                code()[last].a = place.base;
+            else if (reg != place.base)
+                emit(Opcode::Move, place.base, reg);
+            break;
+        case Place::Kind::Global:
+//LOAD-ADD-STORE - g := g + x and g := g - x are one instruction when nothing between load of g and the add can write g
+            if (last >= barrier && isTemp(reg) && code()[last].a == reg) {
+                Instruction add = code()[last];
+                int load = last - 1;
+                while (load >= barrier && !writesMemory(code()[load].op) &&
+                       !(code()[load].op == Opcode::LoadG && code()[load].a == add.b))
+                    load--;
+                if (load >= barrier && code()[load].op == Opcode::LoadG && code()[load].b == place.base &&
+                    isTemp(add.b) && ((add.op == Opcode::Add || add.op == Opcode::Sub) ? add.c != add.b
+                                                                                         : add.op == Opcode::AddK ||
+                                                                                           add.op == Opcode::SubK)) {
+                    if (add.op == Opcode::AddK || add.op == Opcode::SubK)
+                        code()[last] = {Opcode::AddGK, place.base,
+                                        add.op == Opcode::AddK ? add.c : (int) (0u - (uint32_t) add.c), 0};
+                    else
+                        code()[last] = {add.op == Opcode::Add ? Opcode::AddG : Opcode::SubG, place.base, add.c, 0};
+                    code().erase(code().begin() + load);
+                    break;
+                }
+            }
+            emit(Opcode::StoreG, place.base, reg);
+            break;
+        case Place::Kind::Pointer:
+            emit(Opcode::StoreP, place.base, reg);
+            break;
+        case Place::Kind::LocalItem:
+            emit(Opcode::StoreItemL, place.base, place.offset, reg);
+            break;
+        case Place::Kind::GlobalItem:
+            emit(Opcode::StoreItemG, place.base, place.offset, reg);
+            break;
+        case Place::Kind::PointerItem:
+            emit(Opcode::StoreItemP, place.base, place.offset, reg);
+            break;
+        case Place::Kind::Constant:
+            throw invalid_argument("Constant can not be assigned\n");
+    }
+}
+
+int BytecodeCompiler::address(const Place & place) {
+    if (place.kind == Place::Kind::Pointer)
+        return place.base;
+    int reg = allocate();
+    switch (place.kind) {
+        case Place::Kind::Register:
+            emit(Opcode::Addr, reg, place.base);
+            break;
+        case Place::Kind::Global:
+            emit(Opcode::LoadK, reg, place.base);
+            break;
+        case Place::Kind::LocalItem:
+            emit(Opcode::Addr, reg, place.base);
+            emit(Opcode::Add, reg, reg, place.offset);
+            break;
+        case Place::Kind::GlobalItem:
+            emit(Opcode::AddK, reg, place.offset, place.base);
+            break;
+        case Place::Kind::PointerItem:
+            emit(Opcode::Add, reg, place.base, place.offset);
+            break;
+        default:
+            throw invalid_argument("Constant has no address\n");
+    }
+    return reg;
+}
+
+BytecodeProgram BytecodeCompiler::finish() {
+    if (program.main < 0 || !program.functions[program.main].defined)
+        throw invalid_argument("Program has no main block\n");
+    for (int index: called)
+        if (!program.functions[index].defined)
+            throw invalid_argument("Function \"" + program.functions[index].name + "\" is called but not defined\n");
+    return program;
+}
+
+void BytecodeProgram::dump(ostream & out) const {
+    for (auto & function: functions) {
+        if (!function.defined)
+            continue;
+        out << function.name << ": frame " << function.frameSize << ", parameters " << function.paramSlots << endl;
+        for (size_t i = 0; i < function.code.size(); i++) {
+            const Instruction & instruction = function.code[i];
+            out << "    " << i << ": " << opcodeNames[(int) instruction.op] << " " << instruction.a << ", "
+                << instruction.b << ", " << instruction.c << endl;
+        }
+    }
+}
+
+void BytecodeCompiler::countHot(bool loop) {
+//main runs once, it never switches to native code
+    if (countHotness && current != program.main)
+        emit(Opcode::Count, current, loop);
+}
+
+void Expression::compileBranch(BytecodeCompiler & compiler, bool when, vector <int> & jumps) {
+    int value = compileBytecode(compiler);
+    jumps.push_back(compiler.emit(when ? Opcode::JumpNZ : Opcode::JumpZ, value));
+}
+
+int LoweredValue::compileBytecode(BytecodeCompiler &) {
+    return reg;
+}
+
+shared_ptr <Type> LoweredValue::getBytecodeType(BytecodeCompiler &) {
+    return make_shared<Integer>();
+}
+
+int Number::compileBytecode(BytecodeCompiler & compiler) {
+    int reg = compiler.allocate();
+    compiler.emit(Opcode::LoadK, reg, value);
+    return reg;
+}
+
+shared_ptr <Type> Number::getBytecodeType(BytecodeCompiler &) {
+    return make_shared<Integer>();
+}
+
+int String::compileBytecode(BytecodeCompiler &) {
+    throw invalid_argument("String \"" + value + "\" can only be written\n");
+}
+
+shared_ptr <Type> String::getBytecodeType(BytecodeCompiler &) {
+    return nullptr;
+}
+
+void Block::compileBytecode(BytecodeCompiler & compiler) {
+    for (auto & statement: statements) {
+        int top = compiler.getTop();
+        int locals = compiler.getLocals();
+        statement->compileBytecode(compiler);
+        compiler.release(top, locals);
+    }
+}
+
+void Var::compileBytecode(BytecodeCompiler & compiler) {
+    if (dynamic_pointer_cast<OpenArray>(type))
+        throw invalid_argument("Open array \"" + name + "\" can only be a parameter\n");
+    Symbol symbol;
+    symbol.type = type;
+    if (global) {
+        compiler.program.globals[name] = compiler.program.globalSize;
+        symbol.place = {Place::Kind::Global, compiler.program.globalSize, 0};
+        compiler.program.globalSize += type->getScalarCount();
+    } else
+        symbol.place = {Place::Kind::Register, compiler.allocateVariable(type->getScalarCount()), 0};
+    compiler.symbols[name] = symbol;
+}
+
+void Const::compileBytecode(BytecodeCompiler & compiler) {
+    Symbol symbol;
+    symbol.place = {Place::Kind::Constant, value, 0};
+    symbol.type = make_shared<Integer>();
+    compiler.symbols[name] = symbol;
+}
+
+void Special::compileBytecode(BytecodeCompiler & compiler) {
+    switch (token) {
+        case tok_exit:
+            if (compiler.result >= 0)
+                compiler.emit(Opcode::Return, compiler.result);
+            else
+                compiler.emit(Opcode::ReturnVoid);
+            break;
+        case tok_break:
+        case tok_continue:
+            if (compiler.loops.empty())
+                throw invalid_argument(string(token == tok_break ? "break" : "continue") + " outside of loop\n");
+            (token == tok_break ? compiler.loops.back().breaks : compiler.loops.back().continues).push_back(
+                    compiler.emit(Opcode::Jump));
+            break;
+        default:
+            throw UnknownTokenException(token, {tok_exit, tok_break, tok_continue}, "special keyword");
+    }
+}
+
+shared_ptr <Type> BinOp::getBytecodeType(BytecodeCompiler & compiler) {
+    switch (token) {
+        case tok_equal:
+        case tok_notequal:
+        case tok_less:
+        case tok_lessequal:
+        case tok_greater:
+        case tok_greaterequal:
+            return make_shared<Boolean>();
+        case tok_and:
+        case tok_or:
+        case tok_xor:
+            if (isBooleanType(left->getBytecodeType(compiler)) && isBooleanType(right->getBytecodeType(compiler)))
+                return make_shared<Boolean>();
+            return make_shared<Integer>();
+        default:
+            return make_shared<Integer>();
+    }
+}
+
+/**
+ * @brief Opcode with constant right operand
+ */
+static bool getImmediateOpcode(int token, Opcode & op) {
+    switch (token) {
+        case tok_plus:
+            op = Opcode::AddK;
+            return true;
+        case tok_minus:
+            op = Opcode::SubK;
+            return true;
+        case tok_multiply:
+            op = Opcode::MulK;
+            return true;
+        case tok_div:
+            op = Opcode::DivK;
+            return true;
+        case tok_mod:
+            op = Opcode::ModK;
+            return true;
+        default:
+            return false;
+    }
+}
+
+int BinOp::compileBytecode(BytecodeCompiler & compiler) {
+    if ((token == tok_and || token == tok_or) && isBooleanType(getBytecodeType(compiler))) {
+//SHORT CIRCUIT, right operand is evaluated only when left one does not decide
+        int result = compiler.allocate();
+        compiler.store({Place::Kind::Register, result, 0}, left->compileBytecode(compiler));
+        int skip = compiler.emit(token == tok_and ? Opcode::JumpZ : Opcode::JumpNZ, result);
+        compiler.store({Place::Kind::Register, result, 0}, right->compileBytecode(compiler));
+        compiler.patch({skip}, compiler.label());
+        return result;
+    }
+    int l = left->compileBytecode(compiler);
+    int r = right->compileBytecode(compiler);
+    int result = compiler.allocate();
+    int constant;
+    Opcode immediate;
+//division by zero is left to trap at runtime like in compiled code
+    if (getImmediateOpcode(token, immediate) && compiler.takeConstant(r, constant)) {
+        if (constant || (immediate != Opcode::DivK && immediate != Opcode::ModK)) {
+            compiler.emit(immediate, result, l, constant);
+            return result;
+        }
+        compiler.emit(Opcode::LoadK, r, constant);
+    }
+    Opcode op;
+    switch (token) {
+        case tok_equal:
+            op = Opcode::Eq;
+            break;
+        case tok_notequal:
+            op = Opcode::Ne;
+            break;
+        case tok_less:
+            op = Opcode::Lt;
+            break;
+        case tok_lessequal:
+            op = Opcode::Le;
+            break;
+        case tok_greater:
+            op = Opcode::Gt;
+            break;
+        case tok_greaterequal:
+            op = Opcode::Ge;
+            break;
+        case tok_plus:
+            op = Opcode::Add;
+            break;
+        case tok_minus:
+            op = Opcode::Sub;
+            break;
+        case tok_multiply:
+            op = Opcode::Mul;
+            break;
+        case tok_div:
+            op = Opcode::Div;
+            break;
+        case tok_mod:
+            op = Opcode::Mod;
+            break;
+        case tok_and:
+            op = Opcode::And;
+            break;
+        case tok_or:
+            op = Opcode::Or;
+            break;
+        case tok_xor:
+            op = Opcode::Xor;
+            break;
+        default:
+            throw UnknownTokenException(static_cast<Token>(token),
+                                        {tok_equal, tok_notequal, tok_less, tok_lessequal, tok_greater,
+                                         tok_greaterequal, tok_plus, tok_minus, tok_or, tok_multiply, tok_div, tok_mod,
+                                         tok_and, tok_xor}, "operator");
+    }
+    compiler.emit(op, result, l, r);
+    return result;
+}
+
+/**
+ * @brief Compare and branch opcode, jumps when comparison is when, immediate ones compare with constant
+ */
+static Opcode getBranchOpcode(int token, bool when, bool immediate) {
+    if (!when) {
+        switch (token) {
+            case tok_equal:
+                token = tok_notequal;
+                break;
+            case tok_notequal:
+                token = tok_equal;
+                break;
+            case tok_less:
+                token = tok_greaterequal;
+                break;
+            case tok_lessequal:
+                token = tok_greater;
+                break;
+            case tok_greater:
+                token = tok_lessequal;
+                break;
+            default:
+                token = tok_less;
+        }
+    }
+    switch (token) {
+        case tok_equal:
+            return immediate ? Opcode::JumpEqK : Opcode::JumpEq;
+        case tok_notequal:
+            return immediate ? Opcode::JumpNeK : Opcode::JumpNe;
+        case tok_less:
+            return immediate ? Opcode::JumpLtK : Opcode::JumpLt;
+        case tok_lessequal:
+            return immediate ? Opcode::JumpLeK : Opcode::JumpLe;
+        case tok_greater:
+            return immediate ? Opcode::JumpGtK : Opcode::JumpGt;
+        default:
+            return immediate ? Opcode::JumpGeK : Opcode::JumpGe;
+    }
+}
+
+void BinOp::compileBranch(BytecodeCompiler & compiler, bool when, vector <int> & jumps) {
+    switch (token) {
+        case tok_equal:
+        case tok_notequal:
+        case tok_less:
+        case tok_lessequal:
+        case tok_greater:
+        case tok_greaterequal: {
+//COMPARE AND BRANCH, constant right operand is immediate
+            int l = left->compileBytecode(compiler);
+            int r = right->compileBytecode(compiler);
+            int constant;
+            bool immediate = compiler.takeConstant(r, constant);
+            jumps.push_back(compiler.emit(getBranchOpcode(token, when, immediate), l, immediate ? constant : r));
+            return;
+        }
+        case tok_and:
+        case tok_or:
+            if (!isBooleanType(getBytecodeType(compiler)))
+                break;
+            if ((token == tok_and) != when) {
+//false and, true or - any operand decides
+                left->compileBranch(compiler, when, jumps);
+                right->compileBranch(compiler, when, jumps);
+            } else {
+                vector <int> skip;
+                left->compileBranch(compiler, !when, skip);
+                right->compileBranch(compiler, when, jumps);
+                compiler.patch(skip, compiler.label());
+            }
+            return;
+    }
+    Expression::compileBranch(compiler, when, jumps);
+}
+
+shared_ptr <Type> UnOp::getBytecodeType(BytecodeCompiler & compiler) {
+    if (token == tok_not && isBooleanType(expr->getBytecodeType(compiler)))
+        return make_shared<Boolean>();
+    return make_shared<Integer>();
+}
+
+int UnOp::compileBytecode(BytecodeCompiler & compiler) {
+    int value = expr->compileBytecode(compiler);
+    int result = compiler.allocate();
+    switch (token) {
+        case tok_minus:
+            compiler.emit(Opcode::Neg, result, value);
+            break;
+        case tok_not:
+            compiler.emit(isBooleanType(expr->getBytecodeType(compiler)) ? Opcode::BoolNot : Opcode::Not, result, value);
+            break;
+        default:
+            throw UnknownTokenException(static_cast<Token>(token), {tok_minus, tok_not}, "operator");
+    }
+    return result;
+}
+
+void UnOp::compileBranch(BytecodeCompiler & compiler, bool when, vector <int> & jumps) {
+    if (token == tok_not && isBooleanType(expr->getBytecodeType(compiler)))
+        expr->compileBranch(compiler, !when, jumps);
+    else
+        Expression::compileBranch(compiler, when, jumps);
+}
+
+Place VarReference::compilePlace(BytecodeCompiler & compiler) {
+    auto symbol = compiler.symbols.find(name);
+    if (symbol == compiler.symbols.end())
+        throw UnknownVarException(name);
+    if (compiler.pure && symbol->second.place.kind == Place::Kind::Global)
+        throw invalid_argument("Pure function \"" + compiler.program.functions[compiler.getFunction()].name +
+                               "\" uses global variable \"" + name + "\"\n");
+    return symbol->second.place;
+}
+
+int VarReference::compileBytecode(BytecodeCompiler & compiler) {
+    Place place = compilePlace(compiler);
+//variable passed by reference can be changed by call later in expression, its value is copied now
+    if (place.kind == Place::Kind::Register && compiler.addressTaken.count(name)) {
+        int reg = compiler.allocate();
+        compiler.emit(Opcode::Move, reg, place.base);
+        return reg;
+    }
+    return compiler.load(place);
+}
+
+shared_ptr <Type> VarReference::getBytecodeType(BytecodeCompiler & compiler) {
+    auto symbol = compiler.symbols.find(name);
+    if (symbol == compiler.symbols.end())
+        throw UnknownVarException(name);
+    return symbol->second.type;
+}
+
+Place ArrayItemReference::compileItem(BytecodeCompiler & compiler, int & offset, int & adjustment) {
+    Place base;
+    if (auto outer = dynamic_pointer_cast<ArrayItemReference>(var))
+        base = outer->compileItem(compiler, offset, adjustment);
+    else {
+        base = var->compilePlace(compiler);
+        offset = -1;
+        adjustment = 0;
+    }
+    auto array = var->getBytecodeType(compiler);
+    int low, high = 0, highReg = -1;
+    shared_ptr <Type> element;
+    if (auto open = dynamic_pointer_cast<OpenArray>(array)) {
+        low = 0;
+        highReg = compiler.symbols[name].high;
+        element = open->getElementType();
+    } else if (auto fixed = dynamic_pointer_cast<Array>(array)) {
+        low = fixed->getMinIndex();
+        high = fixed->getMaxIndex();
+        element = fixed->getElementType();
+    } else
+        throw invalid_argument("\"" + name + "\" is not an array\n");
+    int stride = dynamic_pointer_cast<Array>(element) ? element->getScalarCount() : 1;
+
+    int idx = index->compileBytecode(compiler);
+    int constant;
+    bool constantIndex = compiler.takeConstant(idx, constant);
+    if (arrayChecks) {
+        if (constantIndex && highReg < 0 && constant >= low && constant <= high)
+            arrayCheckStats.removed++;
+        else {
+            if (constantIndex) {
+                idx = compiler.allocate();
+                compiler.emit(Opcode::LoadK, idx, constant);
+            }
+            compiler.emit(highReg < 0 ? Opcode::Check : Opcode::CheckR, idx, low, highReg < 0 ? high : highReg);
+            arrayCheckStats.inserted++;
+        }
+    }
+//constant index is folded to adjustment like lower bounds
+    if (constantIndex) {
+        adjustment += (constant - low) * stride;
+        return base;
+    }
+    if (stride != 1) {
+        int scaled = compiler.allocate();
+        compiler.emit(Opcode::MulK, scaled, idx, stride);
+        idx = scaled;
+    }
+    if (offset >= 0) {
+        int sum = compiler.allocate();
+        compiler.emit(Opcode::Add, sum, offset, idx);
+        idx = sum;
+    }
+    offset = idx;
+    adjustment -= low * stride;
+    return base;
+}
+
+Place ArrayItemReference::compilePlace(BytecodeCompiler & compiler) {
+    int offset, adjustment;
+    Place base = compileItem(compiler, offset, adjustment);
+    switch (base.kind) {
+        case Place::Kind::Register:
+            if (offset < 0)
+                return {Place::Kind::Register, base.base + adjustment, 0};
+            return {Place::Kind::LocalItem, base.base + adjustment, offset};
+        case Place::Kind::Global:
+            if (offset < 0)
+                return {Place::Kind::Global, base.base + adjustment, 0};
+            return {Place::Kind::GlobalItem, base.base + adjustment, offset};
+        case Place::Kind::Pointer:
+            if (offset < 0) {
+                offset = compiler.allocate();
+                compiler.emit(Opcode::LoadK, offset, adjustment);
+            } else if (adjustment) {
+                int adjusted = compiler.allocate();
+                compiler.emit(Opcode::AddK, adjusted, offset, adjustment);
+                offset = adjusted;
+            }
+            return {Place::Kind::PointerItem, base.base, offset};
+        default:
+            throw invalid_argument("\"" + name + "\" is not an array\n");
+    }
+}
+
+int ArrayItemReference::compileBytecode(BytecodeCompiler & compiler) {
+    return compiler.load(compilePlace(compiler));
+}
+
+shared_ptr <Type> ArrayItemReference::getBytecodeType(BytecodeCompiler & compiler) {
+    auto array = var->getBytecodeType(compiler);
+    if (auto open = dynamic_pointer_cast<OpenArray>(array))
+        return open->getElementType();
+    if (auto fixed = dynamic_pointer_cast<Array>(array))
+        return fixed->getElementType();
+    throw invalid_argument("\"" + name + "\" is not an array\n");
+}
+
+void Assign::compileBytecode(BytecodeCompiler & compiler) {
+    auto symbol = compiler.symbols.find(left->getName());
+    if (symbol != compiler.symbols.end() && symbol->second.constant)
+        throw invalid_argument("Assignment to const parameter \"" + left->getName() + "\"\n");
+    auto type = left->getBytecodeType(compiler);
+    if (dynamic_pointer_cast<Array>(type)) {
+//whole array is copied
+        auto source = dynamic_pointer_cast<Reference>(right);
+        if (!source)
+            throw invalid_argument("Array \"" + left->getName() + "\" can only be assigned an array\n");
+        int from = compiler.address(source->compilePlace(compiler));
+        int to = compiler.address(left->compilePlace(compiler));
+        compiler.emit(Opcode::Copy, to, from, type->getScalarCount());
+        return;
+    }
+    int value = right->compileBytecode(compiler);
+    if (isBooleanType(type) && !isBooleanType(right->getBytecodeType(compiler))) {
+        int cast = compiler.allocate();
+        compiler.emit(Opcode::NotZero, cast, value);
+        value = cast;
+    }
+    compiler.store(left->compilePlace(compiler), value);
+}
+
+void For::compileBytecode(BytecodeCompiler & compiler) {
+    int top = compiler.getTop();
+    int locals = compiler.getLocals();
+// BOUNDS ARE EVALUATED ONCE, the loop runs |end - start| + 1 times or not at all
+    int iv = compiler.allocateVariable();
+    int end = compiler.allocateVariable();
+    compiler.store({Place::Kind::Register, iv, 0}, startExpr->compileBytecode(compiler));
+    compiler.store({Place::Kind::Register, end, 0}, endExpr->compileBytecode(compiler));
+
+//loop variable is the induction variable unless body changes it
+    set <string> assigned;
+    block->collectAssigned(assigned);
+    block->collectAddressTaken(assigned, nullptr);
+    auto shadowed = compiler.symbols.find(varName);
+    bool hasOuter = shadowed != compiler.symbols.end();
+    Symbol outer = hasOuter ? shadowed->second : Symbol();
+    Symbol symbol;
+    symbol.place = {Place::Kind::Register, assigned.count(varName) ? compiler.allocateVariable() : iv, 0};
+    symbol.type = make_shared<Integer>();
+    compiler.symbols[varName] = symbol;
+
+    int enter = compiler.emit(ascending ? Opcode::JumpGt : Opcode::JumpLt, iv, end);
+    int body = compiler.label();
+    if (symbol.place.base != iv)
+        compiler.emit(Opcode::Move, symbol.place.base, iv);
+    compiler.countHot(true);
+    compiler.loops.emplace_back();
+    block->compileBytecode(compiler);
+    compiler.patch(compiler.loops.back().continues, compiler.label());
+    compiler.emit(ascending ? Opcode::ForUp : Opcode::ForDown, iv, end, body);
+    int after = compiler.label();
+    compiler.patch(compiler.loops.back().breaks, after);
+    compiler.patch({enter}, after);
+    compiler.loops.pop_back();
+
+    if (hasOuter)
+        compiler.symbols[varName] = outer;
+    else
+        compiler.symbols.erase(varName);
+    compiler.release(top, locals);
+}
+
+void While::compileBytecode(BytecodeCompiler & compiler) {
+//condition is at the bottom, one branch per iteration
+    int enter = compiler.emit(Opcode::Jump);
+    int body = compiler.label();
+    compiler.countHot(true);
+    compiler.loops.emplace_back();
+    block->compileBytecode(compiler);
+    int check = compiler.label();
+    compiler.patch(compiler.loops.back().continues, check);
+    compiler.patch({enter}, check);
+    vector <int> loop;
+    condition->compileBranch(compiler, true, loop);
+    compiler.patch(loop, body);
+    compiler.patch(compiler.loops.back().breaks, compiler.label());
+    compiler.loops.pop_back();
+}
+
+void If::compileBytecode(BytecodeCompiler & compiler) {
+    vector <int> skip;
+    condition->compileBranch(compiler, false, skip);
+    ifBlock->compileBytecode(compiler);
+    if (elseBlock != nullptr) {
+        int over = compiler.emit(Opcode::Jump);
+        compiler.patch(skip, compiler.label());
+        elseBlock->compileBytecode(compiler);
+        compiler.patch({over}, compiler.label());
+    } else
+        compiler.patch(skip, compiler.label());
+}
+
+/**
+ * @brief Registers parameter takes in frame of callee, open arrays are followed by their high bound
+ */
+static int getParamSlots(const shared_ptr <Var> & param) {
+    if (!param->isReference())
+        return param->getType()->getScalarCount();
+    return dynamic_pointer_cast<OpenArray>(param->getType()) ? 2 : 1;
+}
+
+/**
+ * @brief Pure function may only call pure functions, output and input are not pure
+ */
+static void checkPureCall(BytecodeCompiler & compiler, const string & callee, bool pure = false) {
+    if (compiler.pure && !pure)
+        throw invalid_argument("Pure function \"" + compiler.program.functions[compiler.getFunction()].name +
+                               "\" calls \"" + callee + "\" which is not pure\n");
+}
+
+shared_ptr <Type> FunctionCall::getBytecodeType(BytecodeCompiler & compiler) {
+    if (name == "dec" || name == "readarray")
+        return nullptr;
+    if (name == "eof")
+        return make_shared<Boolean>();
+    if (name == "low" || name == "high" || name == "write" || name == "writeln" || name == "readln")
+        return make_shared<Integer>();
+    auto function = compiler.functions.find(name);
+    if (function == compiler.functions.end())
+        throw invalid_argument("Call to unknown function \"" + name + "\"\n");
+    return function->second.returnType;
+}
+
+// one item of write or writeln, the same runtime function as in LLVM IR is checked for purity
+static void writeItem(BytecodeCompiler & compiler, const shared_ptr <Expression> & item, bool newLine) {
+    if (auto text = dynamic_pointer_cast<String>(item)) {
+        checkPureCall(compiler, newLine ? "writelnStr" : "writeStr");
+        compiler.program.strings.push_back(text->getValue());
+        compiler.emit(newLine ? Opcode::WriteLnStr : Opcode::WriteStr, (int) compiler.program.strings.size() - 1);
+        return;
+    }
+    auto type = item->getBytecodeType(compiler);
+    if (!dynamic_pointer_cast<Integer>(type) && !dynamic_pointer_cast<Boolean>(type))
+        throw invalid_argument("Only integers and strings can be written\n");
+    int value = item->compileBytecode(compiler);
+    checkPureCall(compiler, newLine ? "writeln" : "write");
+    compiler.emit(newLine ? Opcode::WriteLn : Opcode::Write, value);
+}
+
+// readarray(a, low, high), the same bounds are checked as in LLVM IR
+static void compileReadArray(BytecodeCompiler & compiler, const vector <shared_ptr<Expression>> & params) {
+    auto array = params.size() == 3 ? dynamic_pointer_cast<Reference>(params[0]) : nullptr;
+    auto type = array ? array->getBytecodeType(compiler) : nullptr;
+    auto fixed = dynamic_pointer_cast<Array>(type);
+    auto open = dynamic_pointer_cast<OpenArray>(type);
+    if (!dynamic_pointer_cast<Integer>(fixed ? fixed->getElementType() : open ? open->getElementType() : nullptr))
+        throw invalid_argument("readarray needs an array of integers and bounds of items to read\n");
+    auto symbol = compiler.symbols.find(array->getName());
+    if (symbol != compiler.symbols.end() && symbol->second.constant)
+        throw invalid_argument("Const parameter \"" + array->getName() + "\" can not be modified\n");
+    int low = params[1]->compileBytecode(compiler);
+    int high = params[2]->compileBytecode(compiler);
+    int skip = compiler.emit(Opcode::JumpLt, high, low);
+    int first = compiler.address(ArrayItemReference(array, make_shared<LoweredValue>(low)).compilePlace(compiler));
+    if (arrayChecks)
+        ArrayItemReference(array, make_shared<LoweredValue>(high)).compilePlace(compiler);
+    int count = compiler.allocate();
+    compiler.emit(Opcode::Sub, count, high, low);
+    compiler.emit(Opcode::AddK, count, count, 1);
+    checkPureCall(compiler, "readArray");
+    compiler.emit(Opcode::ReadArray, first, count);
+    compiler.patch({skip}, compiler.label());
+}
+
+int FunctionCall::compileBytecode(BytecodeCompiler & compiler) {
+    auto var = params.size() == 1 ? dynamic_pointer_cast<Reference>(params[0]) : nullptr;
+    if (name == "readln" && params.size() > 1) {
+        for (auto & param: params)
+            FunctionCall(name, {param}).compileBytecode(compiler);
+        return compiler.allocate();
+    }
+    if (name == "readarray") {
+        compileReadArray(compiler, params);
+        return compiler.allocate();
+    }
+    if (name == "eof") {
+        if (!params.empty())
+            throw invalid_argument("Call to function \"eof\" with wrong number of parameters. Got " +
+                                   to_string(params.size()) + " expected 0\n");
+        checkPureCall(compiler, name);
+        int reg = compiler.allocate();
+        compiler.emit(Opcode::Eof, reg);
+        return reg;
+    }
+    if (name == "write" || name == "writeln") {
+        if (params.empty() && name == "write")
+            throw invalid_argument("Call to function \"write\" with wrong number of parameters. Got 0 expected 1\n");
+        if (params.empty())
+            writeItem(compiler, make_shared<String>(""), true);
+        for (size_t i = 0; i < params.size(); ++i)
+            writeItem(compiler, params[i], name == "writeln" && i + 1 == params.size());
+        return compiler.allocate();
+    }
+    if ((name == "dec" || name == "readln") && var) {
+        auto symbol = compiler.symbols.find(var->getName());
+        if (symbol != compiler.symbols.end() && symbol->second.constant)
+            throw invalid_argument("Const parameter \"" + var->getName() + "\" can not be modified\n");
+        Place place = var->compilePlace(compiler);
+        if (name == "readln") {
+            int address = compiler.address(place);
+            checkPureCall(compiler, name);
+            compiler.emit(Opcode::Read, address);
+        }
+        else {
+            int value = compiler.load(place);
+            int decremented = compiler.allocate();
+            compiler.emit(Opcode::SubK, decremented, value, 1);
+            compiler.store(place, decremented);
+        }
+        return compiler.allocate();
+    }
+    if ((name == "low" || name == "high") && var && (dynamic_pointer_cast<Array>(var->getBytecodeType(compiler)) ||
+                                                     dynamic_pointer_cast<OpenArray>(var->getBytecodeType(compiler)))) {
+//array bounds, open arrays are indexed from 0 and their high bound is passed with them
+        auto array = dynamic_pointer_cast<Array>(var->getBytecodeType(compiler));
+        if (!array && name == "high")
+            return compiler.symbols[var->getName()].high;
+        int reg = compiler.allocate();
+        compiler.emit(Opcode::LoadK, reg, !array ? 0 : name == "low" ? array->getMinIndex() : array->getMaxIndex());
+        return reg;
+    }
+
+    auto function = compiler.functions.find(name);
+    if (function == compiler.functions.end())
+        throw invalid_argument("Call to unknown function \"" + name + "\"\n");
+    Signature signature = function->second;
+    if (params.size() != signature.params.size())
+        throw invalid_argument("Call to function \"" + name + "\" with wrong number of parameters. Got " + to_string(params.size()) + " expected " + to_string(signature.params.size()) + "\n");
+
+//ARGUMENTS are put right to registers where frame of callee starts
+    int base = compiler.getTop();
+    int slots = 0;
+    for (auto & param: signature.params)
+        slots += getParamSlots(param);
+    compiler.allocate(slots);
+    int slot = base;
+    for (size_t i = 0; i < params.size(); i++) {
+        auto & param = signature.params[i];
+        auto type = param->getType();
+        auto ref = dynamic_pointer_cast<Reference>(params[i]);
+        if (!param->isReference() && !dynamic_pointer_cast<Array>(type)) {
+            int value = params[i]->compileBytecode(compiler);
+            if (isBooleanType(type) && !isBooleanType(params[i]->getBytecodeType(compiler))) {
+                int cast = compiler.allocate();
+                compiler.emit(Opcode::NotZero, cast, value);
+                value = cast;
+            }
+            compiler.store({Place::Kind::Register, slot, 0}, value);
+            slot += getParamSlots(param);
+            continue;
+        }
+        if (!ref)
+            throw invalid_argument("Parameter " + to_string(i + 1) + " of \"" + name + "\" has to be a variable\n");
+        auto symbol = compiler.symbols.find(ref->getName());
+        if (param->isReference() && param->getMode() != ParamMode::Const && symbol != compiler.symbols.end() &&
+            symbol->second.constant)
+            throw invalid_argument("Const parameter \"" + ref->getName() + "\" can not be modified by \"" + name + "\"\n");
+        int address = compiler.address(ref->compilePlace(compiler));
+        if (!param->isReference()) {
+//array passed by value is copied to frame of callee
+            int to = compiler.allocate();
+            compiler.emit(Opcode::Addr, to, slot);
+            compiler.emit(Opcode::Copy, to, address, type->getScalarCount());
+        } else
+            compiler.store({Place::Kind::Register, slot, 0}, address);
+        if (dynamic_pointer_cast<OpenArray>(type)) {
+//any array can be passed as open array, it is indexed from 0 so high bound is number of items - 1
+            auto argType = ref->getBytecodeType(compiler);
+            if (auto array = dynamic_pointer_cast<Array>(argType)) {
+                int high = compiler.allocate();
+                compiler.emit(Opcode::LoadK, high, array->getMaxIndex() - array->getMinIndex());
+                compiler.store({Place::Kind::Register, slot + 1, 0}, high);
+            } else if (dynamic_pointer_cast<OpenArray>(argType))
+                compiler.store({Place::Kind::Register, slot + 1, 0}, compiler.symbols[ref->getName()].high);
+            else
+                throw invalid_argument("Parameter " + to_string(i + 1) + " of \"" + name + "\" has wrong type\n");
+        }
+        slot += getParamSlots(param);
+    }
+    checkPureCall(compiler, name, compiler.program.functions[signature.index].pure);
+    compiler.markCalled(signature.index);
+    compiler.emit(Opcode::Call, base, signature.index, base);
+    compiler.release(base + 1, compiler.getLocals());
+    return base;
+}
+
+void ProcedureCall::compileBytecode(BytecodeCompiler & compiler) {
+    FunctionCall(name, params).compileBytecode(compiler);
+}
+
+/**
+ * @brief Registers of parameters at start of frame, symbols are bound by caller
+ */
+static vector <Symbol> allocateParams(BytecodeCompiler & compiler, const string & name,
+                                      const vector <shared_ptr<Var>> & params) {
+    vector <Symbol> symbols;
+    for (auto & param: params) {
+        Symbol symbol;
+        symbol.type = param->getType();
+        if (!param->isReference())
+            symbol.place = {Place::Kind::Register, compiler.allocateVariable(getParamSlots(param)), 0};
+        else {
+            if (param->getMode() == ParamMode::Value)
+                throw invalid_argument("Open array parameter \"" + param->getName() + "\" of \"" + name + "\" has to be var or const\n");
+            symbol.place = {Place::Kind::Pointer, compiler.allocateVariable(), 0};
+            if (dynamic_pointer_cast<OpenArray>(param->getType()))
+                symbol.high = compiler.allocateVariable();
+            symbol.constant = param->getMode() == ParamMode::Const;
+        }
+        symbols.push_back(symbol);
+    }
+    return symbols;
+}
+
+/**
+ * @brief Binds parameters, declares local variables and compiles body, caller binds result variable first
+ */
+static void compileBody(BytecodeCompiler & compiler, const vector <shared_ptr<Var>> & params,
+                        const vector <Symbol> & paramSymbols, const vector <shared_ptr<Var>> & localVars,
+                        shared_ptr <Block> block) {
+    for (size_t i = 0; i < params.size(); i++)
+        compiler.symbols[params[i]->getName()] = paramSymbols[i];
+    for (auto & var: localVars)
+        var->compileBytecode(compiler);
+    block->collectAddressTaken(compiler.addressTaken, nullptr);
+    block->compileBytecode(compiler);
+}
+
+void Function::compileBytecode(BytecodeCompiler & compiler) {
+    int index = compiler.declareFunction(name, params, returnType);
+    if (block == nullptr)
+        return;
+    if (pure) {
+        for (auto & param: params)
+            if (!dynamic_pointer_cast<Integer>(param->getType()) || param->isReference())
+                throw invalid_argument("Pure function \"" + name + "\" can only have integer value parameters\n");
+        if (dynamic_pointer_cast<Array>(returnType))
+            throw invalid_argument("Pure function \"" + name + "\" can not return array\n");
+    }
+    if (dynamic_pointer_cast<Array>(returnType))
+        throw invalid_argument("Function \"" + name + "\" returning array can not be compiled to bytecode\n");
+    auto scope = compiler.symbols;
+    compiler.beginFunction(index);
+    compiler.program.functions[index].pure = compiler.pure = pure;
+    compiler.countHot(false);
+    auto paramSymbols = allocateParams(compiler, name, params);
+    compiler.program.functions[index].paramSlots = compiler.getTop();
+//result variable
+    Symbol result;
+    result.place = {Place::Kind::Register, compiler.allocateVariable(), 0};
+    result.type = returnType;
+    compiler.symbols[name] = result;
+    compiler.result = result.place.base;
+    compileBody(compiler, params, paramSymbols, localVars, block);
+    compiler.emit(Opcode::Return, compiler.result);
+    compiler.endFunction();
+    compiler.symbols = scope;
+}
+
+void Procedure::compileBytecode(BytecodeCompiler & compiler) {
+    int index = compiler.declareFunction(name, params, nullptr);
+    if (block == nullptr)
+        return;
+    auto scope = compiler.symbols;
+    compiler.beginFunction(index);
+    compiler.countHot(false);
+    auto paramSymbols = allocateParams(compiler, name, params);
+    compiler.program.functions[index].paramSlots = compiler.getTop();
+    compileBody(compiler, params, paramSymbols, localVars, block);
+    compiler.emit(Opcode::ReturnVoid);
+    compiler.endFunction();
+    compiler.symbols = scope;
+}
+
+void Program::compileBytecode(BytecodeCompiler & compiler) {
+//predefined boolean constants
+    Symbol constant;
+    constant.type = make_shared<Boolean>();
+    constant.place = {Place::Kind::Constant, 1, 0};
+    compiler.symbols["true"] = constant;
+    constant.place = {Place::Kind::Constant, 0, 0};
+    compiler.symbols["false"] = constant;
+}
+
+static void rangeError(int index, int low, int high) {
+    fflush(stdout);
+    fprintf(stderr, "Array index %d out of bounds %d..%d\n", index, low, high);
+    exit(1);
+}
+
+// eof of compiled program, white space is skipped
+static bool atEndOfInput() {
+    int c;
+    while ((c = getchar()) != EOF && isspace(c));
+    if (c == EOF)
+        return true;
+    ungetc(c, stdin);
+    return false;
+}
+
+const int maxStack = 1 << 26;       // frames of called functions in 4 byte words
+
+/**
+ * @brief Slot of memo table of pure function, the same direct mapped table with fibonacci hashing as compiled code uses
+ *
+ * Slot is valid flag, result and arguments.
+ */
+static int32_t * getMemoSlot(vector <int32_t> & table, int params, const int32_t * args) {
+    if (table.empty())
+        table.resize((size_t) memoSize * (params + 2));
+    uint32_t hash = 0;
+    for (int i = 0; i < params; i++)
+        hash = (hash ^ (uint32_t) args[i]) * 0x9E3779B1u;
+    int bits = 0;
+    while ((1 << bits) < memoSize)
+        ++bits;
+    uint32_t index = bits ? hash >> (32 - bits) : 0;
+    return table.data() + (size_t) index * (params + 2);
+}
+
+/**
+ * @brief Runs program with computed goto dispatch, every handler jumps straight to handler of next instruction
+ *
+ * Memory holds globals and frames of called functions, frame of callee starts at registers with arguments in frame
+ * of caller. Arithmetic wraps around like in generated code, output and input are the same as in runtime of compiled
+ * programs.
+ */
+Tiering::Tiering(size_t functions, uint32_t callThreshold, uint32_t loopThreshold) : calls(functions),
+                                                                                    loops(functions),
+                                                                                    natives(new atomic<NativeFunction>[functions]),
+                                                                                    callThreshold(callThreshold),
+                                                                                    loopThreshold(loopThreshold) {
+    for (size_t i = 0; i < functions; i++)
+        natives[i] = nullptr;
+}
+
+static void stackOverflow() {
+    fflush(stdout);
+    fprintf(stderr, "Stack overflow\n");
+    exit(1);
+}
+
+int runBytecode(const BytecodeProgram & program, Tiering * tiering) {
+    static const void * handlers[] = {
+#define MILA_OPCODE_LABEL(name) &&op_##name,
+            MILA_OPCODES(MILA_OPCODE_LABEL)
+#undef MILA_OPCODE_LABEL
+    };
+    struct Frame {
+        const Instruction * pc;
+        const Instruction * code;
+        int fp;
+        bool memoized;      // call of pure function, its result goes to memo table
+    };
+    vector <Frame> frames;
+    vector <vector<int32_t>> memos(program.functions.size());
+    vector <int32_t> memoArgs;  // arguments of running pure calls, slot is filled with them
+//memory is allocated once, pages are zeroed lazily by system, native code of tiered execution points into it
+    int fp = program.globalSize;
+    int limit = fp + maxStack;
+    unique_ptr <int32_t, decltype(&free)> memory((int32_t *) calloc(limit, sizeof(int32_t)), &free);
+    if (!memory)
+        stackOverflow();
+    int32_t * mem = memory.get();
+    if (tiering)
+        tiering->memory = mem;
+    const BytecodeFunction & main = program.functions[program.main];
+    if (fp + main.frameSize > limit)
+        stackOverflow();
+    int32_t * r = mem + fp;
+    const Instruction * code = main.code.data();
+    const Instruction * pc = code;
+
+#define DISPATCH() goto *handlers[(int) pc->op]
+#define NEXT() do { ++pc; DISPATCH(); } while (0)
+#define JUMP(target) do { pc = code + (target); DISPATCH(); } while (0)
+#define ARITHMETIC(name, operation, operand) \
+    op_##name: r[pc->a] = (int32_t) ((uint32_t) r[pc->b] operation (uint32_t) (operand)); NEXT();
+#define COMPARE(name, operation) \
+    op_##name: r[pc->a] = r[pc->b] operation r[pc->c]; NEXT(); \
+    op_Jump##name: if (r[pc->a] operation r[pc->b]) JUMP(pc->c); NEXT(); \
+    op_Jump##name##K: if (r[pc->a] operation pc->b) JUMP(pc->c); NEXT();
+
+    DISPATCH();
+    op_Move: r[pc->a] = r[pc->b]; NEXT();
+    op_LoadK: r[pc->a] = pc->b; NEXT();
+    op_LoadG: r[pc->a] = mem[pc->b]; NEXT();
+    op_StoreG: mem[pc->a] = r[pc->b]; NEXT();
+    op_LoadP: r[pc->a] = mem[r[pc->b]]; NEXT();
+    op_StoreP: mem[r[pc->a]] = r[pc->b]; NEXT();
+    op_Addr: r[pc->a] = fp + pc->b; NEXT();
+    op_LoadItemL: r[pc->a] = r[pc->b + r[pc->c]]; NEXT();
+    op_StoreItemL: r[pc->a + r[pc->b]] = r[pc->c]; NEXT();
+    op_LoadItemG: r[pc->a] = mem[pc->b + r[pc->c]]; NEXT();
+    op_StoreItemG: mem[pc->a + r[pc->b]] = r[pc->c]; NEXT();
+    op_LoadItemP: r[pc->a] = mem[r[pc->b] + r[pc->c]]; NEXT();
+    op_StoreItemP: mem[r[pc->a] + r[pc->b]] = r[pc->c]; NEXT();
+    op_Copy: memmove(mem + r[pc->a], mem + r[pc->b], pc->c * sizeof(int32_t)); NEXT();
+    ARITHMETIC(Add, +, r[pc->c])
+    ARITHMETIC(Sub, -, r[pc->c])
+    ARITHMETIC(Mul, *, r[pc->c])
+    op_Div: r[pc->a] = r[pc->b] / r[pc->c]; NEXT();
+    op_Mod: r[pc->a] = r[pc->b] % r[pc->c]; NEXT();
+    op_DivK: r[pc->a] = r[pc->b] / pc->c; NEXT();
+    op_ModK: r[pc->a] = r[pc->b] % pc->c; NEXT();
+    op_And: r[pc->a] = r[pc->b] & r[pc->c]; NEXT();
+    op_Or: r[pc->a] = r[pc->b] | r[pc->c]; NEXT();
+    op_Xor: r[pc->a] = r[pc->b] ^ r[pc->c]; NEXT();
+    ARITHMETIC(AddK, +, pc->c)
+    ARITHMETIC(SubK, -, pc->c)
+    ARITHMETIC(MulK, *, pc->c)
+    op_AddG: mem[pc->a] = (int32_t) ((uint32_t) mem[pc->a] + (uint32_t) r[pc->b]); NEXT();
+    op_SubG: mem[pc->a] = (int32_t) ((uint32_t) mem[pc->a] - (uint32_t) r[pc->b]); NEXT();
+    op_AddGK: mem[pc->a] = (int32_t) ((uint32_t) mem[pc->a] + (uint32_t) pc->b); NEXT();
+    op_Neg: r[pc->a] = (int32_t) (0u - (uint32_t) r[pc->b]); NEXT();
+    op_Not: r[pc->a] = ~r[pc->b]; NEXT();
+    op_BoolNot: r[pc->a] = r[pc->b] == 0; NEXT();
+    op_NotZero: r[pc->a] = r[pc->b] != 0; NEXT();
+    COMPARE(Eq, ==)
+    COMPARE(Ne, !=)
+    COMPARE(Lt, <)
+    COMPARE(Le, <=)
+    COMPARE(Gt, >)
+    COMPARE(Ge, >=)
+    op_Jump: JUMP(pc->a);
+    op_JumpZ: if (!r[pc->a]) JUMP(pc->b); NEXT();
+    op_JumpNZ: if (r[pc->a]) JUMP(pc->b); NEXT();
+    op_ForUp: if (r[pc->a] != r[pc->b]) { r[pc->a]++; JUMP(pc->c); } NEXT();
+    op_ForDown: if (r[pc->a] != r[pc->b]) { r[pc->a]--; JUMP(pc->c); } NEXT();
+    op_Check: if (r[pc->a] < pc->b || r[pc->a] > pc->c) rangeError(r[pc->a], pc->b, pc->c); NEXT();
+    op_CheckR: if (r[pc->a] < pc->b || r[pc->a] > r[pc->c]) rangeError(r[pc->a], pc->b, r[pc->c]); NEXT();
+    op_Call: {
+        const BytecodeFunction & callee = program.functions[pc->b];
+        if (tiering) {
+            if (NativeFunction native = tiering->natives[pc->b].load(memory_order_acquire)) {
+                r[pc->a] = native(mem, r + pc->c);
+                NEXT();
+            }
+        }
+        if (callee.pure) {
+            int32_t * memo = getMemoSlot(memos[pc->b], callee.paramSlots, r + pc->c);
+            if (memo[0] && equal(r + pc->c, r + pc->c + callee.paramSlots, memo + 2)) {
+                r[pc->a] = memo[1];
+                NEXT();
+            }
+            memoArgs.insert(memoArgs.end(), r + pc->c, r + pc->c + callee.paramSlots);
+        }
+        frames.push_back({pc, code, fp, callee.pure});
+        fp += pc->c;
+        if (fp + callee.frameSize > limit)
+            stackOverflow();
+        r = mem + fp;
+//arguments are in place, variables start zeroed
+        fill(r + callee.paramSlots, r + callee.frameSize, 0);
+        code = pc = callee.code.data();
+        DISPATCH();
+    }
+    op_TailCall: {
+        const BytecodeFunction & callee = program.functions[pc->b];
+        if (tiering) {
+//Return of the result follows
+            if (NativeFunction native = tiering->natives[pc->b].load(memory_order_acquire)) {
+                r[pc->a] = native(mem, r + pc->c);
+                NEXT();
+            }
+        }
+        if (fp + callee.frameSize > limit)
+            stackOverflow();
+        memmove(r, r + pc->c, callee.paramSlots * sizeof(int32_t));
+        fill(r + callee.paramSlots, r + callee.frameSize, 0);
+        code = pc = callee.code.data();
+        DISPATCH();
+    }
+    op_Return:
+    op_ReturnVoid: {
+        int32_t value = pc->op == Opcode::Return ? r[pc->a] : 0;
+        if (frames.empty())
+            return value;
+        Frame & frame = frames.back();
+        pc = frame.pc;
+        code = frame.code;
+        fp = frame.fp;
+        r = mem + fp;
+        r[pc->a] = value;
+        if (frame.memoized) {
+//slot is filled with arguments the call started with, body could change its parameters
+            const BytecodeFunction & callee = program.functions[pc->b];
+            int32_t * slot = getMemoSlot(memos[pc->b], callee.paramSlots, memoArgs.data() + memoArgs.size() - callee.paramSlots);
+            if (memoEviction == MemoEviction::Replace || !slot[0]) {
+                slot[0] = 1;
+                slot[1] = value;
+                copy(memoArgs.end() - callee.paramSlots, memoArgs.end(), slot + 2);
+            }
+            memoArgs.resize(memoArgs.size() - callee.paramSlots);
+        }
+        frames.pop_back();
+        NEXT();
+    }
+    op_Write: printf("%d", r[pc->a]); NEXT();
+    op_WriteLn: printf("%d\n", r[pc->a]); NEXT();
+    op_WriteStr: printf("%s", program.strings[pc->a].c_str()); NEXT();
+    op_WriteLnStr: printf("%s\n", program.strings[pc->a].c_str()); NEXT();
+    op_Read: scanf("%d", mem + r[pc->a]); NEXT();
+    op_ReadArray:
+        for (int i = 0; i < r[pc->b]; ++i)
+            scanf("%d", mem + r[pc->a] + i);
+        NEXT();
+    op_Eof: r[pc->a] = atEndOfInput(); NEXT();
+    op_Count:
+        if (pc->b ? ++tiering->loops[pc->a] == tiering->loopThreshold
+                  : ++tiering->calls[pc->a] == tiering->callThreshold)
+            tiering->promote(pc->a);
+        NEXT();
+
+#undef COMPARE
+#undef ARITHMETIC
+#undef JUMP
+#undef NEXT
+#undef DISPATCH
+}
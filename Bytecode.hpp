@@ -0,0 +1,233 @@
+//
+// Register based bytecode compiled from the AST and the VM which runs it, no LLVM is involved
+//
+
+#ifndef MILA_BYTECODE_HPP
+#define MILA_BYTECODE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class Type;
+class Var;
+
+/*
+ * Operands a, b, c are registers of the current frame (r[x]), immediates, absolute addresses of memory (mem[x]) or
+ * positions in code of the function. Registers are memory too, r[x] is mem[fp + x], so address of register is fp + x.
+ */
+#define MILA_OPCODES(X) \
+    X(Move)         /* r[a] = r[b] */ \
+    X(LoadK)        /* r[a] = b */ \
+    X(LoadG)        /* r[a] = mem[b] */ \
+    X(StoreG)       /* mem[a] = r[b] */ \
+    X(LoadP)        /* r[a] = mem[r[b]] */ \
+    X(StoreP)       /* mem[r[a]] = r[b] */ \
+    X(Addr)         /* r[a] = address of r[b] */ \
+    X(LoadItemL)    /* r[a] = r[b + r[c]] */ \
+    X(StoreItemL)   /* r[a + r[b]] = r[c] */ \
+    X(LoadItemG)    /* r[a] = mem[b + r[c]] */ \
+    X(StoreItemG)   /* mem[a + r[b]] = r[c] */ \
+    X(LoadItemP)    /* r[a] = mem[r[b] + r[c]] */ \
+    X(StoreItemP)   /* mem[r[a] + r[b]] = r[c] */ \
+    X(Copy)         /* c items from mem[r[b]] to mem[r[a]] */ \
+    X(Add) X(Sub) X(Mul) X(Div) X(Mod) X(And) X(Or) X(Xor)  /* r[a] = r[b] op r[c] */ \
+    X(AddK) X(SubK) X(MulK) X(DivK) X(ModK)                 /* r[a] = r[b] op c */ \
+    X(AddG) X(SubG) X(AddGK)                                /* mem[a] = mem[a] op r[b] or b, load-add-store */ \
+    X(Neg) X(Not) X(BoolNot) X(NotZero)                     /* r[a] = op r[b] */ \
+    X(Eq) X(Ne) X(Lt) X(Le) X(Gt) X(Ge)                     /* r[a] = r[b] cmp r[c] */ \
+    X(Jump)                                                 /* goto a */ \
+    X(JumpZ) X(JumpNZ)                                      /* if r[a] == 0 or != 0 goto b */ \
+    X(JumpEq) X(JumpNe) X(JumpLt) X(JumpLe) X(JumpGt) X(JumpGe)         /* if r[a] cmp r[b] goto c */ \
+    X(JumpEqK) X(JumpNeK) X(JumpLtK) X(JumpLeK) X(JumpGtK) X(JumpGeK)   /* if r[a] cmp b goto c */ \
+    X(ForUp) X(ForDown)     /* if r[a] != r[b] step r[a] by one and goto c, end of for loop */ \
+    X(Check)                /* r[a] out of b .. c stops program */ \
+    X(CheckR)               /* r[a] out of b .. r[c] stops program, open arrays */ \
+    X(Call)                 /* r[a] = function b, its frame starts at register c where arguments are */ \
+    X(TailCall)             /* return function b, arguments at register c move to start of the frame */ \
+    X(Return)               /* return r[a] */ \
+    X(ReturnVoid) \
+    X(Write) X(WriteLn)     /* print r[a] */ \
+    X(WriteStr) X(WriteLnStr) /* print string a */ \
+    X(Read)                 /* read mem[r[a]] */ \
+    X(ReadArray)            /* read r[b] items to mem[r[a]] */ \
+    X(Eof)                  /* r[a] = 1 when only white space is left in input */ \
+    X(Count)                /* count call of function a (b = 0) or loop iteration in it (b = 1), tiered execution */
+
+enum class Opcode : uint8_t {
+#define MILA_OPCODE_ENUM(name) name,
+    MILA_OPCODES(MILA_OPCODE_ENUM)
+#undef MILA_OPCODE_ENUM
+};
+
+struct Instruction {
+    Opcode op;
+    int a, b, c;
+};
+
+struct BytecodeFunction {
+    string name;
+    vector <Instruction> code;
+    int paramSlots = 0;     // registers with arguments, the rest of frame is zeroed on call
+    int frameSize = 0;      // registers of variables and temporaries
+    bool defined = false;
+    bool pure = false;      // calls are memoized in table like in compiled program
+    vector <shared_ptr<Var>> params;
+};
+
+struct BytecodeProgram {
+    vector <BytecodeFunction> functions;
+    vector <string> strings;
+    int globalSize = 0;     // globals are at the start of memory
+    map <string, int> globals;  // address of global variables
+    int main = -1;
+
+    void dump(ostream & out) const;
+};
+
+// native code of function, arguments are registers of VM where frame of callee would start
+typedef int32_t (* NativeFunction)(int32_t * memory, int32_t * args);
+
+/**
+ * @brief Tiered execution, VM counts calls and loop iterations of functions and switches to native code of hot ones
+ *
+ * Counts are kept only when the program is compiled with Count instructions. Native code is published by another
+ * thread, the VM picks it up at the next call of the function.
+ */
+class Tiering {
+public:
+    vector <uint32_t> calls;
+    vector <uint32_t> loops;
+    unique_ptr <atomic<NativeFunction>[]> natives;
+    uint32_t callThreshold;
+    uint32_t loopThreshold;
+    int32_t * memory = nullptr;     // memory of VM, it does not move while program runs
+
+    Tiering(size_t functions, uint32_t callThreshold, uint32_t loopThreshold);
+
+    virtual ~Tiering() = default;
+
+    // function reached a threshold, called once for every function
+    virtual void promote(int function) = 0;
+};
+
+// runs program, returns result of main
+int runBytecode(const BytecodeProgram & program, Tiering * tiering = nullptr);
+
+// where value of variable, array item or constant is
+struct Place {
+    enum class Kind {
+        Register,       // r[base], local variable, local array starts there
+        Global,         // mem[base]
+        Pointer,        // mem[r[base]], var and const parameters
+        LocalItem,      // r[base + r[offset]]
+        GlobalItem,     // mem[base + r[offset]]
+        PointerItem,    // mem[r[base] + r[offset]]
+        Constant        // base is the value
+    } kind;
+    int base;
+    int offset;
+};
+
+// name visible in compiled code
+struct Symbol {
+    Place place;
+    shared_ptr <Type> type;
+    int high = -1;          // register with high bound of open array parameter
+    bool constant = false;  // const parameter, it can not be modified
+};
+
+// function or procedure known to calls, procedures have no return type
+struct Signature {
+    int index;
+    vector <shared_ptr<Var>> params;
+    shared_ptr <Type> returnType;
+};
+
+/**
+ * @brief State of compilation of AST to bytecode, nodes compile themselves through it
+ *
+ * Registers are allocated like a stack, variables first and temporaries of statement above them. Temporaries are
+ * released after each statement. Arguments of calls are put to consecutive registers at top of the stack, the frame
+ * of callee starts there, so they are passed without copying.
+ */
+class BytecodeCompiler {
+    int current = -1;       // function being compiled
+    int top = 0;            // first free register
+    int locals = 0;         // registers below are variables, above are temporaries
+    int barrier = 0;        // code before is jump target or jumps over, peephole does not look past it
+    set <int> called;       // functions which are called
+
+    bool isTemp(int reg) const { return reg >= locals; }
+
+    vector <Instruction> & code() { return program.functions[current].code; }
+public:
+    BytecodeProgram program;
+    map <string, Symbol> symbols;
+    map <string, Signature> functions;
+    set <string> addressTaken;  // variables of current function passed by reference, reading them copies the value
+    int result = -1;            // register of result variable of current function, -1 in procedures
+    bool pure = false;          // current function is pure, it can not use globals or call impure functions
+    bool countHotness = false;  // Count instructions at start of functions and loop bodies, for tiered execution
+
+    struct Loop {
+        vector <int> breaks;
+        vector <int> continues;
+    };
+    vector <Loop> loops;
+
+    // function index, signature is declared at first declaration
+    int declareFunction(const string & name, const vector <shared_ptr<Var>> & params, shared_ptr <Type> returnType);
+
+    void beginFunction(int index);
+
+    void endFunction();
+
+    // registers of variables which live until end of function or enclosing for loop
+    int allocateVariable(int count = 1);
+
+    int allocate(int count = 1);
+
+    int getTop() const { return top; }
+
+    int getFunction() const { return current; }
+
+    // releases temporaries and variables above top
+    void release(int top, int locals);
+
+    int getLocals() const { return locals; }
+
+    int emit(Opcode op, int a = 0, int b = 0, int c = 0);
+
+    // position of next instruction as jump target
+    int label();
+
+    void patch(const vector <int> & jumps, int target);
+
+    // LoadK of temporary just emitted is removed, the constant is used as immediate operand
+    bool takeConstant(int reg, int & value);
+
+    // register holding value, for Register place the variable register itself
+    int load(const Place & place);
+
+    void store(const Place & place, int reg);
+
+    // register holding absolute address
+    int address(const Place & place);
+
+    void markCalled(int index) { called.insert(index); }
+
+    // Count instruction when hotness is counted
+    void countHot(bool loop);
+
+    BytecodeProgram finish();
+};
+
+#endif //MILA_BYTECODE_HPP
@@ -0,0 +1,115 @@
+#include "Server.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+bool writeAll(int fd, const void * data, size_t size) {
+    const char * bytes = (const char *) data;
+    while (size) {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool readAll(int fd, void * data, size_t size) {
+    char * bytes = (char *) data;
+    while (size) {
+        ssize_t got = read(fd, bytes, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        bytes += got;
+        size -= got;
+    }
+    return true;
+}
+
+bool setAddress(const string & socketPath, sockaddr_un & address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        cerr << "Socket path is too long: " << socketPath << endl;
+        return false;
+    }
+    strcpy(address.sun_path, socketPath.c_str());
+    return true;
+}
+
+static void appendString(string & message, const string & text) {
+    uint32_t size = text.size();
+    message.append((const char *) &size, sizeof(size));
+    message += text;
+}
+
+int runClient(const string & socketPath, int argc, char * argv[]) {
+    sockaddr_un address;
+    if (!setAddress(socketPath, address))
+        return 1;
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0 || connect(server, (sockaddr *) &address, sizeof(address)) != 0) {
+        cerr << "Can not connect to compile server " << socketPath << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    char directory[PATH_MAX];
+    if (!getcwd(directory, sizeof(directory))) {
+        cerr << "Can not get working directory: " << strerror(errno) << endl;
+        return 1;
+    }
+    string message;
+    uint32_t count = argc + 1;
+    message.append((const char *) &count, sizeof(count));
+    appendString(message, directory);
+    for (int i = 0; i < argc; ++i)
+        appendString(message, argv[i]);
+
+//the first byte carries stdin, stdout and stderr
+    int descriptors[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    char control[CMSG_SPACE(sizeof(descriptors))] = {};
+    iovec data = {&message[0], 1};
+    msghdr header = {};
+    header.msg_iov = &data;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    cmsghdr * rights = CMSG_FIRSTHDR(&header);
+    rights->cmsg_level = SOL_SOCKET;
+    rights->cmsg_type = SCM_RIGHTS;
+    rights->cmsg_len = CMSG_LEN(sizeof(descriptors));
+    memcpy(CMSG_DATA(rights), descriptors, sizeof(descriptors));
+    ssize_t sent;
+    while ((sent = sendmsg(server, &header, 0)) < 0 && errno == EINTR);
+
+    int exitCode;
+    if (sent == 1 && writeAll(server, message.data() + 1, message.size() - 1) &&
+        readAll(server, &exitCode, sizeof(exitCode)))
+        return exitCode;
+    cerr << "Compile server closed connection" << endl;
+    return 1;
+}
+
+#ifdef MILA_CLIENT
+// thin client without LLVM, it starts in a fraction of time the compiler takes to initialize
+int main(int argc, char * argv[]) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " socket [options of mila]" << endl;
+        return 1;
+    }
+    return runClient(argv[1], argc - 2, argv + 2);
+}
+#endif
@@ -0,0 +1,13 @@
+# Writes C++ source OUTPUT with bitcode of runtime INPUT as array milaRuntime, the array is empty without INPUT
+# cmake -DINPUT=fce.bc -DOUTPUT=RuntimeBitcode.cpp -P EmbedRuntime.cmake
+
+set(BYTES "")
+set(SOURCE "without runtime")
+if (INPUT)
+    set(SOURCE "from ${INPUT}")
+    file(READ "${INPUT}" CONTENT HEX)
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," BYTES "${CONTENT}")
+endif ()
+file(WRITE "${OUTPUT}" "// generated by EmbedRuntime.cmake ${SOURCE}\n#include <cstddef>\n\n"
+        "extern const unsigned char milaRuntime[] = {${BYTES}0};\n"
+        "extern const size_t milaRuntimeSize = sizeof(milaRuntime) - 1;\n")
@@ -0,0 +1,317 @@
+#include "Jit.hpp"
+#include "Parser.hpp"
+
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <cctype>
+#include <cstdio>
+
+// runtime of native code, the same as fce.c linked to compiled programs, but through stdio shared with VM
+static int32_t nativeWriteln(int32_t x) {
+    printf("%d\n", x);
+    return 0;
+}
+
+static int32_t nativeWrite(int32_t x) {
+    printf("%d", x);
+    return 0;
+}
+
+static int32_t nativeWritelnStr(const char * text) {
+    printf("%s\n", text);
+    return 0;
+}
+
+static int32_t nativeWriteStr(const char * text) {
+    printf("%s", text);
+    return 0;
+}
+
+static int32_t nativeReadln(int32_t * x) {
+    scanf("%d", x);
+    return 0;
+}
+
+static int32_t nativeReadArray(int32_t * items, int32_t count) {
+    for (int32_t i = 0; i < count; ++i)
+        scanf("%d", items + i);
+    return 0;
+}
+
+static bool nativeEof() {
+    int c;
+    while ((c = getchar()) != EOF && isspace(c));
+    if (c == EOF)
+        return true;
+    ungetc(c, stdin);
+    return false;
+}
+
+static void nativeRangeError(int32_t index, int32_t low, int32_t high) {
+    fflush(stdout);
+    fprintf(stderr, "Array index %d out of bounds %d..%d\n", index, low, high);
+    exit(1);
+}
+
+/**
+ * @brief Arrays of booleans have a byte per item in native code and a word in VM
+ */
+static bool hasBooleanArray(llvm::Type * type) {
+    while (type->isArrayTy()) {
+        type = type->getArrayElementType();
+        if (type->isIntegerTy(1))
+            return true;
+    }
+    return false;
+}
+
+TieredJit::TieredJit(Parser & parser, const BytecodeProgram & program, uint32_t callThreshold, uint32_t loopThreshold,
+                     bool log) : Tiering(program.functions.size(), callThreshold, loopThreshold), parser(parser),
+                                 program(program), log(log), start(chrono::steady_clock::now()),
+                                 requested(program.functions.size()), worker(&TieredJit::run, this) {}
+
+TieredJit::~TieredJit() {
+    {
+        lock_guard <mutex> guard(lock);
+        stopping = true;
+    }
+    wakeUp.notify_one();
+    worker.join();
+}
+
+double TieredJit::getTime() const {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+void TieredJit::promote(int function) {
+    {
+        lock_guard <mutex> guard(lock);
+        if (requested[function])
+            return;
+        requested[function] = true;
+        queue.push_back({function, getTime()});
+    }
+    if (log)
+        fprintf(stderr, "tier-up: %s is hot after %u calls and %u loop iterations at %.3f ms\n",
+                program.functions[function].name.c_str(), calls[function], loops[function], getTime());
+    wakeUp.notify_one();
+}
+
+void TieredJit::run() {
+    bool failed = false;
+    while (true) {
+        pair<int, double> request;
+        {
+            unique_lock <mutex> guard(lock);
+            wakeUp.wait(guard, [this] { return stopping || !queue.empty(); });
+            if (stopping)
+                return;
+            request = queue.front();
+            queue.pop_front();
+        }
+        string error;
+        if (!jit && !failed && !initJit(error)) {
+            failed = true;
+            if (log)
+                fprintf(stderr, "tier-up: native code is not available, %s\n", error.c_str());
+        }
+        if (failed)
+            continue;
+        const string & name = program.functions[request.first].name;
+        double begin = getTime();
+        NativeFunction native = compile(request.first, error);
+        if (native)
+            natives[request.first].store(native, memory_order_release);
+        if (!log)
+            continue;
+        if (native)
+            fprintf(stderr, "tier-up: %s runs native code from %.3f ms, compiled in %.3f ms\n", name.c_str(),
+                    getTime(), getTime() - begin);
+        else
+            fprintf(stderr, "tier-up: %s stays in VM, %s\n", name.c_str(), error.c_str());
+    }
+}
+
+bool TieredJit::initJit(string & error) {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    try {
+        llvm::raw_svector_ostream out(bitcode);
+        llvm::WriteBitcodeToFile(parser.Translate(), out);
+    } catch (exception & e) {
+        error = e.what();
+        return false;
+    }
+
+//globals of VM are far from code, PIC reaches them through GOT
+    auto builder = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if (!builder) {
+        error = llvm::toString(builder.takeError());
+        return false;
+    }
+    builder->setRelocationModel(llvm::Reloc::PIC_);
+    builder->setCodeModel(llvm::CodeModel::Small);
+    auto created = llvm::orc::LLJITBuilder().setJITTargetMachineBuilder(*builder).create();
+    if (!created) {
+        error = llvm::toString(created.takeError());
+        return false;
+    }
+    jit = move(*created);
+
+    llvm::orc::SymbolMap symbols;
+    auto define = [&](const string & name, const void * address) {
+        symbols[jit->mangleAndIntern(name)] = llvm::JITEvaluatedSymbol(llvm::pointerToJITTargetAddress(address),
+                                                                        llvm::JITSymbolFlags::Exported);
+    };
+    define("writeln", (const void *) &nativeWriteln);
+    define("write", (const void *) &nativeWrite);
+    define("writelnStr", (const void *) &nativeWritelnStr);
+    define("writeStr", (const void *) &nativeWriteStr);
+    define("readln", (const void *) &nativeReadln);
+    define("readArray", (const void *) &nativeReadArray);
+    define("eof", (const void *) &nativeEof);
+    define("rangeError", (const void *) &nativeRangeError);
+    for (auto & global: program.globals)
+        define(global.first, memory + global.second);
+    llvm::orc::JITDylib & dylib = jit->getMainJITDylib();
+    if (auto failure = dylib.define(llvm::orc::absoluteSymbols(symbols))) {
+        error = llvm::toString(move(failure));
+        jit.reset();
+        return false;
+    }
+//C library
+    auto process = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+            jit->getDataLayout().getGlobalPrefix());
+    if (!process) {
+        error = llvm::toString(process.takeError());
+        jit.reset();
+        return false;
+    }
+    dylib.addGenerator(move(*process));
+    return true;
+}
+
+NativeFunction TieredJit::compile(int function, string & error) {
+    const BytecodeFunction & code = program.functions[function];
+    auto context = make_unique<llvm::LLVMContext>();
+    auto parsed = llvm::parseBitcodeFile(llvm::MemoryBufferRef(llvm::StringRef(bitcode.data(), bitcode.size()), "mila"),
+                                         *context);
+    if (!parsed) {
+        error = llvm::toString(parsed.takeError());
+        return nullptr;
+    }
+    unique_ptr <llvm::Module> module = move(*parsed);
+    llvm::Function * F = module->getFunction(code.name);
+    if (!F || F->isDeclaration()) {
+        error = "it is not in LLVM IR";
+        return nullptr;
+    }
+
+//TRAMPOLINE - arguments are read from registers of VM, references are addresses in memory of VM
+    llvm::IRBuilder<> builder(*context);
+    llvm::Type * i32 = builder.getInt32Ty();
+    llvm::FunctionType * trampolineType = llvm::FunctionType::get(i32, {i32->getPointerTo(), i32->getPointerTo()},
+                                                                  false);
+    llvm::Function * trampoline = llvm::Function::Create(trampolineType, llvm::Function::ExternalLinkage,
+                                                         code.name + ".tier", module.get());
+    builder.SetInsertPoint(llvm::BasicBlock::Create(*context, "entry", trampoline));
+    llvm::Value * memory = trampoline->getArg(0);
+    llvm::Value * args = trampoline->getArg(1);
+    auto loadSlot = [&](int slot) {
+        return builder.CreateLoad(i32, builder.CreateConstInBoundsGEP1_32(i32, args, slot));
+    };
+    vector <llvm::Value *> callArgs;
+    int slot = 0;
+    for (auto & param: code.params) {
+        llvm::Type * type = F->getArg(callArgs.size())->getType();
+        if (!param->isReference() && type->isArrayTy()) {
+            if (hasBooleanArray(type)) {
+                error = "parameter \"" + param->getName() + "\" is array of booleans";
+                return nullptr;
+            }
+            llvm::Value * items = builder.CreateBitCast(builder.CreateConstInBoundsGEP1_32(i32, args, slot),
+                                                        type->getPointerTo());
+            callArgs.push_back(builder.CreateLoad(type, items));
+            slot += param->getType()->getScalarCount();
+        } else if (!param->isReference()) {
+            llvm::Value * value = loadSlot(slot++);
+            callArgs.push_back(type->isIntegerTy(1) ? builder.CreateICmpNE(value, builder.getInt32(0)) : value);
+        } else {
+            if (hasBooleanArray(type->getPointerElementType())) {
+                error = "parameter \"" + param->getName() + "\" is array of booleans";
+                return nullptr;
+            }
+            llvm::Value * address = builder.CreateInBoundsGEP(i32, memory, loadSlot(slot++));
+            callArgs.push_back(builder.CreateBitCast(address, type));
+            if (dynamic_pointer_cast<OpenArray>(param->getType()))
+                callArgs.push_back(loadSlot(slot++));
+        }
+    }
+    llvm::CallInst * call = builder.CreateCall(F, callArgs);
+    call->setCallingConv(F->getCallingConv());
+    if (F->getReturnType()->isVoidTy())
+        builder.CreateRet(builder.getInt32(0));
+    else
+        builder.CreateRet(builder.CreateZExtOrTrunc(call, i32));
+
+//only the trampoline is visible, every compiled function brings its own copy of callees
+    for (llvm::Function & other: *module)
+        if (&other != trampoline && !other.isDeclaration())
+            other.setLinkage(llvm::GlobalValue::InternalLinkage);
+    for (llvm::GlobalVariable & global: module->globals()) {
+        global.setThreadLocal(false);
+        if (program.globals.count(global.getName().str())) {
+            global.setInitializer(nullptr);
+            global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+        }
+    }
+
+//OPTIMIZATION - the same O2 pipeline as opt -O2
+    auto machine = llvm::orc::JITTargetMachineBuilder::detectHost();
+    if (!machine) {
+        error = llvm::toString(machine.takeError());
+        return nullptr;
+    }
+    auto target = machine->createTargetMachine();
+    if (!target) {
+        error = llvm::toString(target.takeError());
+        return nullptr;
+    }
+    module->setDataLayout(jit->getDataLayout());
+    module->setTargetTriple(jit->getTargetTriple().str());
+    {
+        llvm::LoopAnalysisManager LAM;
+        llvm::FunctionAnalysisManager FAM;
+        llvm::CGSCCAnalysisManager CGAM;
+        llvm::ModuleAnalysisManager MAM;
+        llvm::PassBuilder passBuilder(target->get());
+        passBuilder.registerModuleAnalyses(MAM);
+        passBuilder.registerCGSCCAnalyses(CGAM);
+        passBuilder.registerFunctionAnalyses(FAM);
+        passBuilder.registerLoopAnalyses(LAM);
+        passBuilder.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+        passBuilder.buildPerModuleDefaultPipeline(llvm::OptimizationLevel::O2).run(*module, MAM);
+    }
+    for (llvm::GlobalVariable & global: module->globals())
+        if (global.isDeclaration() && hasBooleanArray(global.getValueType())) {
+            error = "global variable \"" + global.getName().str() + "\" is array of booleans";
+            return nullptr;
+        }
+
+    if (auto failure = jit->addIRModule(llvm::orc::ThreadSafeModule(move(module), move(context)))) {
+        error = llvm::toString(move(failure));
+        return nullptr;
+    }
+    auto symbol = jit->lookup(code.name + ".tier");
+    if (!symbol) {
+        error = llvm::toString(symbol.takeError());
+        return nullptr;
+    }
+    return llvm::jitTargetAddressToFunction<NativeFunction>(symbol->getAddress());
+}
@@ -0,0 +1,63 @@
+#ifndef MILA_JIT_HPP
+#define MILA_JIT_HPP
+
+#include "Bytecode.hpp"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+class Parser;
+
+/**
+ * @brief Background compilation of hot functions for tiered execution
+ *
+ * The program starts in the VM. When a function gets hot, a worker thread translates the whole program to LLVM IR once,
+ * then for every hot function it takes a copy of the module with the function, its callees and a trampoline which
+ * turns registers of VM to arguments, optimizes it with the O2 pipeline and compiles it with ORC JIT. Global variables
+ * of the native code are the globals in memory of VM, so both tiers share them.
+ *
+ * Functions with boolean arrays in parameters or in used globals stay in VM, booleans take a byte in arrays of native
+ * code and a word in VM.
+ */
+class TieredJit : public Tiering {
+public:
+    TieredJit(Parser & parser, const BytecodeProgram & program, uint32_t callThreshold, uint32_t loopThreshold,
+              bool log);
+
+    // waits for compilation in progress
+    ~TieredJit() override;
+
+    void promote(int function) override;
+
+private:
+    Parser & parser;
+    const BytecodeProgram & program;
+    bool log;
+    chrono::steady_clock::time_point start;
+
+    mutex lock;
+    condition_variable wakeUp;
+    deque <pair<int, double>> queue;    // hot functions and time they got hot
+    vector <bool> requested;
+    bool stopping = false;
+
+    unique_ptr <llvm::orc::LLJIT> jit;
+    llvm::SmallVector<char, 0> bitcode;     // the whole program, every compilation starts with a copy
+    thread worker;
+
+    void run();
+
+    // program translated to LLVM IR and JIT with runtime and globals of VM, false when it can not be done
+    bool initJit(string & error);
+
+    NativeFunction compile(int function, string & error);
+
+    double getTime() const;
+};
+
+#endif //MILA_JIT_HPP
@@ -6,6 +6,9 @@ enum CharType {
 };
 static int character;   // input symbol
 static CharType input; // input symbol type
+static FILE * source = stdin;   // program text
+static SourceLocation characterLocation;    // position of input symbol
+static SourceLocation nextLocation = {1, 1}; // position of symbol read next
 
 
 unordered_map<string, Token> keyWords = {
@@ -36,13 +39,24 @@ unordered_map<string, Token> keyWords = {
         {"array",     tok_array},
         {"of",        tok_of},
         {"break",     tok_break},
-        {"continue",  tok_continue}
+        {"continue",  tok_continue},
+        {"boolean",   tok_boolean},
+        {"pure",      tok_pure}
 };
 
 
+void Lexer::setSource(FILE * file) {
+    source = file;
+}
+
 void readInput() {
 
-    character = getchar();
+    characterLocation = nextLocation;
+    character = getc(source);
+    if (character == '\n')
+        nextLocation = {nextLocation.line + 1, 1};
+    else if (character != EOF)
+        nextLocation.column++;
     if (character == EOF)
         input = END;
     else if ((character >= 'a' && character <= 'z') || (character >= 'A' && character <= 'Z'))
@@ -55,6 +69,12 @@ void readInput() {
         input = NO_TYPE;
 }
 
+// symbol is read again by the next token
+void unreadInput() {
+    ungetc(character, source);
+    nextLocation = characterLocation;
+}
+
 
 /**
  * @brief Function to return the next token from standard input
@@ -67,6 +87,7 @@ int Lexer::gettok() {
     int base = 10;
     int digit = 0;
     q0:
+    m_Location = characterLocation;
     switch (character) {
         case ':':
             readInput();
@@ -176,7 +197,7 @@ int Lexer::gettok() {
         case '*':
         case ',':
         case ';':
-            ungetc(character, stdin);
+            unreadInput();
             auto a = keyWords.find(m_IdentifierStr);
             if (a == keyWords.end())
                 return tok_identifier;
@@ -212,7 +233,7 @@ int Lexer::gettok() {
         case '*':
         case ',':
         case ';':
-            ungetc(character, stdin);
+            unreadInput();
             return tok_number;
     }
     switch (input) {
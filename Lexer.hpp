@@ -1,10 +1,18 @@
 #ifndef PJPPROJECT_LEXER_HPP
 #define PJPPROJECT_LEXER_HPP
 
+#include <cstdio>
 #include <iostream>
 #include <unordered_map>
 
 using namespace std;
+
+// position in program text, lines and columns are counted from 1, line 0 is an unknown position
+struct SourceLocation {
+    int line = 0;
+    int column = 0;
+};
+
 class Lexer {
 public:
     Lexer() = default;
@@ -14,10 +22,16 @@ public:
     const string& identifierStr() const { return this->m_IdentifierStr; }
     const string& strVal() const { return this->m_StrVal; }
     int numVal() { return this->m_NumVal; }
+    // where the last token starts
+    const SourceLocation& location() const { return this->m_Location; }
+
+    // program is read from stdin unless other file is set
+    static void setSource(FILE * file);
 private:
     string m_IdentifierStr;
     string m_StrVal;
     int m_NumVal;
+    SourceLocation m_Location;
 };
 
 
@@ -91,7 +105,9 @@ enum Token {
     tok_semicolon = -47,
     tok_of = -48,
     tok_break = -49,
-    tok_continue = -50
+    tok_continue = -50,
+    tok_boolean = -51,
+    tok_pure = -52
 };
 
 #endif //PJPPROJECT_LEXER_HPP
@@ -0,0 +1,260 @@
+#include "Optimizer.hpp"
+#include "Tree.hpp"
+
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/LLVMRemarkStreamer.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Remarks/RemarkStreamer.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <algorithm>
+
+int optimizationLevel = 0;
+RemarkOptions remarkOptions;
+
+// passes summarized by --opt-report without a filter
+static const char * const reportedPasses = "^(loop-vectorize|loop-unroll|inline|licm|gvn)$";
+
+struct Remark {
+    string kind;        // "passed", "missed" or "analysis"
+    string pass;
+    string message;
+    int line;           // 0 when the remark has no position
+    int count;          // the same remark for more places of code, for example inlined copies of a loop
+};
+
+// remarks of a loop of the program, or of a function outside of its loops when loop is null
+struct RemarkGroup {
+    string function;
+    const SourceLoop * loop;
+    vector <Remark> remarks;
+};
+
+static vector <RemarkGroup> remarkGroups;
+
+static const SourceLoop * innermostLoop(const string & function, int line) {
+    const SourceLoop * found = nullptr;
+    for (auto & loop: sourceLoops)
+        if (loop.function == function && loop.line <= line && line <= loop.endLine && (!found || loop.line >= found->line))
+            found = &loop;
+    return found;
+}
+
+// line in the function itself of the block the remark is about, code inlined from callees has the line of the call
+static int regionLine(const llvm::DiagnosticInfoOptimizationBase & remark) {
+    auto optimization = llvm::dyn_cast<llvm::DiagnosticInfoIROptimization>(&remark);
+    auto block = optimization ? llvm::dyn_cast_or_null<llvm::BasicBlock>(optimization->getCodeRegion()) : nullptr;
+    if (!block)
+        return 0;
+    for (const llvm::Instruction & I: *block)
+        if (const llvm::DILocation * position = I.getDebugLoc()) {
+            while (position->getInlinedAt())
+                position = position->getInlinedAt();
+            return position->getLine();
+        }
+    return 0;
+}
+
+/**
+ * @brief Collects remarks whose pass matches the filter of their kind, nothing is printed by LLVM
+ *
+ * The remark streamer of --opt-report gets every remark of the pipeline before the handler, the filters only choose
+ * what goes to the summary.
+ */
+class RemarkCollector : public llvm::DiagnosticHandler {
+    unique_ptr <llvm::Regex> passed;
+    unique_ptr <llvm::Regex> missed;
+    unique_ptr <llvm::Regex> analysis;
+
+    static unique_ptr <llvm::Regex> compile(const string & pattern, const string & option) {
+        if (pattern.empty())
+            return nullptr;
+        auto regex = make_unique<llvm::Regex>(pattern);
+        string error;
+        if (!regex->isValid(error))
+            throw invalid_argument("Invalid regular expression of " + option + ": " + error + "\n");
+        return regex;
+    }
+
+    static bool matches(const unique_ptr <llvm::Regex> & regex, llvm::StringRef pass) {
+        return regex && regex->match(pass);
+    }
+
+public:
+    RemarkCollector(const RemarkOptions & options) {
+        bool filtered = !options.passed.empty() || !options.missed.empty() || !options.analysis.empty();
+        passed = compile(filtered ? options.passed : reportedPasses, "-Rpass");
+        missed = compile(filtered ? options.missed : reportedPasses, "-Rpass-missed");
+        analysis = compile(filtered ? options.analysis : reportedPasses, "-Rpass-analysis");
+    }
+
+    bool isPassedOptRemarkEnabled(llvm::StringRef pass) const override {
+        return matches(passed, pass);
+    }
+
+    bool isMissedOptRemarkEnabled(llvm::StringRef pass) const override {
+        return matches(missed, pass);
+    }
+
+    bool isAnalysisRemarkEnabled(llvm::StringRef pass) const override {
+        return matches(analysis, pass);
+    }
+
+    bool isAnyRemarkEnabled() const override {
+        return passed || missed || analysis;
+    }
+
+    bool handleDiagnostics(const llvm::DiagnosticInfo & info) override {
+        auto remark = llvm::dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&info);
+        if (!remark)
+            return false;
+        llvm::StringRef pass = remark->getPassName();
+        string kind = remark->isPassed() ? "passed" : remark->isAnalysis() ? "analysis" : "missed";
+        if (!(remark->isPassed() ? matches(passed, pass) : remark->isAnalysis() ? matches(analysis, pass)
+                                                                                : matches(missed, pass)))
+            return true;
+
+        string function = remark->getFunction().getName().str();
+        int line = remark->isLocationAvailable() ? remark->getLocation().getLine() : 0;
+        const SourceLoop * loop = line ? innermostLoop(function, line) : nullptr;
+        if (!loop) {
+            int region = regionLine(*remark);
+            loop = region ? innermostLoop(function, region) : nullptr;
+        }
+
+        auto group = find_if(remarkGroups.begin(), remarkGroups.end(), [&](const RemarkGroup & group) {
+            return group.function == function && group.loop == loop;
+        });
+        if (group == remarkGroups.end())
+            group = remarkGroups.insert(remarkGroups.end(), {function, loop, {}});
+        string message = remark->getMsg();
+        for (auto & same: group->remarks)
+            if (same.line == line && same.kind == kind && same.pass == pass && same.message == message) {
+                ++same.count;
+                return true;
+            }
+        group->remarks.push_back({kind, pass.str(), message, line, 1});
+        return true;
+    }
+};
+
+// the target llc of the mila wrapper compiles for, its cost model decides vectorization and unrolling
+static unique_ptr <llvm::TargetMachine> createTargetMachine() {
+    llvm::InitializeNativeTarget();
+    string triple = llvm::sys::getDefaultTargetTriple();
+    string error;
+    const llvm::Target * target = llvm::TargetRegistry::lookupTarget(triple, error);
+    if (!target)
+        throw invalid_argument("Target " + triple + " is not available for optimization: " + error + "\n");
+    return unique_ptr<llvm::TargetMachine>(
+            target->createTargetMachine(triple, "generic", "", llvm::TargetOptions(), llvm::None));
+}
+
+// pipeline of a level with the pass builder its passes were created by, built once per process
+struct Pipeline {
+    unique_ptr <llvm::PassBuilder> passBuilder;
+    llvm::ModulePassManager passes;
+};
+
+static unique_ptr <llvm::TargetMachine> targetMachine;
+static Pipeline pipelines[4];   // by level, 0 is not used
+
+static Pipeline & getPipeline(int level) {
+    if (!targetMachine)
+        targetMachine = createTargetMachine();
+    Pipeline & pipeline = pipelines[level];
+    if (pipeline.passBuilder)
+        return pipeline;
+//vectorizers run from -O2 on, as in clang
+    llvm::PipelineTuningOptions tuning;
+    tuning.LoopVectorization = level >= 2;
+    tuning.SLPVectorization = level >= 2;
+    pipeline.passBuilder = make_unique<llvm::PassBuilder>(targetMachine.get(), tuning);
+    pipeline.passes = pipeline.passBuilder->buildPerModuleDefaultPipeline(
+            level == 1 ? llvm::OptimizationLevel::O1 : level == 2 ? llvm::OptimizationLevel::O2
+                                                                  : llvm::OptimizationLevel::O3);
+    return pipeline;
+}
+
+void prepareOptimizer() {
+    try {
+        for (int level = 1; level <= 3; ++level)
+            getPipeline(level);
+    } catch (invalid_argument &) {
+//compilations report it when they optimize
+    }
+}
+
+void optimizeModule(llvm::Module & module) {
+    llvm::LLVMContext & context = module.getContext();
+    unique_ptr <llvm::ToolOutputFile> report;
+    if (remarkOptions.requested())
+        context.setDiagnosticHandler(make_unique<RemarkCollector>(remarkOptions));
+    if (!remarkOptions.reportFile.empty()) {
+        auto opened = llvm::setupLLVMOptimizationRemarks(context, remarkOptions.reportFile, "", "yaml", false);
+        if (!opened)
+            throw invalid_argument("Can not write " + remarkOptions.reportFile + ": " +
+                                   llvm::toString(opened.takeError()) + "\n");
+        report = move(*opened);
+    }
+
+    Pipeline & pipeline = getPipeline(optimizationLevel);
+    module.setTargetTriple(targetMachine->getTargetTriple().str());
+    module.setDataLayout(targetMachine->createDataLayout());
+    {
+        llvm::LoopAnalysisManager LAM;
+        llvm::FunctionAnalysisManager FAM;
+        llvm::CGSCCAnalysisManager CGAM;
+        llvm::ModuleAnalysisManager MAM;
+        pipeline.passBuilder->registerModuleAnalyses(MAM);
+        pipeline.passBuilder->registerCGSCCAnalyses(CGAM);
+        pipeline.passBuilder->registerFunctionAnalyses(FAM);
+        pipeline.passBuilder->registerLoopAnalyses(LAM);
+        pipeline.passBuilder->crossRegisterProxies(LAM, FAM, CGAM, MAM);
+        pipeline.passes.run(module, MAM);
+    }
+
+    if (report) {
+        context.setMainRemarkStreamer(nullptr);
+        context.setLLVMRemarkStreamer(nullptr);
+        report->keep();
+    }
+}
+
+void writeRemarkSummary(llvm::raw_ostream & out) {
+    if (!remarkOptions.requested())
+        return;
+//loops by their line, then functions with remarks outside of loops
+    stable_sort(remarkGroups.begin(), remarkGroups.end(), [](const RemarkGroup & a, const RemarkGroup & b) {
+        if (!a.loop || !b.loop)
+            return a.loop && !b.loop;
+        return a.loop->line < b.loop->line;
+    });
+    out << "optimization remarks:" << (remarkGroups.empty() ? " none" : "") << "\n";
+    for (auto & group: remarkGroups) {
+        if (group.loop)
+            out << group.loop->kind << " at line " << group.loop->line << " in " << group.function << " (lines "
+                << group.loop->line << "-" << group.loop->endLine << ")\n";
+        else
+            out << group.function << ", outside of loops\n";
+        auto remarks = group.remarks;
+        stable_sort(remarks.begin(), remarks.end(), [](const Remark & a, const Remark & b) {
+            return a.line < b.line;
+        });
+        for (auto & remark: remarks) {
+            out << "  ";
+            if (remark.line)
+                out << "line " << remark.line << ": ";
+            out << remark.pass << " " << remark.kind << ": " << remark.message;
+            if (remark.count > 1)
+                out << " (" << remark.count << " times)";
+            out << "\n";
+        }
+    }
+}
@@ -0,0 +1,46 @@
+//
+// Optimization pipeline of LLVM run in the compiler and remarks of its passes mapped to loops of the program
+//
+
+#ifndef MILA_OPTIMIZER_HPP
+#define MILA_OPTIMIZER_HPP
+
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <string>
+
+using namespace std;
+
+// level of the default pipeline (opt -O1, -O2, -O3), 0 leaves the module as it is generated, set by -O1, -O2, -O3
+extern int optimizationLevel;
+
+/**
+ * @brief Remarks of optimization passes requested by -Rpass=, -Rpass-missed=, -Rpass-analysis= and --opt-report=
+ *
+ * Every filter is a regular expression matched against the pass name, like -Rpass of clang. Remarks which pass a
+ * filter are summarized per loop of the program; --opt-report writes all remarks of the pipeline as YAML (the same as
+ * -fsave-optimization-record of clang) and summarizes the main loop passes unless a filter is given.
+ */
+struct RemarkOptions {
+    string passed;
+    string missed;
+    string analysis;
+    string reportFile;
+
+    bool requested() const { return !passed.empty() || !missed.empty() || !analysis.empty() || !reportFile.empty(); }
+};
+extern RemarkOptions remarkOptions;
+
+// runs the default pipeline of optimizationLevel for the default target, as llc of the mila wrapper compiles for it,
+// and collects remarks, throws invalid_argument when the target or the report can not be set up
+void optimizeModule(llvm::Module & module);
+
+// target machine and pipelines of all levels are built ahead, so compilations forked by the compile server start
+// with them, nothing is built when the target is not available
+void prepareOptimizer();
+
+// per loop summary of collected remarks, nothing when no remark was requested
+void writeRemarkSummary(llvm::raw_ostream & out);
+
+#endif //MILA_OPTIMIZER_HPP
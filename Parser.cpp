@@ -1,8 +1,33 @@
 #include "Parser.hpp"
+#include "Optimizer.hpp"
+#include "Stats.hpp"
+
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Transforms/IPO/Internalize.h"
 
 #include <memory>
 #include <sstream>
 
+// bitcode of fce.c generated by CMake (EmbedRuntime.cmake), empty when clang of the same LLVM version was not found
+extern const unsigned char milaRuntime[];
+extern const size_t milaRuntimeSize;
+
+// AST nodes are counted by kind for --stats
+template<class T, class ... Args>
+static shared_ptr <T> makeNode(Args && ... args) {
+    if (compileStats)
+        compileStats->countNode<T>();
+    return make_shared<T>(forward<Args>(args)...);
+}
+
+// node is at position of the token its construct starts with, for debug info
+template<class T>
+static shared_ptr <T> located(shared_ptr <T> node, const SourceLocation & location) {
+    node->location = location;
+    return node;
+}
+
 void Parser::printExpansion(string s) {
     if (showExpansion)
         cout << s << endl;
@@ -11,7 +36,9 @@ void Parser::printExpansion(string s) {
 Parser::Parser() :
         MilaContext(),
         MilaBuilder(make_unique<llvm::IRBuilder<>>(MilaContext)),
-        MilaModule(make_unique<llvm::Module>("mila", MilaContext)) {}
+        MilaModule(make_unique<llvm::Module>("mila", MilaContext)) {
+    MilaContext.setDiscardValueNames(discardValueNames);
+}
 
 
 UnknownVarException::UnknownVarException(string varName) : varName(varName) {}
@@ -55,12 +82,120 @@ bool Parser::Parse() {
 }
 
 const llvm::Module & Parser::Generate() {
+    if (streaming) {
+        statsPhase("stream");
+        lower = [this](const shared_ptr <Statement> & statement) {
+            statement->translateToLLVM(MilaModule, MilaBuilder);
+//calls of functions which only compute may be evaluated at compile time later, their body is kept
+            auto function = dynamic_pointer_cast<Function>(statement);
+            if (function && function->keepForFolding(MilaModule))
+                interpretable.push_back(function);
+        };
+        parseProgram();
+        lower = nullptr;
+        return runModulePasses();
+    }
+
     //parser grammar starting symbol
+    statsPhase("parse");
     parseProgram();
 
+    return Translate();
+}
+
+const llvm::Module & Parser::Translate() {
+    statsPhase("codegen");
+    for (auto & statement: statements) {
+        statement->translateToLLVM(MilaModule, MilaBuilder);
+    }
+    return runModulePasses();
+}
+
+const llvm::Module & Parser::runModulePasses() {
+    auto program = static_pointer_cast<Program>(statements.front());
+    program->finishDebugInfo(MilaModule);
+    statsPhase("passes");
+    program->demoteRecursiveStaticLocals(MilaModule);
+    program->markNoAliasParams(MilaModule);
+    if (wholeProgram)
+        program->internalizeFunctions(MilaModule);
+    program->eliminateTailCalls(MilaModule);
+//profiles are matched to the same code, so counters are added and profiles applied at the same point
+    if (profileGenerate)
+        program->addBranchCounters(MilaModule);
+    if (!profileUse.empty())
+        program->applyProfile(MilaModule);
+//before attributes, counters make every function write memory
+    if (instrument)
+        program->instrumentFunctions(MilaModule);
+    if (wholeProgram)
+        program->inferFunctionAttributes(MilaModule);
+    if (linkRuntime)
+        addRuntime();
+//runtime linked before, so it is inlined to the program
+    if (optimizationLevel) {
+        statsPhase("optimize");
+        optimizeModule(*MilaModule);
+    }
     return *MilaModule;
 }
 
+void Parser::addRuntime() {
+    statsPhase("link");
+    if (!milaRuntimeSize)
+        throw invalid_argument("Runtime bitcode was not built with the compiler, --link-runtime is not available\n");
+    auto runtime = llvm::parseBitcodeFile(
+            llvm::MemoryBufferRef(llvm::StringRef((const char *) milaRuntime, milaRuntimeSize), "fce.c"), MilaContext);
+    if (!runtime)
+        throw invalid_argument("Runtime bitcode can not be read: " + llvm::toString(runtime.takeError()) + "\n");
+//CPU of clang which built the runtime does not keep it from being inlined to functions of program
+    for (llvm::Function & F: **runtime) {
+        F.removeFnAttr("target-cpu");
+        F.removeFnAttr("target-features");
+        F.removeFnAttr("tune-cpu");
+    }
+//declarations of program are resolved to runtime, then everything what came from it is internal
+    bool failed = llvm::Linker::linkModules(*MilaModule, move(*runtime), llvm::Linker::Flags::None,
+                                            [](llvm::Module & module, const llvm::StringSet<> & linked) {
+        llvm::internalizeModule(module, [&linked](const llvm::GlobalValue & value) {
+            return !linked.count(value.getName());
+        });
+    });
+    if (failed)
+        throw invalid_argument("Runtime can not be linked to program\n");
+}
+
+BytecodeProgram Parser::Compile(bool countHotness) {
+    BytecodeCompiler compiler;
+    compiler.countHotness = countHotness;
+//tiered execution translates the whole AST to LLVM IR later, so it is not streamed
+    if (streaming && !countHotness) {
+        statsPhase("stream");
+        lower = [&compiler](const shared_ptr <Statement> & statement) {
+            statement->compileBytecode(compiler);
+        };
+        parseProgram();
+        lower = nullptr;
+        return compiler.finish();
+    }
+
+    statsPhase("parse");
+    parseProgram();
+    statsPhase("bytecode");
+    for (auto & statement: statements) {
+        statement->compileBytecode(compiler);
+    }
+    return compiler.finish();
+}
+
+void Parser::addDeclaration(const shared_ptr <Statement> & statement) {
+//program is kept for passes over the whole module, other declarations are released after lowering when streaming
+    if (!lower || statements.empty())
+        statements.push_back(statement);
+    if (lower)
+        lower(statement);
+}
+
 /**
  * @brief Simple token buffer.
  *
@@ -69,7 +204,12 @@ const llvm::Module & Parser::Generate() {
  * Every function in the parser will assume that CurTok is the cureent token that needs to be parsed
  */
 int Parser::getNextToken() {
-    return CurTok = m_Lexer.gettok();
+    CurTok = m_Lexer.gettok();
+    if (compileStats) {
+        auto name = tokens.find(static_cast<Token>(CurTok));
+        compileStats->countToken(name != tokens.end() ? name->second : string(1, (char) CurTok));
+    }
+    return CurTok;
 }
 
 void Parser::match(Token expected) {
@@ -84,90 +224,94 @@ void Parser::throwParseException(vector <Token> expected) {
 
 void Parser::parseProgram() {
     printExpansion("1) A -> program ident ; B");
+    SourceLocation location = m_Lexer.location();
     match(tok_program);
     match(tok_identifier);
     match(tok_semicolon);
-    vector <shared_ptr<Statement>> statements;
-    statements.push_back(make_shared<Program>());
-    parseDecls(statements);
-    for (auto & statement: statements) {
-        statement->translateToLLVM(MilaModule, MilaBuilder);
-    }
+    addDeclaration(located(makeNode<Program>(), location));
+    parseDecls();
 }
 
-void Parser::parseDecls(vector <shared_ptr<Statement>> & statements) {
-    switch (CurTok) {
-        case tok_var: {
-            printExpansion("2) B -> var E B");
-            match(tok_var);
-            vector <shared_ptr<Var>> vars;
-            parseVarDecl(vars, true);
-            for (auto & var: vars) {
-                statements.push_back(var);
+void Parser::parseDecls() {
+//declarations are parsed in a loop, recursion would take stack per declaration of big programs
+    while (true) {
+        switch (CurTok) {
+            case tok_var: {
+                printExpansion("2) B -> var E B");
+                match(tok_var);
+                vector <shared_ptr<Var>> vars;
+                parseVarDecl(vars, true);
+                for (auto & var: vars) {
+                    addDeclaration(var);
+                }
+                break;
             }
-            parseDecls(statements);
-            break;
-        }
-        case tok_begin: {
-            printExpansion("3) B -> U .");
-            vector <shared_ptr<Var>> params;
-            vector <shared_ptr<Var>> vars;
-            auto main = make_shared<Function>("main", params, shared_ptr<Type>(new Integer()), parseBlock(), vars);
-            match(tok_dot);
-            statements.push_back(main);
-            break;
-        }
-        case tok_function: {
-            printExpansion("4) B -> function ident ( Q ) : H ; C T ; B");
-            match(tok_function);
-            string name = m_Lexer.identifierStr();
-            match(tok_identifier);
-            match(tok_leftParenthesis);
-            vector <shared_ptr<Var>> params;
-            parseFuncParamDecl(params);
-            match(tok_rightParenthesis);
-            match(tok_declaration);
-            auto type = parseType();
-            match(tok_semicolon);
-            vector <shared_ptr<Var>> vars;
-            parseLocalVar(vars);
-            auto block = parseFunctionForward();
-            match(tok_semicolon);
-            statements.push_back(make_shared<Function>(name, params, type, block, vars));
-            parseDecls(statements);
-            break;
-        }
-        case tok_procedure: {
-            printExpansion("5) B -> procedure ident ( Q ) ; C T ; B");
-            match(tok_procedure);
-            string name = m_Lexer.identifierStr();
-            match(tok_identifier);
-            match(tok_leftParenthesis);
-            vector <shared_ptr<Var>> params;
-            parseFuncParamDecl(params);
-            match(tok_rightParenthesis);
-            match(tok_semicolon);
-            vector <shared_ptr<Var>> vars;
-            parseLocalVar(vars);
-            auto block = parseFunctionForward();
-            match(tok_semicolon);
-            statements.push_back(make_shared<Procedure>(name, params, block, vars));
-            parseDecls(statements);
-            break;
-        }
-        case tok_const: {
-            printExpansion("6) B -> const J B");
-            match(tok_const);
-            auto consts = parseConstDecl();
-            for (auto & c: consts) {
-                statements.push_back(c);
+            case tok_begin: {
+                printExpansion("3) B -> U .");
+                vector <shared_ptr<Var>> params;
+                vector <shared_ptr<Var>> vars;
+                SourceLocation location = m_Lexer.location();
+                auto main = located(makeNode<Function>("main", params, makeNode<Integer>(), parseBlock(), vars),
+                                    location);
+                match(tok_dot);
+                addDeclaration(main);
+                return;
             }
-            parseDecls(statements);
-            break;
+            case tok_function: {
+                printExpansion("4) B -> function ident ( Q ) : H ; C T ; B");
+                SourceLocation location = m_Lexer.location();
+                match(tok_function);
+                string name = m_Lexer.identifierStr();
+                match(tok_identifier);
+                match(tok_leftParenthesis);
+                vector <shared_ptr<Var>> params;
+                parseFuncParamDecl(params);
+                match(tok_rightParenthesis);
+                match(tok_declaration);
+                auto type = parseType();
+                match(tok_semicolon);
+                vector <shared_ptr<Var>> vars;
+                parseLocalVar(vars);
+                bool pure = false;
+                auto block = parseFunctionForward(pure);
+                match(tok_semicolon);
+                addDeclaration(located(makeNode<Function>(name, params, type, block, vars, pure), location));
+                break;
+            }
+            case tok_procedure: {
+                printExpansion("5) B -> procedure ident ( Q ) ; C T ; B");
+                SourceLocation location = m_Lexer.location();
+                match(tok_procedure);
+                string name = m_Lexer.identifierStr();
+                match(tok_identifier);
+                match(tok_leftParenthesis);
+                vector <shared_ptr<Var>> params;
+                parseFuncParamDecl(params);
+                match(tok_rightParenthesis);
+                match(tok_semicolon);
+                vector <shared_ptr<Var>> vars;
+                parseLocalVar(vars);
+                bool pure = false;
+                auto block = parseFunctionForward(pure);
+                if (pure)
+                    throw invalid_argument("Procedure \"" + name + "\" can not be pure, only functions are\n");
+                match(tok_semicolon);
+                addDeclaration(located(makeNode<Procedure>(name, params, block, vars), location));
+                break;
+            }
+            case tok_const: {
+                printExpansion("6) B -> const J B");
+                match(tok_const);
+                auto consts = parseConstDecl();
+                for (auto & c: consts) {
+                    addDeclaration(c);
+                }
+                break;
+            }
+            default:
+                printExpansion("B exception");
+                throwParseException({tok_var, tok_begin, tok_function, tok_procedure, tok_const});
         }
-        default:
-            printExpansion("B exception");
-            throwParseException({tok_var, tok_begin, tok_function, tok_procedure, tok_const});
     }
 }
 
@@ -187,10 +331,11 @@ void Parser::parseLocalVar(vector <shared_ptr<Var>> & vars) {
 }
 
 void Parser::parseStatement(vector <shared_ptr<Statement>> & statements) {
+    SourceLocation location = m_Lexer.location();
     switch (CurTok) {
         case tok_identifier: {
             printExpansion("9) D -> O R");
-            auto statement = parseIdentLine();
+            auto statement = located(parseIdentLine(), location);
             statements.push_back(statement);
             parseNextStatement(statements);
             break;
@@ -207,7 +352,7 @@ void Parser::parseStatement(vector <shared_ptr<Statement>> & statements) {
             match(tok_identifier);
             match(tok_assign);
             auto startExpr = parseExpression();
-            parseFor(varName, startExpr, statements);
+            parseFor(varName, startExpr, location, statements);
             break;
         }
         case tok_while: {
@@ -216,31 +361,31 @@ void Parser::parseStatement(vector <shared_ptr<Statement>> & statements) {
             auto condition = parseExpression();
             match(tok_do);
             auto block = parseBlock();
-            statements.push_back(make_shared<While>(block, condition));
+            statements.push_back(located(makeNode<While>(block, condition), location));
             parseNextStatement(statements);
             break;
         }
         case tok_exit:
             printExpansion("13) D -> exit R");
             match(tok_exit);
-            statements.push_back(make_shared<Special>(tok_exit));
+            statements.push_back(located(makeNode<Special>(tok_exit), location));
             parseNextStatement(statements);
             break;
         case tok_break:
             printExpansion("14) D -> break R");
             match(tok_break);
-            statements.push_back(make_shared<Special>(tok_break));
+            statements.push_back(located(makeNode<Special>(tok_break), location));
             parseNextStatement(statements);
             break;
         case tok_continue:
             printExpansion("15) D -> continue R");
             match(tok_continue);
-            statements.push_back(make_shared<Special>(tok_continue));
+            statements.push_back(located(makeNode<Special>(tok_continue), location));
             parseNextStatement(statements);
             break;
         case tok_if:
             printExpansion("16) D -> S R");
-            statements.push_back(parseIf());
+            statements.push_back(located(parseIf(), location));
             parseNextStatement(statements);
             break;
         default:
@@ -251,8 +396,8 @@ void Parser::parseStatement(vector <shared_ptr<Statement>> & statements) {
     }
 }
 
-void
-Parser::parseFor(const string varName, shared_ptr<Expression> startExpr, vector <shared_ptr<Statement>> & statements) {
+void Parser::parseFor(const string varName, shared_ptr<Expression> startExpr, SourceLocation location,
+                      vector <shared_ptr<Statement>> & statements) {
     bool ascending = true;
     switch (CurTok) {
         case tok_to: {
@@ -272,34 +417,37 @@ Parser::parseFor(const string varName, shared_ptr<Expression> startExpr, vector
     auto endExpr = parseExpression();
     match(tok_do);
     auto block = parseBlock();
-    statements.push_back(make_shared<For>(varName, block, startExpr, endExpr, ascending));
+    statements.push_back(located(makeNode<For>(varName, block, startExpr, endExpr, ascending), location));
     parseNextStatement(statements);
 }
 
 void Parser::parseVarDecl(vector <shared_ptr<Var>> & vars, const bool global) {
     printExpansion("19) E -> ident E' : H ; E''");
     vector <string> names;
+    vector <SourceLocation> locations;
     names.push_back(m_Lexer.identifierStr());
+    locations.push_back(m_Lexer.location());
     match(tok_identifier);
-    parseMultIdent(names);
+    parseMultIdent(names, locations);
     match(tok_declaration);
     auto type = parseType();
-    for (auto & name: names) {
-        vars.push_back(make_shared<Var>(name, type, global));
+    for (size_t i = 0; i < names.size(); ++i) {
+        vars.push_back(located(makeNode<Var>(names[i], type, global), locations[i]));
     }
 
     match(tok_semicolon);
     parseMultVarDecls(vars, global);
 }
 
-void Parser::parseMultIdent(vector <string> & names) {
+void Parser::parseMultIdent(vector <string> & names, vector <SourceLocation> & locations) {
     switch (CurTok) {
         case tok_comma:
             printExpansion("20) E' -> , ident E'");
             match(tok_comma);
             names.push_back(m_Lexer.identifierStr());
+            locations.push_back(m_Lexer.location());
             match(tok_identifier);
-            parseMultIdent(names);
+            parseMultIdent(names, locations);
             break;
         default:
             printExpansion("21) E' -> ε");
@@ -324,12 +472,12 @@ void Parser::parseMultVarDecls(vector <shared_ptr<Var>> & vars, const bool globa
 shared_ptr<Expression> Parser::parseIdentSuffix(const string name) {
     switch (CurTok) {
         case tok_leftBracket: {
-            printExpansion("24) F -> [ I ] F'''");
+            printExpansion("24) F -> [ V ] F'''");
             match(tok_leftBracket);
-            auto expression = parseExpression();
+            auto item = parseIndexList(makeNode<VarReference>(name));
             match(tok_rightBracket);
             //multidim array
-            return parseIdentArraySuffix(make_shared<ArrayItemReference>(make_shared<VarReference>(name), expression));
+            return parseIdentArraySuffix(item);
         }
         case tok_leftParenthesis: {
             printExpansion("25) F -> ( G )");
@@ -337,26 +485,27 @@ shared_ptr<Expression> Parser::parseIdentSuffix(const string name) {
             vector <shared_ptr<Expression>> params;
             parseFuncParam(params);
             match(tok_rightParenthesis);
-            return make_shared<FunctionCall>(name, params);
+            return makeNode<FunctionCall>(name, params);
         }
         default:
             printExpansion("26) F -> ε");
-            return make_shared<VarReference>(name);
+            return makeNode<VarReference>(name);
     }
 }
 
 shared_ptr<Expression> Parser::parseIdent() {
     printExpansion("27) F' -> ident F");
     const string name = m_Lexer.identifierStr();
+    SourceLocation location = m_Lexer.location();
     match(tok_identifier);
-    return parseIdentSuffix(name);
+    return located(parseIdentSuffix(name), location);
 }
 
 shared_ptr<Expression> Parser::parseIdentOrNumb() {
     switch (CurTok) {
         case tok_number: {
             printExpansion("28) F'' -> numb");
-            auto number = make_shared<Number>(m_Lexer.numVal());
+            auto number = makeNode<Number>(m_Lexer.numVal());
             match(tok_number);
             return number;
         }
@@ -373,12 +522,12 @@ shared_ptr<Expression> Parser::parseIdentOrNumb() {
 shared_ptr<Expression> Parser::parseIdentArraySuffix(shared_ptr<Reference> var) {
     switch (CurTok) {
         case tok_leftBracket: {
-            printExpansion("30) F''' -> [ I ] F'''");
+            printExpansion("30) F''' -> [ V ] F'''");
             match(tok_leftBracket);
-            auto expression = parseExpression();
+            auto item = parseIndexList(var);
             match(tok_rightBracket);
             //multidim array
-            return parseIdentArraySuffix(make_shared<ArrayItemReference>(var, expression));
+            return parseIdentArraySuffix(item);
         }
         default:
             printExpansion("31) F''' -> ε");
@@ -401,7 +550,7 @@ void Parser::parseFuncParam(vector <shared_ptr<Expression>> & params) {
         }
         case tok_string: {
             printExpansion("33) G -> string G'");
-            auto tmp = make_shared<String>(m_Lexer.strVal());
+            auto tmp = makeNode<String>(m_Lexer.strVal());
             match(tok_string);
             params.push_back(tmp);
             parseMultFuncParams(params);
@@ -432,23 +581,58 @@ shared_ptr<Type> Parser::parseType() {
         case tok_integer:
             printExpansion("37) H -> integer");
             match(tok_integer);
-            return make_shared<Integer>();
-        case tok_array: {
-            printExpansion("38) H -> array [ P . . P ] of H");
+            return makeNode<Integer>();
+        case tok_boolean:
+            printExpansion("98) H -> boolean");
+            match(tok_boolean);
+            return makeNode<Boolean>();
+        case tok_array:
+            printExpansion("38) H -> array H'");
             match(tok_array);
+            return parseArrayType();
+        default:
+            printExpansion("H exception");
+            throwParseException({tok_integer, tok_boolean, tok_array});
+    }
+    return nullptr;
+}
+
+shared_ptr<Type> Parser::parseArrayType() {
+    switch (CurTok) {
+        case tok_leftBracket: {
+            printExpansion("99) H' -> [ P . . P H'' ] of H");
             match(tok_leftBracket);
+            vector <pair<int, int>> ranges;
             auto minIndex = parseNumber();
             match(tok_dot);
             match(tok_dot);
             auto maxIndex = parseNumber();
+            ranges.emplace_back(minIndex->getValue(), maxIndex->getValue());
+            parseArrayRanges(ranges);
             match(tok_rightBracket);
             match(tok_of);
             auto type = parseType();
-            return make_shared<Array>(minIndex->getValue(), maxIndex->getValue(), type);
+            //array [a .. b, c .. d] of T is array [a .. b] of array [c .. d] of T
+            for (auto range = ranges.rbegin(); range != ranges.rend(); ++range) {
+                auto array = makeNode<Array>(range->first, range->second, type);
+                if (range->second < range->first)
+                    throw invalid_argument("Array [" + to_string(range->first) + " .. " + to_string(range->second) +
+                                           "] has no items\n");
+                if (array->getScalarCount() > maxArrayScalars)
+                    throw invalid_argument("Array [" + to_string(range->first) + " .. " + to_string(range->second) +
+                                           "] has " + to_string(array->getScalarCount()) + " items, more than " +
+                                           to_string(maxArrayScalars) + "\n");
+                type = array;
+            }
+            return type;
         }
+        case tok_of:
+            printExpansion("100) H' -> of H");
+            match(tok_of);
+            return makeNode<OpenArray>(parseType());
         default:
-            printExpansion("H exception");
-            throwParseException({tok_integer, tok_array});
+            printExpansion("H' exception");
+            throwParseException({tok_leftBracket, tok_of});
     }
     return nullptr;
 }
@@ -492,7 +676,7 @@ shared_ptr<Expression> Parser::parseLevel1Ops(shared_ptr<Expression> expression)
     }
 //    parseLevel2Op();
 //    parseLevel1Ops();
-    return make_shared<BinOp>(op, expression, parseLevel1Ops(parseLevel2Op()));
+    return makeNode<BinOp>(op, expression, parseLevel1Ops(parseLevel2Op()));
 }
 
 vector <shared_ptr<Const>> Parser::parseConstDecl() {
@@ -501,10 +685,10 @@ vector <shared_ptr<Const>> Parser::parseConstDecl() {
     string name = m_Lexer.identifierStr();
     match(tok_identifier);
     match(tok_equal);
-    auto val = make_shared<Number>(m_Lexer.numVal());
+    auto val = makeNode<Number>(m_Lexer.numVal());
     match(tok_number);
     match(tok_semicolon);
-    consts.push_back(make_shared<Const>(name, val->getValue()));
+    consts.push_back(makeNode<Const>(name, val->getValue()));
     parseMultConstDecls(consts);
     return consts;
 }
@@ -516,10 +700,10 @@ void Parser::parseMultConstDecls(vector <shared_ptr<Const>> & consts) {
             string name = m_Lexer.identifierStr();
             match(tok_identifier);
             match(tok_equal);
-            auto val = make_shared<Number>(m_Lexer.numVal());
+            auto val = makeNode<Number>(m_Lexer.numVal());
             match(tok_number);
             match(tok_semicolon);
-            consts.push_back(make_shared<Const>(name, val->getValue()));
+            consts.push_back(makeNode<Const>(name, val->getValue()));
             parseMultConstDecls(consts);
             break;
         }
@@ -556,7 +740,7 @@ shared_ptr<Expression> Parser::parseLevel2Ops(shared_ptr<Expression> expression)
     }
 //    parseLevel3Op();
 //    parseLevel2Ops();
-    return make_shared<BinOp>(op, expression, parseLevel2Ops(parseLevel3Op()));
+    return makeNode<BinOp>(op, expression, parseLevel2Ops(parseLevel3Op()));
 }
 
 shared_ptr<Expression> Parser::parseLevel3Op() {
@@ -595,7 +779,7 @@ shared_ptr<Expression> Parser::parseLevel3Ops(shared_ptr<Expression> expression)
 //    parseLevel4Op();
 //    parseLevel3Ops();
 
-    return make_shared<BinOp>(op, expression, parseLevel3Ops(parseLevel4Op()));
+    return makeNode<BinOp>(op, expression, parseLevel3Ops(parseLevel4Op()));
 }
 
 shared_ptr<Expression> Parser::parseLevel4Op() {
@@ -603,7 +787,7 @@ shared_ptr<Expression> Parser::parseLevel4Op() {
         case tok_not:
             printExpansion("62) M -> not M");
             match(tok_not);
-            return make_shared<UnOp>(tok_not, parseLevel4Op());
+            return makeNode<UnOp>(tok_not, parseLevel4Op());
         case tok_minus: //first N
         case tok_leftParenthesis:
         case tok_number:
@@ -622,7 +806,7 @@ shared_ptr<Expression> Parser::parseLevel5Op() {
         case tok_minus:
             printExpansion("64) N -> - N");
             match(tok_minus);
-            return make_shared<UnOp>(tok_minus, parseLevel5Op());
+            return makeNode<UnOp>(tok_minus, parseLevel5Op());
         case tok_number://first F''
         case tok_identifier:
             printExpansion("65) N -> F''");
@@ -653,14 +837,13 @@ shared_ptr<Statement> Parser::parseAfterIdent(const string name) {
         case tok_assign:
             printExpansion("68) O' -> := I");
             match(tok_assign);
-            return make_shared<Assign>(make_shared<VarReference>(name), parseExpression());
+            return makeNode<Assign>(makeNode<VarReference>(name), parseExpression());
         case tok_leftBracket: {
-            printExpansion("69) O' -> [ I ] O''");
+            printExpansion("69) O' -> [ V ] O''");
             match(tok_leftBracket);
-            auto expression = parseExpression();
+            auto item = parseIndexList(makeNode<VarReference>(name));
             match(tok_rightBracket);
-            auto var = make_shared<VarReference>(name);
-            return parseArrayElement(make_shared<ArrayItemReference>(var, expression));
+            return parseArrayElement(item);
         }
         case tok_leftParenthesis: {
             printExpansion("70) O' -> ( G )");
@@ -669,7 +852,7 @@ shared_ptr<Statement> Parser::parseAfterIdent(const string name) {
             vector <shared_ptr<Expression>> params;
             parseFuncParam(params);
             match(tok_rightParenthesis);
-            return make_shared<ProcedureCall>(name, params);
+            return makeNode<ProcedureCall>(name, params);
         }
 
         default:
@@ -684,13 +867,13 @@ shared_ptr<Statement> Parser::parseArrayElement(shared_ptr<ArrayItemReference> v
         case tok_assign:
             printExpansion("71) O'' -> := I");
             match(tok_assign);
-            return make_shared<Assign>(var, parseExpression());
+            return makeNode<Assign>(var, parseExpression());
         case tok_leftBracket: {
-            printExpansion("72) O'' -> [ I ] O''");
+            printExpansion("72) O'' -> [ V ] O''");
             match(tok_leftBracket);
-            auto expression = parseExpression();
+            auto item = parseIndexList(var);
             match(tok_rightBracket);
-            return parseArrayElement(make_shared<ArrayItemReference>(var, expression));
+            return parseArrayElement(item);
         }
         default:
             printExpansion("O'' exception");
@@ -699,6 +882,24 @@ shared_ptr<Statement> Parser::parseArrayElement(shared_ptr<ArrayItemReference> v
     return nullptr;
 }
 
+shared_ptr<ArrayItemReference> Parser::parseIndexList(shared_ptr<Reference> var) {
+    printExpansion("104) V -> I V'");
+    auto item = makeNode<ArrayItemReference>(var, parseExpression());
+    return parseMultIndex(item);
+}
+
+shared_ptr<ArrayItemReference> Parser::parseMultIndex(shared_ptr<ArrayItemReference> var) {
+    switch (CurTok) {
+        case tok_comma:
+            printExpansion("105) V' -> , I V'");
+            match(tok_comma);
+            return parseMultIndex(makeNode<ArrayItemReference>(var, parseExpression()));
+        default:
+            printExpansion("106) V' -> ε");
+            return var;
+    }
+}
+
 shared_ptr<Number> Parser::parseNumber() {
     switch (CurTok) {
         case tok_minus: {
@@ -712,7 +913,7 @@ shared_ptr<Number> Parser::parseNumber() {
             printExpansion("74) P -> numb");
             int tmp = m_Lexer.numVal();
             match(tok_number);
-            return make_shared<Number>(tmp);
+            return makeNode<Number>(tmp);
         }
         default:
             printExpansion("P exception");
@@ -722,19 +923,57 @@ shared_ptr<Number> Parser::parseNumber() {
 }
 
 void Parser::parseFuncParamDecl(vector <shared_ptr<Var>> & params) {
-    printExpansion("75) Q -> ident E' : H Q'");
+    printExpansion("75) Q -> Q'' ident E' : H Q'");
+    ParamMode mode = parseParamMode();
     vector <string> names;
+    vector <SourceLocation> locations;
     names.push_back(m_Lexer.identifierStr());
+    locations.push_back(m_Lexer.location());
     match(tok_identifier);
-    parseMultIdent(names);
+    parseMultIdent(names, locations);
     match(tok_declaration);
     auto type = parseType();
-    for (auto & name: names) {
-        params.push_back(make_shared<Var>(name, type, false));
+    for (size_t i = 0; i < names.size(); ++i) {
+        params.push_back(located(makeNode<Var>(names[i], type, false, mode), locations[i]));
     }
     parseFunctMultParamDecls(params);
 }
 
+void Parser::parseArrayRanges(vector <pair<int, int>> & ranges) {
+    switch (CurTok) {
+        case tok_comma: {
+            printExpansion("107) H'' -> , P . . P H''");
+            match(tok_comma);
+            auto minIndex = parseNumber();
+            match(tok_dot);
+            match(tok_dot);
+            auto maxIndex = parseNumber();
+            ranges.emplace_back(minIndex->getValue(), maxIndex->getValue());
+            parseArrayRanges(ranges);
+            break;
+        }
+        default:
+            printExpansion("108) H'' -> ε");
+            return;
+    }
+}
+
+ParamMode Parser::parseParamMode() {
+    switch (CurTok) {
+        case tok_var:
+            printExpansion("101) Q'' -> var");
+            match(tok_var);
+            return ParamMode::Var;
+        case tok_const:
+            printExpansion("102) Q'' -> const");
+            match(tok_const);
+            return ParamMode::Const;
+        default:
+            printExpansion("103) Q'' -> ε");
+            return ParamMode::Value;
+    }
+}
+
 void Parser::parseFunctMultParamDecls(vector <shared_ptr<Var>> & params) {
     switch (CurTok) {
         case tok_semicolon:
@@ -790,36 +1029,37 @@ shared_ptr<Statement> Parser::parseIf() {
 }
 
 shared_ptr<Statement> Parser::parseIfBlock(shared_ptr<Expression> condition) {
+    SourceLocation location = m_Lexer.location();
     switch (CurTok) {
         case tok_begin:
             printExpansion("83) S' -> U S''");
-            return make_shared<If>(parseBlock(), parseElse(), condition);
+            return makeNode<If>(parseBlock(), parseElse(), condition);
         case tok_identifier: {
             printExpansion("84) S' -> O S''");
             vector <shared_ptr<Statement>> statements;
-            statements.push_back(parseIdentLine());
-            return make_shared<If>(make_shared<Block>(statements), parseElse(), condition);
+            statements.push_back(located(parseIdentLine(), location));
+            return makeNode<If>(makeNode<Block>(statements), parseElse(), condition);
         }
         case tok_exit: {
             printExpansion("85) S' -> exit S''");
             match(tok_exit);
             vector <shared_ptr<Statement>> statements;
-            statements.push_back(make_shared<Special>(tok_exit));
-            return make_shared<If>(make_shared<Block>(statements), parseElse(), condition);
+            statements.push_back(located(makeNode<Special>(tok_exit), location));
+            return makeNode<If>(makeNode<Block>(statements), parseElse(), condition);
         }
         case tok_continue: {
             printExpansion("86) S' -> continue S''");
             match(tok_continue);
             vector <shared_ptr<Statement>> statements;
-            statements.push_back(make_shared<Special>(tok_continue));
-            return make_shared<If>(make_shared<Block>(statements), parseElse(), condition);
+            statements.push_back(located(makeNode<Special>(tok_continue), location));
+            return makeNode<If>(makeNode<Block>(statements), parseElse(), condition);
         }
         case tok_break: {
             printExpansion("87) S' -> break S''");
             match(tok_break);
             vector <shared_ptr<Statement>> statements;
-            statements.push_back(make_shared<Special>(tok_break));
-            return make_shared<If>(make_shared<Block>(statements), parseElse(), condition);
+            statements.push_back(located(makeNode<Special>(tok_break), location));
+            return makeNode<If>(makeNode<Block>(statements), parseElse(), condition);
         }
         default:
             printExpansion("S' exception");
@@ -841,33 +1081,34 @@ shared_ptr<Block> Parser::parseElse() {
 }
 
 shared_ptr<Block> Parser::parseElseBlock() {
+    SourceLocation location = m_Lexer.location();
     switch (CurTok) {
         case tok_identifier: {
             printExpansion("90) S''' -> O");
             vector <shared_ptr<Statement>> statements;
-            statements.push_back(parseIdentLine());
-            return make_shared<Block>(statements);
+            statements.push_back(located(parseIdentLine(), location));
+            return makeNode<Block>(statements);
         }
         case tok_exit: {
             printExpansion("91) S''' -> exit");
             match(tok_exit);
             vector <shared_ptr<Statement>> statements;
-            statements.push_back(make_shared<Special>(tok_exit));
-            return make_shared<Block>(statements);
+            statements.push_back(located(makeNode<Special>(tok_exit), location));
+            return makeNode<Block>(statements);
         }
         case tok_break: {
             printExpansion("92) S''' -> break");
             match(tok_break);
             vector <shared_ptr<Statement>> statements;
-            statements.push_back(make_shared<Special>(tok_break));
-            return make_shared<Block>(statements);
+            statements.push_back(located(makeNode<Special>(tok_break), location));
+            return makeNode<Block>(statements);
         }
         case tok_continue: {
             printExpansion("93) S''' -> continue");
             match(tok_continue);
             vector <shared_ptr<Statement>> statements;
-            statements.push_back(make_shared<Special>(tok_continue));
-            return make_shared<Block>(statements);
+            statements.push_back(located(makeNode<Special>(tok_continue), location));
+            return makeNode<Block>(statements);
         }
         case tok_begin:
             printExpansion("94) S''' -> U");
@@ -879,7 +1120,7 @@ shared_ptr<Block> Parser::parseElseBlock() {
     return nullptr;
 }
 
-shared_ptr<Block> Parser::parseFunctionForward() {
+shared_ptr<Block> Parser::parseFunctionForward(bool & pure) {
     switch (CurTok) {
         case tok_begin:
             printExpansion("95) T -> U");
@@ -888,9 +1129,15 @@ shared_ptr<Block> Parser::parseFunctionForward() {
             printExpansion("96) T -> forward");
             match(tok_forward);
             return nullptr;
+        case tok_pure:
+            printExpansion("109) T -> pure ; T");
+            match(tok_pure);
+            match(tok_semicolon);
+            pure = true;
+            return parseFunctionForward(pure);
         default:
             printExpansion("T exception");
-            throwParseException({tok_begin, tok_forward});
+            throwParseException({tok_begin, tok_forward, tok_pure});
     }
     return nullptr;
 }
@@ -900,8 +1147,10 @@ shared_ptr<Block> Parser::parseBlock() {
     match(tok_begin);
     vector <shared_ptr<Statement>> statements;
     parseStatement(statements);
+    auto block = makeNode<Block>(statements);
+    block->end = m_Lexer.location();
     match(tok_end);
-    return make_shared<Block>(statements);
+    return block;
 }
 
 
@@ -17,6 +17,8 @@
 #include "Lexer.hpp"
 #include "Tree.hpp"
 
+#include <functional>
+
 static unordered_map<Token, string> tokens = {
         {tok_error,            "UNKNOWN TOKEN"},
         {tok_eof,              "EOF"},
@@ -82,7 +84,9 @@ static unordered_map<Token, string> tokens = {
         {tok_semicolon,        ";"},
         {tok_of,               "of"},
         {tok_break,            "break"},
-        {tok_continue,         "continue"}
+        {tok_continue,         "continue"},
+        {tok_boolean,          "boolean"},
+        {tok_pure,             "pure"}
 };
 
 
@@ -94,7 +98,10 @@ public:
 
     bool Parse();                    // parse
     const llvm::Module & Generate();  // generate
+    BytecodeProgram Compile(bool countHotness = false);  // generate bytecode instead of LLVM IR
+    const llvm::Module & Translate(); // generate LLVM IR of program parsed by Compile
     bool showExpansion = false; // if true, print used expansion rules
+    bool streaming = false;     // declarations are lowered as soon as they are parsed and their AST is released
     void printExpansion(string s);
 
 private:
@@ -107,11 +114,24 @@ private:
     void throwParseException(vector <Token> expected);
 
 
+    vector <shared_ptr<Statement>> statements;  // program followed by declarations, in order of source
+    function<void(const shared_ptr <Statement> &)> lower;  // lowers declaration when streaming
+    vector <shared_ptr<Function>> interpretable;    // bodies kept when streaming, their calls may be evaluated
+
+    // declaration is stored, or lowered right away when streaming
+    void addDeclaration(const shared_ptr <Statement> & statement);
+
+    // passes over the whole module after all declarations are translated
+    const llvm::Module & runModulePasses();
+
+    // definitions of runtime functions are linked from embedded bitcode of fce.c, they are internal in module
+    void addRuntime();
+
     //A - program
     void parseProgram();
 
     //B - global var, function, procedure, const, main declarations
-    void parseDecls(vector <shared_ptr<Statement>> & statements);
+    void parseDecls();
 
     //C - local var
     void parseLocalVar(vector <shared_ptr<Var>> & vars);
@@ -120,13 +140,14 @@ private:
     void parseStatement(vector <shared_ptr<Statement>> & statements);
 
     //D' - remaining part of for
-    void parseFor(string varName, shared_ptr <Expression> startExpr, vector <shared_ptr<Statement>> & statements);
+    void parseFor(string varName, shared_ptr <Expression> startExpr, SourceLocation location,
+                  vector <shared_ptr<Statement>> & statements);
 
     //E - ident and type of var, multiple vars
     void parseVarDecl(vector <shared_ptr<Var>> & vars, bool global);
 
-    //E' - multiple identifier
-    void parseMultIdent(vector <string> & names);
+    //E' - multiple identifier, with position of every identifier
+    void parseMultIdent(vector <string> & names, vector <SourceLocation> & locations);
 
     //E'' multiple var declarations
     void parseMultVarDecls(vector <shared_ptr<Var>> & vars, bool global);
@@ -152,6 +173,12 @@ private:
     //H - type
     shared_ptr <Type> parseType();
 
+    //H' - array with bounds or open array
+    shared_ptr <Type> parseArrayType();
+
+    //H'' - bounds of more array dimensions
+    void parseArrayRanges(vector <pair<int, int>> & ranges);
+
     //I - expression - level 1 operand
     shared_ptr <Expression> parseExpression();
 
@@ -200,6 +227,15 @@ private:
     //Q' - more function/procedure param declarations
     void parseFunctMultParamDecls(vector <shared_ptr<Var>> & params);
 
+    //Q'' - param passing mode - var, const or by value
+    ParamMode parseParamMode();
+
+    //V - array indexes, a[i, j] is a[i][j]
+    shared_ptr <ArrayItemReference> parseIndexList(shared_ptr <Reference> var);
+
+    //V' - more array indexes
+    shared_ptr <ArrayItemReference> parseMultIndex(shared_ptr <ArrayItemReference> var);
+
     //R - parse statement if there is, else end block with or without ; (last statement can end without ;)
     void parseNextStatement(vector <shared_ptr<Statement>> & statements);
 
@@ -218,8 +254,8 @@ private:
     //S''' - block or single statement (starting with identifier) = assign, exit, function call
     shared_ptr <Block> parseElseBlock();
 
-    //T - function forward
-    shared_ptr <Block> parseFunctionForward();
+    //T - function forward, pure directive sets pure
+    shared_ptr <Block> parseFunctionForward(bool & pure);
 
     //U - block
     shared_ptr <Block> parseBlock();
@@ -0,0 +1,119 @@
+#include "SSABuilder.hpp"
+
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+
+void SSABuilder::reset() {
+    types.clear();
+    names.clear();
+    currentDef.clear();
+    phiVariables.clear();
+    sealedBlocks.clear();
+    incompletePhis.clear();
+    pendingPhis.clear();
+}
+
+int SSABuilder::declareVariable(llvm::Type * type, const string & name) {
+    types.push_back(type);
+    names.push_back(name);
+    currentDef.emplace_back();
+    return (int) types.size() - 1;
+}
+
+llvm::Type * SSABuilder::getVariableType(int variable) const {
+    return types[variable];
+}
+
+void SSABuilder::writeVariable(int variable, llvm::BasicBlock * block, llvm::Value * value) {
+    currentDef[variable][block] = value;
+}
+
+llvm::Value * SSABuilder::readVariable(int variable, llvm::BasicBlock * block) {
+    auto def = currentDef[variable].find(block);
+    if (def != currentDef[variable].end())
+        return def->second;
+    return readVariableRecursive(variable, block);
+}
+
+void SSABuilder::sealBlock(llvm::BasicBlock * block) {
+    auto incomplete = incompletePhis.find(block);
+    if (incomplete != incompletePhis.end()) {
+        auto phis = incomplete->second;
+        incompletePhis.erase(incomplete);
+        for (auto & phi: phis)
+            addPhiOperands(phi.first, phi.second);
+    }
+    sealedBlocks.insert(block);
+}
+
+llvm::Value * SSABuilder::readVariableRecursive(int variable, llvm::BasicBlock * block) {
+    llvm::Value * value;
+    if (!sealedBlocks.count(block)) {
+//incomplete CFG - operands are added when the block is sealed
+        llvm::PHINode * phi = createPhi(variable, block);
+        incompletePhis[block][variable] = phi;
+        value = phi;
+    } else if (llvm::pred_empty(block)) {
+//read before any write (entry block or unreachable code)
+        value = llvm::UndefValue::get(types[variable]);
+    } else if (block->getSinglePredecessor()) {
+        value = readVariable(variable, block->getSinglePredecessor());
+    } else {
+//break potential cycles with operandless phi
+        llvm::PHINode * phi = createPhi(variable, block);
+        writeVariable(variable, block, phi);
+        value = addPhiOperands(variable, phi);
+    }
+    writeVariable(variable, block, value);
+    return value;
+}
+
+llvm::PHINode * SSABuilder::createPhi(int variable, llvm::BasicBlock * block) {
+    llvm::PHINode * phi;
+    if (llvm::Instruction * first = block->getFirstNonPHI())
+        phi = llvm::PHINode::Create(types[variable], 2, names[variable], first);
+    else
+        phi = llvm::PHINode::Create(types[variable], 2, names[variable], block);
+    phiVariables[phi] = variable;
+    return phi;
+}
+
+llvm::Value * SSABuilder::addPhiOperands(int variable, llvm::PHINode * phi) {
+    pendingPhis.insert(phi);
+    for (llvm::BasicBlock * pred: llvm::predecessors(phi->getParent()))
+        phi->addIncoming(readVariable(variable, pred), pred);
+    pendingPhis.erase(phi);
+    return tryRemoveTrivialPhi(variable, phi);
+}
+
+llvm::Value * SSABuilder::tryRemoveTrivialPhi(int variable, llvm::PHINode * phi) {
+    llvm::Value * same = nullptr;
+    for (llvm::Value * op: phi->incoming_values()) {
+        if (op == same || op == phi)
+            continue;
+        if (same)
+            return phi;
+        same = op;
+    }
+    if (!same)
+        same = llvm::UndefValue::get(types[variable]);
+
+//phis using this one may become trivial too
+    vector <llvm::WeakVH> users;
+    for (llvm::User * user: phi->users())
+        if (user != phi && llvm::isa<llvm::PHINode>(user))
+            users.emplace_back(user);
+
+//current definitions are tracking handles, they follow the replacement
+    phi->replaceAllUsesWith(same);
+    phiVariables.erase(phi);
+    phi->eraseFromParent();
+
+//same may be one of the users and get replaced too
+    llvm::WeakTrackingVH result(same);
+    for (auto & user: users)
+        if (auto * userPhi = llvm::dyn_cast_or_null<llvm::PHINode>(user))
+            if (phiVariables.count(userPhi) && !pendingPhis.count(userPhi))
+                tryRemoveTrivialPhi(phiVariables[userPhi], userPhi);
+    return result;
+}
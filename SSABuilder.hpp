@@ -0,0 +1,59 @@
+#ifndef MILA_SSABUILDER_HPP
+#define MILA_SSABUILDER_HPP
+
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Type.h"
+#include "llvm/IR/Value.h"
+#include "llvm/IR/ValueHandle.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief On the fly SSA construction (Braun et al., Simple and Efficient Construction of Static Single Assignment Form)
+ *
+ * Scalar variables are identified by number, every write records the current definition for the block and reads
+ * look the definition up through predecessors, placing phi nodes where control flow merges.
+ * Phi operands of a block are filled in when the block is sealed, i.e. when all its predecessors are known.
+ */
+class SSABuilder {
+public:
+    // forget all variables and blocks, called at the start of every function
+    void reset();
+
+    int declareVariable(llvm::Type * type, const string & name);
+
+    llvm::Type * getVariableType(int variable) const;
+
+    void writeVariable(int variable, llvm::BasicBlock * block, llvm::Value * value);
+
+    llvm::Value * readVariable(int variable, llvm::BasicBlock * block);
+
+    // no more predecessors will be added to block
+    void sealBlock(llvm::BasicBlock * block);
+
+private:
+    llvm::Value * readVariableRecursive(int variable, llvm::BasicBlock * block);
+
+    llvm::PHINode * createPhi(int variable, llvm::BasicBlock * block);
+
+    llvm::Value * addPhiOperands(int variable, llvm::PHINode * phi);
+
+    llvm::Value * tryRemoveTrivialPhi(int variable, llvm::PHINode * phi);
+
+    vector <llvm::Type *> types;
+    vector <string> names;
+    vector <map<llvm::BasicBlock *, llvm::WeakTrackingVH>> currentDef;
+    map <llvm::PHINode *, int> phiVariables;
+    set <llvm::BasicBlock *> sealedBlocks;
+    map <llvm::BasicBlock *, map<int, llvm::PHINode *>> incompletePhis;
+    // phis whose operands are being filled in, they must not be removed from under the caller
+    set <llvm::PHINode *> pendingPhis;
+};
+
+#endif //MILA_SSABUILDER_HPP
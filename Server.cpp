@@ -0,0 +1,236 @@
+#include "Server.hpp"
+
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static const uint32_t maxString = 1u << 20;
+static const uint32_t maxStrings = 4096;
+
+// result of request, sent by process handling the connection to the server, fits to atomic write to pipe
+struct RequestRecord {
+    double latency;     // ms from accept until exit code is sent
+    double compile;     // ms of compilation in forked process
+    int exitCode;
+    char command[240];
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int) {
+    stopping = 1;
+}
+
+static bool readString(int fd, string & text) {
+    uint32_t size;
+    if (!readAll(fd, &size, sizeof(size)) || size > maxString)
+        return false;
+    text.resize(size);
+    return readAll(fd, &text[0], size);
+}
+
+// number of strings with stdin, stdout and stderr, false when client sent no descriptors
+static bool receiveHeader(int connection, uint32_t & count, int descriptors[3]) {
+    char control[CMSG_SPACE(3 * sizeof(int))];
+    iovec data = {&count, sizeof(count)};
+    msghdr header = {};
+    header.msg_iov = &data;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    ssize_t got;
+    while ((got = recvmsg(connection, &header, 0)) < 0 && errno == EINTR);
+    if (got <= 0)
+        return false;
+    cmsghdr * rights = CMSG_FIRSTHDR(&header);
+    if (!rights || rights->cmsg_level != SOL_SOCKET || rights->cmsg_type != SCM_RIGHTS ||
+        rights->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+        return false;
+    memcpy(descriptors, CMSG_DATA(rights), 3 * sizeof(int));
+    return got == sizeof(count) || readAll(connection, (char *) &count + got, sizeof(count) - got);
+}
+
+static double millisecondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// process of connection, it compiles in another process so that crash of compiler is reported to client too
+static void handleConnection(int connection, int stats, chrono::steady_clock::time_point accepted,
+                             CompileFunction compile) {
+    uint32_t count;
+    int descriptors[3];
+    if (!receiveHeader(connection, count, descriptors) || count < 1 || count > maxStrings)
+        return;
+    vector <string> strings(count);
+    for (auto & text: strings)
+        if (!readString(connection, text))
+            return;
+
+    RequestRecord record = {};
+    string command = "mila";
+    for (size_t i = 1; i < strings.size(); ++i)
+        command += " " + strings[i];
+    strncpy(record.command, command.c_str(), sizeof(record.command) - 1);
+
+    auto started = chrono::steady_clock::now();
+    pid_t worker = fork();
+    if (worker == 0) {
+        for (int fd = 0; fd < 3; ++fd)
+            dup2(descriptors[fd], fd);
+        close(connection);
+        close(stats);
+        if (chdir(strings[0].c_str()) != 0) {
+            cerr << "Can not change directory to " << strings[0] << endl;
+            exit(1);
+        }
+        vector <char *> argv = {(char *) "mila"};
+        for (size_t i = 1; i < strings.size(); ++i)
+            argv.push_back(&strings[i][0]);
+        argv.push_back(nullptr);
+//destructors of LLVM statics are skipped, only output is flushed
+        int exitCode = compile(argv.size() - 1, argv.data());
+        cout.flush();
+        llvm::outs().flush();
+        fflush(nullptr);
+        _exit(exitCode);
+    }
+    int exitCode = 1;
+    if (worker > 0) {
+        int status;
+        while (waitpid(worker, &status, 0) < 0 && errno == EINTR);
+        exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    } else
+        dprintf(descriptors[2], "Compile server can not fork: %s\n", strerror(errno));
+    record.compile = millisecondsSince(started);
+    record.exitCode = exitCode;
+
+    writeAll(connection, &exitCode, sizeof(exitCode));
+    close(connection);
+    record.latency = millisecondsSince(accepted);
+    writeAll(stats, &record, sizeof(record));
+}
+
+static double percentile(const vector <double> & sorted, double fraction) {
+    return sorted[min(sorted.size() - 1, (size_t) (fraction * sorted.size()))];
+}
+
+// mean of the two middle values for an even number of them
+static double median(const vector <double> & sorted) {
+    size_t middle = sorted.size() / 2;
+    return sorted.size() % 2 ? sorted[middle] : (sorted[middle - 1] + sorted[middle]) / 2;
+}
+
+static void printStats(const vector <double> & latencies) {
+    vector <double> sorted = latencies;
+    sort(sorted.begin(), sorted.end());
+    double total = 0;
+    for (double latency: sorted)
+        total += latency;
+    fprintf(stderr, "%zu requests: mean %.3f ms, median %.3f ms, p95 %.3f ms, max %.3f ms\n", sorted.size(),
+            total / sorted.size(), median(sorted), percentile(sorted, 0.95), sorted.back());
+}
+
+int runServer(const string & socketPath, CompileFunction compile) {
+    sockaddr_un address;
+    if (!setAddress(socketPath, address))
+        return 1;
+//socket of server which did not stop cleanly is replaced, socket of running server is not
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || connect(listener, (sockaddr *) &address, sizeof(address)) == 0) {
+        cerr << "Compile server already runs on " << socketPath << endl;
+        return 1;
+    }
+    close(listener);
+    unlink(socketPath.c_str());
+//socket is created read-write for the owner only, requests run compilations in directories of the server user
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t oldMask = umask(077);
+    bool bound = listener >= 0 && bind(listener, (sockaddr *) &address, sizeof(address)) == 0;
+    umask(oldMask);
+    if (!bound || listen(listener, SOMAXCONN) != 0) {
+        cerr << "Can not listen on " << socketPath << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    int stats[2];
+    if (pipe(stats) != 0) {
+        cerr << "Can not create pipe: " << strerror(errno) << endl;
+        return 1;
+    }
+
+//WARM STATE - shared libraries are loaded and relocated already, targets are initialized for tiered execution
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+
+    struct sigaction action = {};
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+    cerr << "Compile server listens on " << socketPath << endl;
+
+    vector <double> latencies;
+    pollfd polled[2] = {{listener, POLLIN, 0},
+                        {stats[0], POLLIN, 0}};
+    while (!stopping) {
+        int ready = poll(polled, 2, 1000);
+        while (waitpid(-1, nullptr, WNOHANG) > 0);
+        if (ready <= 0)
+            continue;
+        if (polled[1].revents & POLLIN) {
+            RequestRecord record;
+            if (readAll(stats[0], &record, sizeof(record))) {
+                latencies.push_back(record.latency);
+                fprintf(stderr, "request %zu: %s, exit %d, %.3f ms (compile %.3f ms); ", latencies.size(),
+                        record.command, record.exitCode, record.latency, record.compile);
+                printStats(latencies);
+            }
+        }
+        if (polled[0].revents & POLLIN) {
+            int connection = accept(listener, nullptr, nullptr);
+            if (connection < 0)
+                continue;
+//only the user of the server, also when the socket got wider permissions or lives in a shared directory
+            ucred peer;
+            socklen_t peerSize = sizeof(peer);
+            if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &peer, &peerSize) != 0 || peer.uid != getuid()) {
+                cerr << "Rejected connection of user " << (peerSize == sizeof(peer) ? to_string(peer.uid) : "?") << endl;
+                close(connection);
+                continue;
+            }
+            auto accepted = chrono::steady_clock::now();
+            pid_t handler = fork();
+            if (handler == 0) {
+                signal(SIGINT, SIG_DFL);
+                signal(SIGTERM, SIG_DFL);
+                close(listener);
+                close(stats[0]);
+                handleConnection(connection, stats[1], accepted, compile);
+                _exit(0);
+            }
+            if (handler < 0)
+                cerr << "Can not fork: " << strerror(errno) << endl;
+            close(connection);
+        }
+    }
+    close(listener);
+    unlink(socketPath.c_str());
+    if (!latencies.empty())
+        printStats(latencies);
+    return 0;
+}
@@ -0,0 +1,48 @@
+//
+// Compile server which keeps LLVM loaded and initialized between compilations, and its client
+//
+
+#ifndef MILA_SERVER_HPP
+#define MILA_SERVER_HPP
+
+#include <cstddef>
+#include <string>
+
+#include <sys/un.h>
+
+using namespace std;
+
+/*
+ * Request: number of strings and the strings (working directory of client and options), every string prefixed by its
+ * length. stdin, stdout and stderr of client go with the first bytes as SCM_RIGHTS, the compiler reads and writes them
+ * directly, so output is not buffered in server and programs run by --vm can read input as it comes.
+ * Response: exit code. Numbers are 32 bit in byte order of the machine, client and server run on the same one.
+ */
+
+// compilation with command line options, the same as run of the compiler, returns exit code
+typedef int (* CompileFunction)(int argc, char * argv[]);
+
+/**
+ * @brief Serves compile requests on Unix domain socket until SIGINT or SIGTERM
+ *
+ * State of compiler is global, so every request is compiled in a process forked from the server. The fork has LLVM
+ * initialized already (static constructors of its options take most of start of the compiler), only the compilation
+ * itself is left. It reads and writes stdin, stdout and stderr of the client, which are passed over the socket. Every
+ * connection is handled by its own process, so requests run concurrently. Latency of each request (from accept until
+ * the exit code is sent) is logged to stderr together with statistics of all requests so far.
+ */
+int runServer(const string & socketPath, CompileFunction compile);
+
+// whole buffer is written or read, false on error or end of file
+bool writeAll(int fd, const void * data, size_t size);
+
+bool readAll(int fd, void * data, size_t size);
+
+// false when path does not fit to the address
+bool setAddress(const string & socketPath, sockaddr_un & address);
+
+// sends options and working directory to server, compilation uses stdin, stdout and stderr of client, returns its
+// exit code
+int runClient(const string & socketPath, int argc, char * argv[]);
+
+#endif //MILA_SERVER_HPP
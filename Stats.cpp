@@ -0,0 +1,243 @@
+#include "Stats.hpp"
+
+#include "llvm/IR/Constants.h"
+#include "llvm/Support/JSON.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <set>
+
+#include <cxxabi.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+CompileStats * compileStats = nullptr;
+
+// counters of operator new, they run only while stats are collected, tiered JIT allocates from another thread
+static atomic<bool> counting(false);
+static atomic<uint64_t> allocatedBytes(0);
+static atomic<uint64_t> allocationCount(0);
+static atomic<uint64_t> freedBytes(0);
+static atomic<int64_t> heapGrowth(0);
+static atomic<int64_t> heapPeak(0);
+
+void * operator new(size_t size) {
+    void * pointer = malloc(size ? size : 1);
+    if (!pointer)
+        throw bad_alloc();
+    if (counting.load(memory_order_relaxed)) {
+        size_t usable = malloc_usable_size(pointer);
+        allocatedBytes.fetch_add(usable, memory_order_relaxed);
+        allocationCount.fetch_add(1, memory_order_relaxed);
+        int64_t growth = heapGrowth.fetch_add(usable, memory_order_relaxed) + usable;
+        int64_t peak = heapPeak.load(memory_order_relaxed);
+        while (growth > peak && !heapPeak.compare_exchange_weak(peak, growth, memory_order_relaxed));
+    }
+    return pointer;
+}
+
+void * operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void * pointer) noexcept {
+    if (pointer && counting.load(memory_order_relaxed)) {
+        size_t usable = malloc_usable_size(pointer);
+        freedBytes.fetch_add(usable, memory_order_relaxed);
+        heapGrowth.fetch_sub(usable, memory_order_relaxed);
+    }
+    free(pointer);
+}
+
+void operator delete[](void * pointer) noexcept {
+    operator delete(pointer);
+}
+
+void operator delete(void * pointer, size_t) noexcept {
+    operator delete(pointer);
+}
+
+void operator delete[](void * pointer, size_t) noexcept {
+    operator delete(pointer);
+}
+
+// resident set size now, 0 when it is not known
+static uint64_t currentRss() {
+    FILE * statm = fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+    unsigned long size, resident = 0;
+    if (fscanf(statm, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose(statm);
+    return (uint64_t) resident * sysconf(_SC_PAGESIZE);
+}
+
+static uint64_t peakRss() {
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return (uint64_t) usage.ru_maxrss * 1024;
+}
+
+// name of AST class
+static string demangle(const char * name) {
+    int status;
+    char * demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (!demangled)
+        return name;
+    string result = demangled;
+    free(demangled);
+    return result;
+}
+
+CompileStats::CompileStats() : owner(this_thread::get_id()) {
+    counting = true;
+}
+
+void CompileStats::beginPhase(const string & name) {
+    if (this_thread::get_id() != owner)
+        return;
+    endPhase();
+    phases.emplace_back();
+    phases.back().name = name;
+    inPhase = true;
+    phaseStart = chrono::steady_clock::now();
+    allocatedBytes = 0;
+    allocationCount = 0;
+    freedBytes = 0;
+    heapGrowth = 0;
+    heapPeak = 0;
+}
+
+void CompileStats::endPhase() {
+    if (!inPhase)
+        return;
+    inPhase = false;
+    Phase & phase = phases.back();
+    phase.microseconds = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - phaseStart).count();
+    phase.allocated = allocatedBytes;
+    phase.allocations = allocationCount;
+    phase.freed = freedBytes;
+    phase.peak = heapPeak;
+    phase.rss = currentRss();
+}
+
+void CompileStats::countModule(const llvm::Module & module) {
+    for (const llvm::Function & F: module) {
+        if (F.isDeclaration()) {
+            ++declarations;
+            continue;
+        }
+        functions.push_back({F.getName().str(), F.size(), F.getInstructionCount()});
+        for (const llvm::Argument & arg: F.args())
+            namedValues += arg.hasName();
+        for (const llvm::BasicBlock & BB: F) {
+            namedValues += BB.hasName();
+            for (const llvm::Instruction & I: BB)
+                namedValues += I.hasName();
+        }
+    }
+    set <string> contents;
+    for (const llvm::GlobalVariable & global: module.globals()) {
+        ++globals;
+        auto data = global.hasInitializer() ? llvm::dyn_cast<llvm::ConstantDataSequential>(global.getInitializer())
+                                            : nullptr;
+        if (data && data->isString()) {
+            ++strings;
+            if (!contents.insert(data->getAsString().str()).second)
+                ++duplicateStrings;
+        }
+    }
+}
+
+void CompileStats::countBytecode(const BytecodeProgram & program) {
+    for (auto & function: program.functions)
+        if (function.defined)
+            bytecodeFunctions.push_back({function.name, (uint64_t) function.frameSize, function.code.size()});
+}
+
+void CompileStats::write(llvm::raw_ostream & out) {
+    endPhase();
+    counting = false;
+    llvm::json::OStream json(out, 2);
+    json.object([&] {
+        json.attribute("peakRss", peakRss());
+        json.attributeArray("phases", [&] {
+            for (auto & phase: phases)
+                json.object([&] {
+                    json.attribute("name", phase.name);
+                    json.attribute("microseconds", phase.microseconds);
+                    json.attribute("allocatedBytes", phase.allocated);
+                    json.attribute("allocations", phase.allocations);
+                    json.attribute("freedBytes", phase.freed);
+                    json.attribute("peakHeapGrowth", phase.peak);
+                    json.attribute("rss", phase.rss);
+                });
+        });
+        json.attributeObject("tokens", [&] {
+            uint64_t total = 0;
+            for (auto & token: tokens)
+                total += token.second;
+            json.attribute("total", total);
+            json.attributeObject("byKind", [&] {
+                for (auto & token: tokens)
+                    json.attribute(token.first, token.second);
+            });
+        });
+        json.attributeObject("ast", [&] {
+            uint64_t total = 0, bytes = 0;
+            map <string, NodeCount> named;
+            for (auto & node: nodes) {
+                total += node.second.count;
+                bytes += node.second.bytes;
+                named[demangle(node.first.name())] = node.second;
+            }
+            json.attribute("nodes", total);
+            json.attribute("bytes", bytes);
+            json.attributeObject("byKind", [&] {
+                for (auto & node: named)
+                    json.attributeObject(node.first, [&] {
+                        json.attribute("nodes", node.second.count);
+                        json.attribute("bytes", node.second.bytes);
+                    });
+            });
+        });
+        if (!functions.empty() || declarations)
+            json.attributeObject("ir", [&] {
+                uint64_t blocks = 0, instructions = 0;
+                for (auto & function: functions) {
+                    blocks += function.blocks;
+                    instructions += function.instructions;
+                }
+                json.attribute("instructions", instructions);
+                json.attribute("basicBlocks", blocks);
+                json.attribute("declarations", declarations);
+                json.attribute("globals", globals);
+                json.attribute("strings", strings);
+                json.attribute("duplicateStrings", duplicateStrings);
+                json.attribute("namedValues", namedValues);
+                json.attributeArray("functions", [&] {
+                    for (auto & function: functions)
+                        json.object([&] {
+                            json.attribute("name", function.name);
+                            json.attribute("basicBlocks", function.blocks);
+                            json.attribute("instructions", function.instructions);
+                        });
+                });
+            });
+        if (!bytecodeFunctions.empty())
+            json.attributeArray("bytecode", [&] {
+                for (auto & function: bytecodeFunctions)
+                    json.object([&] {
+                        json.attribute("name", function.name);
+                        json.attribute("registers", function.registers);
+                        json.attribute("instructions", function.instructions);
+                    });
+            });
+    });
+    out << "\n";
+}
@@ -0,0 +1,109 @@
+//
+// Memory and size accounting of compilation, reported as JSON by --stats
+//
+
+#ifndef MILA_STATS_HPP
+#define MILA_STATS_HPP
+
+#include "Bytecode.hpp"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <thread>
+#include <typeindex>
+#include <typeinfo>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief Counts of compilation, collected only when --stats is given
+ *
+ * Compilation is split to phases, every phase gets time, bytes and number of allocations through operator new,
+ * bytes freed, peak of heap growth and resident set size at its end. Most of memory of LLVM and all of AST and
+ * containers of compiler go through operator new, SmallVector buffers and malloc of C library do not.
+ */
+class CompileStats {
+public:
+    CompileStats();
+
+    // ends the current phase and starts next one, phases of other threads (translation for tiered JIT) belong to
+    // the phase of main thread
+    void beginPhase(const string & name);
+
+    void countToken(const string & token) { ++tokens[token]; }
+
+    template<class T>
+    void countNode() {
+        NodeCount & count = nodes[type_index(typeid(T))];
+        ++count.count;
+        count.bytes += sizeof(T);
+    }
+
+    // functions, basic blocks, instructions, globals and named values of module
+    void countModule(const llvm::Module & module);
+
+    // instructions and registers of every function
+    void countBytecode(const BytecodeProgram & program);
+
+    // ends the current phase and writes everything as JSON object
+    void write(llvm::raw_ostream & out);
+
+private:
+    struct Phase {
+        string name;
+        uint64_t microseconds = 0;
+        uint64_t allocated = 0;     // bytes allocated in phase
+        uint64_t allocations = 0;
+        uint64_t freed = 0;         // bytes freed in phase, also of objects allocated before
+        int64_t peak = 0;           // highest heap growth since start of phase
+        uint64_t rss = 0;           // resident set size at end of phase
+    };
+
+    struct NodeCount {
+        uint64_t count = 0;
+        uint64_t bytes = 0;         // size of objects, without strings and vectors they own
+    };
+
+    struct FunctionCount {
+        string name;
+        uint64_t blocks;
+        uint64_t instructions;
+    };
+
+    struct BytecodeCount {
+        string name;
+        uint64_t registers;
+        uint64_t instructions;
+    };
+
+    vector <Phase> phases;
+    bool inPhase = false;
+    thread::id owner;
+    chrono::steady_clock::time_point phaseStart;
+    map <string, uint64_t> tokens;
+    map <type_index, NodeCount> nodes;
+    vector <FunctionCount> functions;
+    vector <BytecodeCount> bytecodeFunctions;
+    uint64_t declarations = 0;          // functions without body, runtime
+    uint64_t globals = 0;
+    uint64_t strings = 0;               // constant strings of write and writeln
+    uint64_t duplicateStrings = 0;      // strings with the same content as another one
+    uint64_t namedValues = 0;           // instructions, arguments and basic blocks with name
+
+    void endPhase();
+};
+
+// null unless --stats is given
+extern CompileStats * compileStats;
+
+inline void statsPhase(const string & name) {
+    if (compileStats)
+        compileStats->beginPhase(name);
+}
+
+#endif //MILA_STATS_HPP
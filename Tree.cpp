@@ -3,8 +3,130 @@
 //
 
 #include "Tree.hpp"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/IR/ReplaceConstant.h"
+#include "llvm/ProfileData/InstrProf.h"
+#include "llvm/ProfileData/ProfileCommon.h"
+#include <fstream>
 #include <sstream>
 
+bool directSSA = false;
+bool arrayChecks = false;
+LocalArrays localArrays = LocalArrays::Stack;
+bool wholeProgram = false;
+bool discardValueNames = false;
+bool linkRuntime = false;
+bool instrument = false;
+bool profileGenerate = false;
+bool debugInfo = false;
+string sourceName = "stdin";
+bool debugLocations = false;
+vector <SourceLoop> sourceLoops;
+vector <string> profileUse;
+vector <string> profileMismatches;
+vector <TailCall> tailCalls;
+vector <string> foldedCalls;
+vector <string> rejectedCalls;
+
+// evaluation of a call by function and arguments, failures are kept too so that no call is evaluated twice
+struct EvaluatedCall {
+    bool ok;
+    ConstValue result;
+    string failure;
+};
+static map<pair<string, vector<int>>, EvaluatedCall> evaluatedCalls;
+int interpreterFuelLeft = interpreterFuel;
+bool foldCalls = true;
+static const string tooDeep = "more than " + to_string(interpreterMaxDepth) + " nested calls";
+int memoSize = 1024;
+MemoEviction memoEviction = MemoEviction::Replace;
+ArrayCheckStats arrayCheckStats;
+static set <string> forwardFunctions;    // declared before their body, calls of them may still be folded
+static map <string, string> droppedBodies;  // bodies released by --stream, why their calls can not be folded
+static bool inCheckedCopy = false;  // checked copy of versioned loop, loops in it are not versioned again
+static unique_ptr <llvm::DIBuilder> debugBuilder;   // exists from start of module until its debug info is finished
+static llvm::DICompileUnit * debugUnit = nullptr;
+static llvm::DIScope * debugScope = nullptr;        // function or for loop being translated, null outside functions
+static map<int, llvm::DILocalVariable *> ssaDebugVars;  // described variables of SSABuilder in current function
+
+/**
+ * @brief Loads value of type pointed to by address
+ */
+static llvm::Value * createLoad(shared_ptr <llvm::IRBuilder<>> builder, llvm::Value * address) {
+    return builder->CreateLoad(address->getType()->getPointerElementType(), address);
+}
+
+/**
+ * @brief Frame builder - creates stack slot in the entry block of the current function
+ *
+ * Slots are appended after allocas already at the top of the entry block regardless of the current insert point,
+ * so loops do not allocate on every iteration and mem2reg/SROA can promote them.
+ */
+static llvm::AllocaInst * createFrameSlot(shared_ptr <llvm::IRBuilder<>> builder, llvm::Type * type, const string & name) {
+    llvm::BasicBlock & entry = builder->GetInsertBlock()->getParent()->getEntryBlock();
+    auto insertPoint = entry.begin();
+    while (insertPoint != entry.end() && llvm::isa<llvm::AllocaInst>(*insertPoint))
+        ++insertPoint;
+    llvm::IRBuilder<> frameBuilder(&entry, insertPoint);
+    return frameBuilder.CreateAlloca(type, nullptr, name);
+}
+
+/**
+ * @brief Converts between integer and boolean values, boolean is widened to 0/1 and integer is true when nonzero
+ */
+static llvm::Value * castToType(shared_ptr <llvm::IRBuilder<>> builder, llvm::Value * value, llvm::Type * type) {
+    if (value->getType() == type || !value->getType()->isIntegerTy() || !type->isIntegerTy())
+        return value;
+    if (type->isIntegerTy(1))
+        return builder->CreateICmpNE(value, llvm::ConstantInt::get(value->getType(), 0));
+    return builder->CreateZExt(value, type);
+}
+
+static bool isBoolean(llvm::Type * type) {
+    return type->isIntegerTy(1);
+}
+
+/**
+ * @brief Strips address arithmetic from pointer, result is variable (alloca, global or argument) it points into
+ */
+static llvm::Value * getBaseObject(llvm::Value * ptr) {
+    while (true) {
+        if (auto gep = llvm::dyn_cast<llvm::GEPOperator>(ptr))
+            ptr = gep->getPointerOperand();
+        else if (auto cast = llvm::dyn_cast<llvm::BitCastOperator>(ptr))
+            ptr = cast->getOperand(0);
+        else
+            return ptr;
+    }
+}
+
+/**
+ * @brief Instructions created next are at position of node in the current function, nodes without position keep the
+ * position of the enclosing statement
+ */
+static void setDebugLocation(const Node & node, shared_ptr <llvm::IRBuilder<>> builder) {
+    if (debugScope && node.location.line)
+        builder->SetCurrentDebugLocation(
+                llvm::DILocation::get(builder->getContext(), node.location.line, node.location.column, debugScope));
+}
+
+/**
+ * @brief Variable of debug info has value from the insert point of builder on (dbg.value)
+ */
+static void describeValue(llvm::Value * value, llvm::DILocalVariable * variable, shared_ptr <llvm::IRBuilder<>> builder) {
+    llvm::BasicBlock * BB = builder->GetInsertBlock();
+    llvm::DILocation * location = builder->getCurrentDebugLocation();
+    if (builder->GetInsertPoint() == BB->end())
+        debugBuilder->insertDbgValueIntrinsic(value, variable, debugBuilder->createExpression(), location, BB);
+    else
+        debugBuilder->insertDbgValueIntrinsic(value, variable, debugBuilder->createExpression(), location,
+                                              &*builder->GetInsertPoint());
+}
 
 llvm::Type * Integer::getLLVMType(shared_ptr <llvm::IRBuilder<>> builder) {
     return llvm::Type::getInt32Ty(builder->getContext());
@@ -14,6 +136,22 @@ llvm::Constant * Integer::getInitConstant(shared_ptr <llvm::IRBuilder<>> builder
     return llvm::ConstantInt::get(getLLVMType(builder), 0, true);
 }
 
+llvm::DIType * Integer::getDebugType(llvm::DIBuilder & debugBuilder) {
+    return debugBuilder.createBasicType("integer", 32, llvm::dwarf::DW_ATE_signed);
+}
+
+llvm::Type * Boolean::getLLVMType(shared_ptr <llvm::IRBuilder<>> builder) {
+    return llvm::Type::getInt1Ty(builder->getContext());
+}
+
+llvm::Constant * Boolean::getInitConstant(shared_ptr <llvm::IRBuilder<>> builder) {
+    return llvm::ConstantInt::getFalse(builder->getContext());
+}
+
+llvm::DIType * Boolean::getDebugType(llvm::DIBuilder & debugBuilder) {
+    return debugBuilder.createBasicType("boolean", 8, llvm::dwarf::DW_ATE_boolean);
+}
+
 Array::Array(int minIndex, int maxIndex, shared_ptr <Type> type) : minIndex(minIndex), maxIndex(maxIndex), type(type) {}
 
 llvm::Type * Array::getLLVMType(shared_ptr <llvm::IRBuilder<>> builder) {
@@ -21,7 +159,29 @@ llvm::Type * Array::getLLVMType(shared_ptr <llvm::IRBuilder<>> builder) {
 }
 
 llvm::Constant * Array::getInitConstant(shared_ptr <llvm::IRBuilder<>> builder) {
-    return llvm::ConstantArray::get((llvm::ArrayType *) getLLVMType(builder), this->type->getInitConstant(builder));
+    return llvm::ConstantAggregateZero::get(getLLVMType(builder));
+}
+
+llvm::DIType * Array::getDebugType(llvm::DIBuilder & debugBuilder) {
+    llvm::DIType * item = type->getDebugType(debugBuilder);
+    int count = maxIndex - minIndex + 1;
+    llvm::Metadata * range = debugBuilder.getOrCreateSubrange(minIndex, count);
+    return debugBuilder.createArrayType(item->getSizeInBits() * count, 0, item, debugBuilder.getOrCreateArray(range));
+}
+
+OpenArray::OpenArray(shared_ptr <Type> type) : type(type) {}
+
+llvm::DIType * OpenArray::getDebugType(llvm::DIBuilder & debugBuilder) {
+    llvm::Metadata * range = debugBuilder.getOrCreateSubrange(0, -1);
+    return debugBuilder.createArrayType(0, 0, type->getDebugType(debugBuilder), debugBuilder.getOrCreateArray(range));
+}
+
+llvm::Type * OpenArray::getLLVMType(shared_ptr <llvm::IRBuilder<>> builder) {
+    return llvm::ArrayType::get(type->getLLVMType(builder), 0);
+}
+
+llvm::Constant * OpenArray::getInitConstant(shared_ptr <llvm::IRBuilder<>> builder) {
+    return llvm::ConstantAggregateZero::get(getLLVMType(builder));
 }
 
 int Array::getMinIndex() const {
@@ -32,6 +192,18 @@ int Array::getMaxIndex() const {
     return maxIndex;
 }
 
+int64_t Array::getScalarCount() const {
+    return ((int64_t) maxIndex - minIndex + 1) * type->getScalarCount();
+}
+
+shared_ptr <Type> Array::getElementType() const {
+    return type;
+}
+
+shared_ptr <Type> OpenArray::getElementType() const {
+    return type;
+}
+
 Number::Number(int value) : value(value) {}
 
 int Number::getValue() const {
@@ -42,10 +214,36 @@ llvm::Value * Number::getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr
     return llvm::ConstantInt::get(llvm::Type::getInt32Ty(builder->getContext()), value, true);
 }
 
+llvm::Type * Number::getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+    return llvm::Type::getInt32Ty(builder->getContext());
+}
+
+bool Number::getConstValue(int & value) {
+    value = this->value;
+    return true;
+}
+
+bool Number::evaluate(Interpreter & interpreter, ConstValue & value) {
+    value = {this->value, false};
+    return true;
+}
+
 void Number::neg() {
     value = -value;
 }
 
+LoweredValue::LoweredValue(llvm::Value * value) : value(value) {}
+
+LoweredValue::LoweredValue(int reg) : reg(reg) {}
+
+llvm::Value * LoweredValue::getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+    return value;
+}
+
+llvm::Type * LoweredValue::getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+    return value->getType();
+}
+
 String::String(string value) : value(value) {}
 
 string String::getValue() const {
@@ -56,15 +254,48 @@ llvm::Value * String::getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr
     return llvm::ConstantDataArray::getString(builder->getContext(), value);
 }
 
+llvm::Type * String::getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+    return getLLVMValue(module, builder)->getType();
+}
+
+void Expression::createCondBr(llvm::BasicBlock * trueBB, llvm::BasicBlock * falseBB, shared_ptr <llvm::Module> module,
+                              shared_ptr <llvm::IRBuilder<>> builder) {
+    llvm::Value * cond = castToType(builder, getLLVMValue(module, builder), llvm::Type::getInt1Ty(builder->getContext()));
+    builder->CreateCondBr(cond, trueBB, falseBB);
+}
+
 Block::Block(vector <shared_ptr<Statement>> statements) : statements(statements) {}
 
 void Block::translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
     for (auto & statement: statements) {
+        setDebugLocation(*statement, builder);
         statement->translateToLLVM(module, builder);
     }
 }
 
-Var::Var(string name, shared_ptr <Type> type, bool global) : name(name), type(type), global(global) {}
+bool Block::execute(Interpreter & interpreter) {
+    for (auto & statement: statements) {
+        if (!interpreter.step() || !statement->execute(interpreter))
+            return false;
+//rest of block is skipped after exit, break or continue
+        if (interpreter.flow != Interpreter::Flow::Next)
+            return true;
+    }
+    return true;
+}
+
+void Block::collectAssigned(set <string> & names) const {
+    for (auto & statement: statements)
+        statement->collectAssigned(names);
+}
+
+void Block::collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const {
+    for (auto & statement: statements)
+        statement->collectAddressTaken(names, module);
+}
+
+Var::Var(string name, shared_ptr <Type> type, bool global, ParamMode mode) : name(name), type(type), global(global),
+                                                                           mode(mode) {}
 
 shared_ptr <Type> Var::getType() const {
     return type;
@@ -74,21 +305,106 @@ string Var::getName() const {
     return name;
 }
 
+ParamMode Var::getMode() const {
+    return mode;
+}
+
+bool Var::isReference() const {
+    return mode != ParamMode::Value || dynamic_pointer_cast<OpenArray>(type);
+}
+
 void Var::translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
-    if (!global) {
-        llvm::AllocaInst * alloca = builder->CreateAlloca(type->getLLVMType(builder), NULL, name);
+    if (dynamic_pointer_cast<OpenArray>(type))
+        throw invalid_argument("Open array \"" + name + "\" can only be a parameter\n");
+    constVars.erase(name);
+    openArrayHighs.erase(name);
+    if (!global && directSSA && !type->getLLVMType(builder)->isArrayTy() && !addressTakenVars.count(name)) {
+        NamedSSAVars[name] = ssaBuilder.declareVariable(type->getLLVMType(builder), name);
+        describe(nullptr, builder);
+        return;
+    }
+    NamedSSAVars.erase(name);
+    llvm::Type * llvmType = type->getLLVMType(builder);
+//arrays of pure functions are their local state, static storage would be shared by calls from more threads
+    bool pureLocal = !global && pureFunctions.count(builder->GetInsertBlock()->getParent()->getName().str());
+    if (!global && (pureLocal || !(localArrays == LocalArrays::Static && llvmType->isArrayTy() &&
+                                   module->getDataLayout().getTypeAllocSize(llvmType) > largeLocalArraySize))) {
+        llvm::AllocaInst * alloca = createFrameSlot(builder, llvmType, name);
         NamedVars[name] = alloca;
     } else {
-        module->getOrInsertGlobal(name, type->getLLVMType(builder));
-        llvm::GlobalVariable * gVar = module->getNamedGlobal(name);
-        gVar->setLinkage(llvm::GlobalValue::CommonLinkage);
-        gVar->setInitializer(type->getInitConstant(builder));
+//zero initializer keeps the variable in .bss, its size does not affect size of IR
+        string globalName = global ? name : builder->GetInsertBlock()->getParent()->getName().str() + "." + name;
+        auto gVar = new llvm::GlobalVariable(*module, llvmType, false, llvm::GlobalValue::InternalLinkage,
+                                             type->getInitConstant(builder), globalName);
+        if (!global)
+            staticLocals[gVar] = builder->GetInsertBlock()->getParent();
         NamedVars[name] = gVar;
     }
-    if (type->getLLVMType(builder)->isArrayTy()) {
-        shared_ptr <Array> array = static_pointer_cast<Array>(type);
-        arrayBounds[name] = {array->getMinIndex(), array->getMaxIndex()};
+    describe(NamedVars[name], builder);
+    if (dynamic_pointer_cast<Array>(type))
+        arrayTypes[name] = type;
+    else
+        arrayTypes.erase(name);
+}
+
+void Var::bindArgument(llvm::Function::arg_iterator & arg, shared_ptr <llvm::Module> module,
+                       shared_ptr <llvm::IRBuilder<>> builder) {
+    argNo = arg->getArgNo() + 1;
+    if (!isReference()) {
+        translateToLLVM(module, builder);
+        VarReference(name).setLLVMValue(&*arg++, module, builder);
+        return;
     }
+//REFERENCE - variable lives in memory of caller, no local copy is made
+    NamedSSAVars.erase(name);
+    NamedVars[name] = &*arg++;
+    describe(NamedVars[name], builder);
+    if (mode == ParamMode::Const)
+        constVars.insert(name);
+    else
+        constVars.erase(name);
+    openArrayHighs.erase(name);
+    arrayTypes.erase(name);
+    if (dynamic_pointer_cast<OpenArray>(type))
+        openArrayHighs[name] = &*arg++;
+    if (dynamic_pointer_cast<OpenArray>(type) || dynamic_pointer_cast<Array>(type))
+        arrayTypes[name] = type;
+}
+
+void Var::describe(llvm::Value * storage, shared_ptr <llvm::IRBuilder<>> builder) {
+    if (!debugInfo || !debugBuilder || !location.line)
+        return;
+    llvm::DIFile * file = debugUnit->getFile();
+    llvm::DIType * debugType = type->getDebugType(*debugBuilder);
+    if (auto gVar = llvm::dyn_cast_or_null<llvm::GlobalVariable>(storage)) {
+        llvm::DIScope * scope = global ? debugUnit : debugScope;
+        gVar->addDebugInfo(debugBuilder->createGlobalVariableExpression(scope, name, global ? "" : gVar->getName(), file,
+                                                                        location.line, debugType, true));
+        return;
+    }
+    if (!debugScope)
+        return;
+//reference parameter is described as reference to variable of caller
+    if (storage && llvm::isa<llvm::Argument>(storage))
+        debugType = debugBuilder->createReferenceType(llvm::dwarf::DW_TAG_reference_type, debugType);
+    llvm::DILocalVariable * variable = argNo
+            ? debugBuilder->createParameterVariable(debugScope, name, argNo, file, location.line, debugType, true)
+            : debugBuilder->createAutoVariable(debugScope, name, file, location.line, debugType, true);
+    if (!storage) {
+//values are given by assignments
+        ssaDebugVars[NamedSSAVars[name]] = variable;
+        return;
+    }
+    if (llvm::isa<llvm::Argument>(storage)) {
+        describeValue(storage, variable, builder);
+        return;
+    }
+    auto alloca = llvm::cast<llvm::Instruction>(storage);
+    auto position = llvm::DILocation::get(builder->getContext(), location.line, location.column, debugScope);
+    if (alloca->getNextNode())
+        debugBuilder->insertDeclare(alloca, variable, debugBuilder->createExpression(), position, alloca->getNextNode());
+    else
+        debugBuilder->insertDeclare(alloca, variable, debugBuilder->createExpression(), position, alloca->getParent());
 }
 
 Const::Const(string name, int value) : name(name), value(value) {}
@@ -106,7 +422,7 @@ void Special::translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm
             llvm::Function * F = builder->GetInsertBlock()->getParent();
             if (F->getReturnType() != llvm::Type::getVoidTy(builder->getContext())) {
                 string name = builder->GetInsertBlock()->getParent()->getName().str();
-                builder->CreateRet(builder->CreateLoad(NamedVars[name]));
+                builder->CreateRet(VarReference(name).getLLVMValue(module, builder));
             } else
                 builder->CreateRetVoid();
             break;
@@ -126,80 +442,260 @@ void Special::translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm
     }
 }
 
+bool Special::execute(Interpreter & interpreter) {
+    interpreter.flow = token == tok_exit ? Interpreter::Flow::Exit
+                     : token == tok_break ? Interpreter::Flow::Break : Interpreter::Flow::Continue;
+    return true;
+}
+
 BinOp::BinOp(int token, shared_ptr <Expression> left, shared_ptr <Expression> right) : token(token), left(left),
                                                                                        right(right) {}
 
+bool BinOp::isShortCircuit(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+    return (token == tok_and || token == tok_or) && isBoolean(left->getLLVMType(module, builder)) &&
+           isBoolean(right->getLLVMType(module, builder));
+}
+
+llvm::Type * BinOp::getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+    switch (token) {
+        case tok_equal:
+        case tok_notequal:
+        case tok_less:
+        case tok_lessequal:
+        case tok_greater:
+        case tok_greaterequal:
+            return llvm::Type::getInt1Ty(builder->getContext());
+        case tok_and:
+        case tok_or:
+        case tok_xor:
+//logical for two booleans, bitwise otherwise
+            if (isBoolean(left->getLLVMType(module, builder)) && isBoolean(right->getLLVMType(module, builder)))
+                return llvm::Type::getInt1Ty(builder->getContext());
+            return llvm::Type::getInt32Ty(builder->getContext());
+        default:
+            return llvm::Type::getInt32Ty(builder->getContext());
+    }
+}
+
 llvm::Value * BinOp::getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
-    llvm::Value * result;
+    if (isShortCircuit(module, builder)) {
+//SHORT CIRCUIT - result is known in every block where left operand decides, merge it with value of right operand
+        llvm::Function * TheFunction = builder->GetInsertBlock()->getParent();
+        llvm::BasicBlock * RightBB = llvm::BasicBlock::Create(builder->getContext(), token == tok_and ? "and_rhs" : "or_rhs");
+        llvm::BasicBlock * MergeBB = llvm::BasicBlock::Create(builder->getContext(), token == tok_and ? "and_after" : "or_after");
+        if (token == tok_and)
+            left->createCondBr(RightBB, MergeBB, module, builder);
+        else
+            left->createCondBr(MergeBB, RightBB, module, builder);
+        ssaBuilder.sealBlock(RightBB);
+
+        TheFunction->getBasicBlockList().push_back(RightBB);
+        builder->SetInsertPoint(RightBB);
+        llvm::Value * rightValue = right->getLLVMValue(module, builder);
+        llvm::BasicBlock * RightEndBB = builder->GetInsertBlock();
+        builder->CreateBr(MergeBB);
+        ssaBuilder.sealBlock(MergeBB);
+
+        TheFunction->getBasicBlockList().push_back(MergeBB);
+        builder->SetInsertPoint(MergeBB);
+        llvm::PHINode * result = builder->CreatePHI(builder->getInt1Ty(), 2, token == tok_and ? "and" : "or");
+        for (llvm::BasicBlock * pred: llvm::predecessors(MergeBB))
+            result->addIncoming(pred == RightEndBB ? rightValue : builder->getInt1(token == tok_or), pred);
+        return result;
+    }
+
+    llvm::Type * type = getLLVMType(module, builder);
+    llvm::Value * l = left->getLLVMValue(module, builder);
+    llvm::Value * r = right->getLLVMValue(module, builder);
+//operands of comparisons and arithmetic are integers, booleans are widened to 0/1
+    if (isBoolean(type) && token != tok_and && token != tok_or && token != tok_xor)
+        type = llvm::Type::getInt32Ty(builder->getContext());
+    l = castToType(builder, l, type);
+    r = castToType(builder, r, type);
     switch (token) {
         case tok_equal:
-            result = builder->CreateICmpEQ(left->getLLVMValue(module, builder), right->getLLVMValue(module, builder));
-            break;
+            return builder->CreateICmpEQ(l, r);
         case tok_notequal:
-            result = builder->CreateICmpNE(left->getLLVMValue(module, builder), right->getLLVMValue(module, builder));
-            break;
+            return builder->CreateICmpNE(l, r);
         case tok_less:
-            result = builder->CreateICmpSLT(left->getLLVMValue(module, builder), right->getLLVMValue(module, builder));
-            break;
+            return builder->CreateICmpSLT(l, r);
         case tok_lessequal:
-            result = builder->CreateICmpSLE(left->getLLVMValue(module, builder), right->getLLVMValue(module, builder));
-            break;
+            return builder->CreateICmpSLE(l, r);
         case tok_greater:
-            result = builder->CreateICmpSGT(left->getLLVMValue(module, builder), right->getLLVMValue(module, builder));
-            break;
+            return builder->CreateICmpSGT(l, r);
         case tok_greaterequal:
-            result = builder->CreateICmpSGE(left->getLLVMValue(module, builder), right->getLLVMValue(module, builder));
-            break;
+            return builder->CreateICmpSGE(l, r);
         case tok_plus:
-            result = builder->CreateAdd(left->getLLVMValue(module, builder), right->getLLVMValue(module, builder));
-            break;
+            return builder->CreateAdd(l, r);
         case tok_minus:
-            result = builder->CreateSub(left->getLLVMValue(module, builder), right->getLLVMValue(module, builder));
-            break;
+            return builder->CreateSub(l, r);
         case tok_or:
-            result = builder->CreateOr(left->getLLVMValue(module, builder), right->getLLVMValue(module, builder));
-            break;
+            return builder->CreateOr(l, r);
         case tok_multiply:
-            result = builder->CreateMul(left->getLLVMValue(module, builder), right->getLLVMValue(module, builder));
-            break;
+            return builder->CreateMul(l, r);
         case tok_div:
-            result = builder->CreateSDiv(left->getLLVMValue(module, builder), right->getLLVMValue(module, builder));
-            break;
+            return builder->CreateSDiv(l, r);
         case tok_mod:
-            result = builder->CreateSRem(left->getLLVMValue(module, builder), right->getLLVMValue(module, builder));
-            break;
+            return builder->CreateSRem(l, r);
         case tok_and:
-            result = builder->CreateAnd(left->getLLVMValue(module, builder), right->getLLVMValue(module, builder));
-            break;
+            return builder->CreateAnd(l, r);
         case tok_xor:
-            result = builder->CreateXor(left->getLLVMValue(module, builder), right->getLLVMValue(module, builder));
-            break;
+            return builder->CreateXor(l, r);
         default:
             throw UnknownTokenException(static_cast<Token>(token),
                                         {tok_equal, tok_notequal, tok_less, tok_lessequal, tok_greater,
                                          tok_greaterequal, tok_plus, tok_minus, tok_or, tok_multiply, tok_div, tok_mod,
                                          tok_and, tok_xor}, "operator");
     }
-//cast to 32 bit int
-    return builder->CreateIntCast(result, llvm::Type::getInt32Ty(builder->getContext()), false);
+}
+
+void BinOp::createCondBr(llvm::BasicBlock * trueBB, llvm::BasicBlock * falseBB, shared_ptr <llvm::Module> module,
+                         shared_ptr <llvm::IRBuilder<>> builder) {
+    if (!isShortCircuit(module, builder)) {
+        Expression::createCondBr(trueBB, falseBB, module, builder);
+        return;
+    }
+//SHORT CIRCUIT - right operand is evaluated only when left one does not decide, no value is materialized
+    llvm::BasicBlock * RightBB = llvm::BasicBlock::Create(builder->getContext(), token == tok_and ? "and_rhs" : "or_rhs");
+    if (token == tok_and)
+        left->createCondBr(RightBB, falseBB, module, builder);
+    else
+        left->createCondBr(trueBB, RightBB, module, builder);
+    ssaBuilder.sealBlock(RightBB);
+    builder->GetInsertBlock()->getParent()->getBasicBlockList().push_back(RightBB);
+    builder->SetInsertPoint(RightBB);
+    right->createCondBr(trueBB, falseBB, module, builder);
+}
+
+bool BinOp::getVarOffset(string & var, int & offset) {
+    int value;
+    if (token != tok_plus && token != tok_minus)
+        return false;
+    if (left->getVarOffset(var, offset) && right->getConstValue(value)) {
+        offset += token == tok_plus ? value : -value;
+        return true;
+    }
+    if (token == tok_plus && left->getConstValue(value) && right->getVarOffset(var, offset)) {
+        offset += value;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Result of arithmetic truncated to 32 bits like in generated code
+ */
+static int wrapInt(int64_t value) {
+    return (int) (uint32_t) value;
+}
+
+bool BinOp::evaluate(Interpreter & interpreter, ConstValue & value) {
+    ConstValue l, r;
+    if (!left->evaluate(interpreter, l) || !right->evaluate(interpreter, r))
+        return false;
+//and, or and xor of two booleans are logical, bitwise otherwise
+    bool boolean = l.boolean && r.boolean;
+    int64_t a = l.value, b = r.value;
+    switch (token) {
+        case tok_equal:
+            value = {a == b, true};
+            return true;
+        case tok_notequal:
+            value = {a != b, true};
+            return true;
+        case tok_less:
+            value = {a < b, true};
+            return true;
+        case tok_lessequal:
+            value = {a <= b, true};
+            return true;
+        case tok_greater:
+            value = {a > b, true};
+            return true;
+        case tok_greaterequal:
+            value = {a >= b, true};
+            return true;
+        case tok_plus:
+            value = {wrapInt(a + b), false};
+            return true;
+        case tok_minus:
+            value = {wrapInt(a - b), false};
+            return true;
+        case tok_multiply:
+            value = {wrapInt(a * b), false};
+            return true;
+        case tok_div:
+        case tok_mod:
+//division by zero and overflow are left to runtime
+            if (b == 0)
+                return interpreter.fail("division by zero");
+            if (a == INT32_MIN && b == -1)
+                return interpreter.fail("overflow of division");
+            value = {(int) (token == tok_div ? a / b : a % b), false};
+            return true;
+        case tok_and:
+            value = {(int) (a & b), boolean};
+            return true;
+        case tok_or:
+            value = {(int) (a | b), boolean};
+            return true;
+        case tok_xor:
+            value = {(int) (a ^ b), boolean};
+            return true;
+        default:
+            return false;
+    }
+}
+
+void BinOp::collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const {
+    left->collectAddressTaken(names, module);
+    right->collectAddressTaken(names, module);
 }
 
 UnOp::UnOp(int token, shared_ptr <Expression> expr) : token(token), expr(expr) {}
 
+llvm::Type * UnOp::getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+//not of boolean is logical, bitwise otherwise
+    if (token == tok_not && isBoolean(expr->getLLVMType(module, builder)))
+        return llvm::Type::getInt1Ty(builder->getContext());
+    return llvm::Type::getInt32Ty(builder->getContext());
+}
+
 llvm::Value * UnOp::getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
-    llvm::Value * result;
+    llvm::Value * value = castToType(builder, expr->getLLVMValue(module, builder), getLLVMType(module, builder));
     switch (token) {
         case tok_minus:
-            result = builder->CreateNeg(expr->getLLVMValue(module, builder));
-            break;
+            return builder->CreateNeg(value);
         case tok_not:
-            result = builder->CreateNot(expr->getLLVMValue(module, builder));
-            break;
+            return builder->CreateNot(value);
         default:
             throw UnknownTokenException(static_cast<Token>(token), {tok_minus, tok_not}, "operator");
     }
-//cast to 32 bit int
-    return builder->CreateIntCast(result, llvm::Type::getInt32Ty(builder->getContext()), false);
+}
+
+void UnOp::createCondBr(llvm::BasicBlock * trueBB, llvm::BasicBlock * falseBB, shared_ptr <llvm::Module> module,
+                        shared_ptr <llvm::IRBuilder<>> builder) {
+//negated condition just swaps targets
+    if (token == tok_not && isBoolean(expr->getLLVMType(module, builder)))
+        expr->createCondBr(falseBB, trueBB, module, builder);
+    else
+        Expression::createCondBr(trueBB, falseBB, module, builder);
+}
+
+bool UnOp::evaluate(Interpreter & interpreter, ConstValue & value) {
+    if (!expr->evaluate(interpreter, value))
+        return false;
+    if (token == tok_minus)
+        value = {wrapInt(-(int64_t) value.value), false};
+    else if (token == tok_not)
+        value = value.boolean ? ConstValue{!value.value, true} : ConstValue{~value.value, false};
+    else
+        return false;
+    return true;
+}
+
+void UnOp::collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const {
+    expr->collectAddressTaken(names, module);
 }
 
 Reference::Reference(const string name) : name(name) {}
@@ -208,19 +704,73 @@ string Reference::getName() const {
     return name;
 }
 
+shared_ptr <Type> Reference::getArrayType() const {
+    return nullptr;
+}
+
+void Reference::setLLVMValue(llvm::Value * value, shared_ptr <llvm::Module> module,
+                             shared_ptr <llvm::IRBuilder<>> builder) {
+    builder->CreateStore(value, getLLVMAddress(module, builder));
+}
+
 VarReference::VarReference(const string name) : Reference(name) {}
 
 llvm::Value * VarReference::getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+    if (NamedSSAVars.find(name) != NamedSSAVars.end())
+        return ssaBuilder.readVariable(NamedSSAVars[name], builder->GetInsertBlock());
     if (NamedVars.find(name) == NamedVars.end()) {
         if (NamedConsts.find(name) != NamedConsts.end())
             return NamedConsts[name];
         throw UnknownVarException(name);
     }
-    return builder->CreateLoad(NamedVars[name]);
+    return createLoad(builder, NamedVars[name]);
 }
 
-llvm::Value * VarReference::getLLVMAddress(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+llvm::Type * VarReference::getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+    if (NamedSSAVars.find(name) != NamedSSAVars.end())
+        return ssaBuilder.getVariableType(NamedSSAVars[name]);
+    if (NamedVars.find(name) == NamedVars.end()) {
+        if (NamedConsts.find(name) != NamedConsts.end())
+            return NamedConsts[name]->getType();
+        throw UnknownVarException(name);
+    }
+    return NamedVars[name]->getType()->getPointerElementType();
+}
+
+bool VarReference::getConstValue(int & value) {
+    if (NamedSSAVars.count(name) || NamedVars.count(name) || !NamedConsts.count(name))
+        return false;
+    value = (int) llvm::cast<llvm::ConstantInt>(NamedConsts[name])->getSExtValue();
+    return true;
+}
 
+bool VarReference::evaluate(Interpreter & interpreter, ConstValue & value) {
+    if (!interpreter.frames.empty() && interpreter.frames.back().count(name)) {
+        value = interpreter.frames.back()[name];
+        return true;
+    }
+//otherwise only named constant, variables of the caller are not known at compile time
+    if (interpreter.frames.empty() && (NamedSSAVars.count(name) || NamedVars.count(name)))
+        return false;
+    auto constant = NamedConsts.count(name) ? llvm::dyn_cast<llvm::ConstantInt>(NamedConsts[name]) : nullptr;
+    if (!constant)
+        return false;
+    bool boolean = constant->getType()->isIntegerTy(1);
+    value = {(int) (boolean ? constant->getZExtValue() : constant->getSExtValue()), boolean};
+    return true;
+}
+
+bool VarReference::getVarOffset(string & var, int & offset) {
+    if (!NamedSSAVars.count(name) && !NamedVars.count(name))
+        return false;
+    var = name;
+    offset = 0;
+    return true;
+}
+
+llvm::Value * VarReference::getLLVMAddress(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+    if (NamedSSAVars.find(name) != NamedSSAVars.end())
+        throw invalid_argument("Address of register variable \"" + name + "\" requested\n");
     if (NamedVars.find(name) == NamedVars.end()) {
         if (NamedConsts.find(name) != NamedConsts.end())
             return NamedConsts[name];
@@ -229,29 +779,248 @@ llvm::Value * VarReference::getLLVMAddress(shared_ptr <llvm::Module> module, sha
     return NamedVars[name];
 }
 
-ArrayItemReference::ArrayItemReference(shared_ptr <Reference> var, shared_ptr <Expression> index) : var(var),
-                                                                                                    index(index) {}
+shared_ptr <Type> VarReference::getArrayType() const {
+    auto type = arrayTypes.find(name);
+    return type != arrayTypes.end() ? type->second : nullptr;
+}
+
+void VarReference::setLLVMValue(llvm::Value * value, shared_ptr <llvm::Module> module,
+                                shared_ptr <llvm::IRBuilder<>> builder) {
+    if (NamedSSAVars.find(name) == NamedSSAVars.end()) {
+        Reference::setLLVMValue(value, module, builder);
+        return;
+    }
+    ssaBuilder.writeVariable(NamedSSAVars[name], builder->GetInsertBlock(), value);
+    auto described = ssaDebugVars.find(NamedSSAVars[name]);
+    if (described != ssaDebugVars.end())
+        describeValue(value, described->second, builder);
+}
+
+ArrayItemReference::ArrayItemReference(shared_ptr <Reference> var, shared_ptr <Expression> index) : Reference(
+        var->getName()), var(var), index(index) {}
 
 llvm::Value *
 ArrayItemReference::getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
-    return builder->CreateLoad(getLLVMAddress(module, builder));
+    return createLoad(builder, getLLVMAddress(module, builder));
 }
 
+llvm::Type *
+ArrayItemReference::getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+    return var->getLLVMType(module, builder)->getArrayElementType();
+}
+
+shared_ptr <Type> ArrayItemReference::getArrayType() const {
+    auto array = var->getArrayType();
+    shared_ptr <Type> element = nullptr;
+    if (auto open = dynamic_pointer_cast<OpenArray>(array))
+        element = open->getElementType();
+    else if (array)
+        element = static_pointer_cast<Array>(array)->getElementType();
+    return dynamic_pointer_cast<Array>(element) ? element : nullptr;
+}
+
+/**
+ * @brief Address of item, the array is stored flattened in row-major order
+ *
+ * a[i, j] of array [l1..h1, l2..h2] is item (i - l1) * (h2 - l2 + 1) + (j - l2), lower bounds of all dimensions are
+ * folded into one constant, so the offset is linear in every index and loops over it are strength reduced.
+ */
 llvm::Value *
 ArrayItemReference::getLLVMAddress(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
-    llvm::Value * idx = builder->CreateSub(index->getLLVMValue(module, builder),
-                                           llvm::ConstantInt::get(llvm::Type::getInt32Ty(builder->getContext()),
-                                                                  arrayBounds[var->getName()].first, true));
-    return builder->CreateGEP(var->getLLVMAddress(module, builder),
-                              {llvm::ConstantInt::get(llvm::Type::getInt32Ty(builder->getContext()), 0, true), idx});
+    llvm::Value * offset;
+    int64_t adjustment;
+    llvm::Value * arrayAddress = getItemOffset(offset, adjustment, module, builder);
+    if (adjustment)
+        offset = builder->CreateNSWAdd(offset, builder->getInt64(adjustment));
+    llvm::Type * scalarType = arrayAddress->getType()->getPointerElementType();
+    while (scalarType->isArrayTy())
+        scalarType = scalarType->getArrayElementType();
+    llvm::Value * address = builder->CreateInBoundsGEP(scalarType,
+                                                       builder->CreateBitCast(arrayAddress, scalarType->getPointerTo()),
+                                                       offset);
+//part of chain addresses a row, e.g. passed as array parameter
+    llvm::Type * itemType = getLLVMType(module, builder);
+    return itemType == scalarType ? address : builder->CreateBitCast(address, itemType->getPointerTo());
+}
+
+llvm::Value * ArrayItemReference::getItemOffset(llvm::Value *& offset, int64_t & adjustment, shared_ptr <llvm::Module> module,
+                                                shared_ptr <llvm::IRBuilder<>> builder) {
+    llvm::Value * arrayAddress;
+    if (auto outer = dynamic_pointer_cast<ArrayItemReference>(var))
+        arrayAddress = outer->getItemOffset(offset, adjustment, module, builder);
+    else {
+        arrayAddress = var->getLLVMAddress(module, builder);
+        offset = nullptr;
+        adjustment = 0;
+    }
+    llvm::Value * idx = castToType(builder, index->getLLVMValue(module, builder),
+                                   llvm::Type::getInt32Ty(builder->getContext()));
+    if (arrayChecks)
+        createRangeCheck(idx, module, builder);
+    int low;
+    llvm::Value * high;
+    getBounds(low, high, builder);
+//products of indexes with strides of large arrays and their lower bounds do not fit to integer
+    int64_t stride = getLLVMType(module, builder)->isArrayTy() ? getArrayType()->getScalarCount() : 1;
+    idx = builder->CreateSExt(idx, builder->getInt64Ty());
+    if (stride != 1)
+        idx = builder->CreateNSWMul(idx, builder->getInt64(stride));
+    offset = offset ? builder->CreateNSWAdd(offset, idx) : idx;
+    adjustment -= low * stride;
+    return arrayAddress;
+}
+
+void ArrayItemReference::getBounds(int & low, llvm::Value *& high, shared_ptr <llvm::IRBuilder<>> builder) const {
+    auto array = var->getArrayType();
+    if (!array)
+        throw invalid_argument("\"" + name + "\" is not an array\n");
+    if (dynamic_pointer_cast<OpenArray>(array)) {
+        low = 0;
+        high = openArrayHighs[name];
+    } else {
+        low = static_pointer_cast<Array>(array)->getMinIndex();
+        high = builder->getInt32(static_pointer_cast<Array>(array)->getMaxIndex());
+    }
+}
+
+void ArrayItemReference::createRangeCheck(llvm::Value * idx, shared_ptr <llvm::Module> module,
+                                          shared_ptr <llvm::IRBuilder<>> builder) {
+    string loopVar;
+    int offset;
+    int lowBound;
+    llvm::Value * high;
+    getBounds(lowBound, high, builder);
+//HOISTED - index is loop variable plus constant, the whole range of loop is checked before the loop
+    if (index->getVarOffset(loopVar, offset) && hoistedChecks.count(loopVar)) {
+        hoistedChecks[loopVar]->accesses.insert({lowBound, high, offset});
+        hoistedChecks[loopVar]->count++;
+        return;
+    }
+//index - low < number of items, unsigned comparison catches index below low bound too
+    llvm::Value * low = Number(lowBound).getLLVMValue(module, builder);
+    llvm::Value * size = builder->CreateAdd(builder->CreateSub(high, low), Number(1).getLLVMValue(module, builder));
+    llvm::Value * inRange = builder->CreateICmpULT(builder->CreateSub(idx, low), size, "in_range");
+    if (auto constant = llvm::dyn_cast<llvm::ConstantInt>(inRange))
+        if (constant->isOne()) {
+            arrayCheckStats.removed++;
+            return;
+        }
+    arrayCheckStats.inserted++;
+
+    llvm::Function * TheFunction = builder->GetInsertBlock()->getParent();
+    llvm::BasicBlock * OkBB = llvm::BasicBlock::Create(builder->getContext(), "range_ok", TheFunction);
+    llvm::BasicBlock * ErrorBB = llvm::BasicBlock::Create(builder->getContext(), "range_error", TheFunction);
+    builder->CreateCondBr(inRange, OkBB, ErrorBB, llvm::MDBuilder(builder->getContext()).createBranchWeights(1 << 20, 1));
+    ssaBuilder.sealBlock(OkBB);
+    ssaBuilder.sealBlock(ErrorBB);
+    builder->SetInsertPoint(ErrorBB);
+    builder->CreateCall(module->getFunction("rangeError"), {idx, low, high});
+    builder->CreateUnreachable();
+    builder->SetInsertPoint(OkBB);
+}
+
+void ArrayItemReference::collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const {
+    var->collectAddressTaken(names, module);
+    index->collectAddressTaken(names, module);
 }
 
 Assign::Assign(shared_ptr <Reference> left, shared_ptr <Expression> right) : left(left), right(right) {}
 
 void Assign::translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
-    builder->CreateStore(right->getLLVMValue(module, builder), left->getLLVMAddress(module, builder));
+    if (constVars.count(left->getName()))
+        throw invalid_argument("Assignment to const parameter \"" + left->getName() + "\"\n");
+    left->setLLVMValue(castToType(builder, right->getLLVMValue(module, builder), left->getLLVMType(module, builder)),
+                       module, builder);
+}
+
+bool Assign::execute(Interpreter & interpreter) {
+//only scalar variables of interpreted function, array items and globals are not known at compile time
+    auto var = dynamic_pointer_cast<VarReference>(left);
+    ConstValue value;
+    if (!var || !interpreter.frames.back().count(var->getName()) || !right->evaluate(interpreter, value))
+        return false;
+    ConstValue & target = interpreter.frames.back()[var->getName()];
+    target.value = target.boolean ? value.value != 0 : value.value;
+    return true;
+}
+
+void Assign::collectAssigned(set <string> & names) const {
+    names.insert(left->getName());
+}
+
+void Assign::collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const {
+    left->collectAddressTaken(names, module);
+    right->collectAddressTaken(names, module);
+}
+
+
+/**
+ * @brief Variable bound to name before it was shadowed by for loop variable
+ */
+struct ShadowedVar {
+    string name;
+    llvm::Value * var;
+    int ssaVar;
+    bool constant;
+};
+
+static ShadowedVar shadowVar(const string & name) {
+    auto var = NamedVars.find(name);
+    auto ssaVar = NamedSSAVars.find(name);
+    return {name, var == NamedVars.end() ? nullptr : var->second, ssaVar == NamedSSAVars.end() ? -1 : ssaVar->second,
+            constVars.count(name) > 0};
 }
 
+static void restoreVar(const ShadowedVar & shadowed) {
+    if (shadowed.var)
+        NamedVars[shadowed.name] = shadowed.var;
+    else
+        NamedVars.erase(shadowed.name);
+    if (shadowed.ssaVar >= 0)
+        NamedSSAVars[shadowed.name] = shadowed.ssaVar;
+    else
+        NamedSSAVars.erase(shadowed.name);
+    if (shadowed.constant)
+        constVars.insert(shadowed.name);
+}
+
+/**
+ * @brief Creates loop ID metadata for loop back edge
+ *
+ * for loops always terminate, so the loop is marked mustprogress. With -g the loop starts at the current debug location
+ */
+static llvm::MDNode * createLoopID(shared_ptr <llvm::IRBuilder<>> builder) {
+    llvm::LLVMContext & context = builder->getContext();
+    llvm::Metadata * mustProgress = llvm::MDNode::get(context, llvm::MDString::get(context, "llvm.loop.mustprogress"));
+    vector <llvm::Metadata *> operands = {nullptr};
+    if (builder->getCurrentDebugLocation())
+        operands.push_back(builder->getCurrentDebugLocation().get());
+    operands.push_back(mustProgress);
+    llvm::MDNode * loopID = llvm::MDNode::getDistinct(context, operands);
+    loopID->replaceOperandWith(0, loopID);
+    return loopID;
+}
+
+/**
+ * @brief Iteration counter of loop in the current function with --instrument, null without it
+ */
+static llvm::GlobalVariable * createLoopCounter(const string & kind, shared_ptr <llvm::Module> module,
+                                                shared_ptr <llvm::IRBuilder<>> builder) {
+    if (!instrument)
+        return nullptr;
+    llvm::Function * F = builder->GetInsertBlock()->getParent();
+    auto counter = new llvm::GlobalVariable(*module, builder->getInt64Ty(), false, llvm::GlobalValue::InternalLinkage,
+                                            builder->getInt64(0), F->getName() + ".loop");
+    loopCounters.push_back({counter, F->getName().str(), kind});
+    return counter;
+}
+
+static void countIteration(llvm::GlobalVariable * counter, shared_ptr <llvm::IRBuilder<>> builder) {
+    if (!counter)
+        return;
+    llvm::Value * count = builder->CreateLoad(builder->getInt64Ty(), counter);
+    builder->CreateStore(builder->CreateAdd(count, builder->getInt64(1)), counter);
+}
 
 For::For(const string varName, shared_ptr <Block> block, shared_ptr <Expression> startExpr,
          shared_ptr <Expression> endExpr, const bool ascending) : varName(varName), block(block), startExpr(startExpr),
@@ -262,81 +1031,203 @@ void For::translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IR
 
     llvm::BasicBlock * oldBreakPoint = whereBreak;
     llvm::BasicBlock * oldContinuePoint = whereContinue;
-
+//loop variable is described in lexical block of the loop
+    llvm::DIScope * oldScope = debugScope;
     llvm::Function * TheFunction = builder->GetInsertBlock()->getParent();
+    if (debugScope) {
+        sourceLoops.push_back({TheFunction->getName().str(), "for " + varName, location.line, block->end.line});
+        debugScope = debugBuilder->createLexicalBlock(debugScope, debugUnit->getFile(), location.line, location.column);
+        setDebugLocation(*this, builder);
+    }
     llvm::BasicBlock * HeaderBB = llvm::BasicBlock::Create(builder->getContext(), "for_header", TheFunction);
 
 //JUMP TO INIT
     builder->CreateBr(HeaderBB);
+    ssaBuilder.sealBlock(HeaderBB);
 
 //INITIALIZE VARIABLE
     builder->SetInsertPoint(HeaderBB);
-//shadowing variable
-    llvm::Value * OldVal = NamedVars[varName];
+//shadowing variable, induction variable is not visible in mila (name is not an identifier)
+    const string ivName = varName + ".iv";
+    ShadowedVar oldVar = shadowVar(varName);
+    ShadowedVar oldIV = shadowVar(ivName);
+
+    auto loopVar = make_shared<Var>(varName, make_shared<Integer>(), false);
+    loopVar->location = location;
+    loopVar->translateToLLVM(module, builder);
+    make_shared<Var>(ivName, make_shared<Integer>(), false)->translateToLLVM(module, builder);
+    auto iv = make_shared<VarReference>(ivName);
+
+// BOUNDS ARE EVALUATED ONCE, the loop runs |end - start| + 1 times or not at all
+    llvm::Type * intType = llvm::Type::getInt32Ty(builder->getContext());
+    llvm::Value * start = castToType(builder, startExpr->getLLVMValue(module, builder), intType);
+    llvm::Value * end = castToType(builder, endExpr->getLLVMValue(module, builder), intType);
+    llvm::Value * EnterCond = ascending ? builder->CreateICmpSLE(start, end, "for_cond")
+                                        : builder->CreateICmpSGE(start, end, "for_cond");
+//TRIP COUNT in 64 bits, so a loop over all integers does not overflow; the difference is unsigned when the loop runs
+    llvm::Value * distance = ascending ? builder->CreateSub(end, start) : builder->CreateSub(start, end);
+    llvm::Value * trips = builder->CreateAdd(builder->CreateZExt(distance, builder->getInt64Ty()),
+                                             builder->getInt64(1), "for_trips", true, true);
+    iv->setLLVMValue(start, module, builder);
+
+    llvm::BasicBlock * AfterBB = llvm::BasicBlock::Create(builder->getContext(), "for_after");
+    llvm::GlobalVariable * iterations = createLoopCounter("for " + varName, module, builder);
+    set <string> assigned;
+    block->collectAssigned(assigned);
+    block->collectAddressTaken(assigned, module);
+    auto oldChecks = hoistedChecks.find(varName) != hoistedChecks.end() ? hoistedChecks[varName] : nullptr;
+    if (!arrayChecks || assigned.count(varName) || inCheckedCopy) {
+        hoistedChecks.erase(varName);
+        translateLoop(EnterCond, trips, AfterBB, iterations, module, builder);
+    } else {
+// VERSIONED LOOP - accesses indexed by loop variable are not checked, their whole range is checked once in header
+        HoistedChecks checks;
+        hoistedChecks[varName] = &checks;
+        llvm::BasicBlock * FastBB = llvm::BasicBlock::Create(builder->getContext(), "for_unchecked", TheFunction);
+        builder->SetInsertPoint(FastBB);
+        translateLoop(EnterCond, trips, AfterBB, iterations, module, builder);
+        hoistedChecks.erase(varName);
+
+        builder->SetInsertPoint(HeaderBB);
+        llvm::Value * lo = builder->CreateSExt(ascending ? start : end, builder->getInt64Ty());
+        llvm::Value * hi = builder->CreateSExt(ascending ? end : start, builder->getInt64Ty());
+        llvm::Value * safe = builder->getTrue();
+        for (auto & access: checks.accesses) {
+            llvm::Value * low = builder->getInt64(get<0>(access));
+            llvm::Value * high = builder->CreateSExt(get<1>(access), builder->getInt64Ty());
+            llvm::Value * first = builder->CreateAdd(lo, builder->getInt64(get<2>(access)));
+            llvm::Value * last = builder->CreateAdd(hi, builder->getInt64(get<2>(access)));
+            llvm::Value * inRange = builder->CreateAnd(builder->CreateICmpSGE(first, low), builder->CreateICmpSLE(last, high));
+            safe = llvm::isa<llvm::Constant>(safe) && llvm::cast<llvm::Constant>(safe)->isOneValue()
+                   ? inRange : builder->CreateAnd(safe, inRange, "for_in_range");
+        }
+        auto constant = llvm::dyn_cast<llvm::ConstantInt>(safe);
+        if (constant && constant->isOne()) {
+//proven at compile time, there is no checked version
+            arrayCheckStats.removed += checks.count;
+            builder->CreateBr(FastBB);
+            ssaBuilder.sealBlock(FastBB);
+        } else {
+            arrayCheckStats.hoisted += checks.count;
+            arrayCheckStats.preChecks++;
+            llvm::BasicBlock * SlowBB = llvm::BasicBlock::Create(builder->getContext(), "for_checked", TheFunction);
+            builder->CreateCondBr(safe, FastBB, SlowBB);
+            ssaBuilder.sealBlock(FastBB);
+            ssaBuilder.sealBlock(SlowBB);
+            builder->SetInsertPoint(SlowBB);
+//only the unchecked copy is specialized further, so nested loops have copies linear in depth, not 2^depth
+            bool oldInCheckedCopy = inCheckedCopy;
+            inCheckedCopy = true;
+            translateLoop(EnterCond, trips, AfterBB, iterations, module, builder);
+            inCheckedCopy = oldInCheckedCopy;
+        }
+    }
+    if (oldChecks)
+        hoistedChecks[varName] = oldChecks;
+    ssaBuilder.sealBlock(AfterBB);
 
-    shared_ptr <Expression> stepVal = make_shared<Number>(ascending ? 1 : -1);
-    shared_ptr <Var> stepVarDecl = make_shared<Var>(varName, make_shared<Integer>(), false);
-    stepVarDecl->translateToLLVM(module, builder);
+// AFTER LOOP
+    TheFunction->getBasicBlockList().push_back(AfterBB);
+    builder->SetInsertPoint(AfterBB);
 
+// Restore the unshadowed variable.
+    restoreVar(oldVar);
+    restoreVar(oldIV);
+    exited = false;
+    breaked = false;
+    debugScope = oldScope;
+    setDebugLocation(*this, builder);
 
-    auto stepVar = make_shared<VarReference>(varName);
-    auto stepVarLLVMAddress = stepVar->getLLVMAddress(module, builder);
 
-    builder->CreateStore(startExpr->getLLVMValue(module, builder), stepVar->getLLVMAddress(module, builder));
+    whereBreak = oldBreakPoint;
+    whereContinue = oldContinuePoint;
+}
 
-//checkcond
-    llvm::BasicBlock * CondCheckBB = llvm::BasicBlock::Create(builder->getContext(), "for_condcheck", TheFunction);
-    llvm::BasicBlock * BodyBB = llvm::BasicBlock::Create(builder->getContext(), "for_body", TheFunction);
-    llvm::BasicBlock * AfterBB = llvm::BasicBlock::Create(builder->getContext(), "for_after", TheFunction);
-    builder->CreateBr(CondCheckBB);
-    builder->SetInsertPoint(CondCheckBB);
+void For::translateLoop(llvm::Value * EnterCond, llvm::Value * trips, llvm::BasicBlock * AfterBB,
+                        llvm::GlobalVariable * iterations, shared_ptr <llvm::Module> module,
+                        shared_ptr <llvm::IRBuilder<>> builder) {
+    llvm::Function * TheFunction = builder->GetInsertBlock()->getParent();
+    auto stepVar = make_shared<VarReference>(varName);
+    auto iv = make_shared<VarReference>(varName + ".iv");
 
-// CHECK CONDITION BEFORE ENTERING LOOP
-    auto condition = make_shared<BinOp>(ascending ? tok_lessequal : tok_greaterequal, stepVar, endExpr);
-    llvm::Value * EndCond = builder->CreateICmpNE(condition->getLLVMValue(module, builder),
-                                                  Number(0).getLLVMValue(module, builder), "for_cond");
+    llvm::BasicBlock * BodyBB = llvm::BasicBlock::Create(builder->getContext(), "for_body", TheFunction);
     llvm::BasicBlock * NextVarBB = llvm::BasicBlock::Create(builder->getContext(), "for_nextvar", TheFunction);
-    builder->CreateCondBr(EndCond, BodyBB, AfterBB);
+    llvm::BasicBlock * EntryBB = builder->GetInsertBlock();
+    builder->CreateCondBr(EnterCond, BodyBB, AfterBB);
 
     whereBreak = AfterBB;
     whereContinue = NextVarBB;
 
-
-
-// LOOP BODY
+// LOOP BODY - assignments to loop variable in body do not change number of iterations
     builder->SetInsertPoint(BodyBB);
+//canonical counter from 0 to trips, the form SCEV takes the trip count from
+    llvm::PHINode * count = builder->CreatePHI(builder->getInt64Ty(), 2, "for_count");
+    count->addIncoming(builder->getInt64(0), EntryBB);
+    countIteration(iterations, builder);
+    stepVar->setLLVMValue(iv->getLLVMValue(module, builder), module, builder);
     block->translateToLLVM(module, builder);
-
-
-
+    setDebugLocation(*this, builder);
 
 //exit
     if (!exited && !breaked) {
         builder->CreateBr(NextVarBB);
     }
+    exited = false;
+    breaked = false;
+    ssaBuilder.sealBlock(NextVarBB);
 
-// INCREASE VAR
+// INCREASE VAR, the loop ends by the count after trips iterations, the variable is only stepped for the next one; the
+// step after the last iteration (past maxint in "to maxint") may overflow to poison, but that value is never read
     builder->SetInsertPoint(NextVarBB);
-    llvm::Value * nextVar = builder->CreateAdd(stepVar->getLLVMValue(module, builder),
-                                               stepVal->getLLVMValue(module, builder));
-
-    builder->CreateStore(nextVar, stepVarLLVMAddress);
-    builder->CreateBr(CondCheckBB);
-
-// AFTER LOOP
-    builder->SetInsertPoint(AfterBB);
+    llvm::Value * nextCount = builder->CreateAdd(count, builder->getInt64(1), "for_count_next", true, true);
+    count->addIncoming(nextCount, NextVarBB);
+    llvm::Value * LastCond = builder->CreateICmpEQ(nextCount, trips, "for_last");
+    llvm::Value * ivCur = iv->getLLVMValue(module, builder);
+    llvm::Value * one = Number(1).getLLVMValue(module, builder);
+    iv->setLLVMValue(ascending ? builder->CreateNSWAdd(ivCur, one, "for_next")
+                               : builder->CreateNSWSub(ivCur, one, "for_next"), module, builder);
+    llvm::BranchInst * BackEdge = builder->CreateCondBr(LastCond, AfterBB, BodyBB);
+    BackEdge->setMetadata(llvm::LLVMContext::MD_loop, createLoopID(builder));
+    ssaBuilder.sealBlock(BodyBB);
+}
 
-// Restore the unshadowed variable.
-    if (OldVal)
-        NamedVars[varName] = OldVal;
+bool For::execute(Interpreter & interpreter) {
+    ConstValue start, end;
+    if (!startExpr->evaluate(interpreter, start) || !endExpr->evaluate(interpreter, end))
+        return false;
+//loop variable is shadowed like in generated code, outer one is restored after the loop
+    bool shadowed = interpreter.frames.back().count(varName);
+    ConstValue outer = shadowed ? interpreter.frames.back()[varName] : ConstValue{0, false};
+    bool ok = true;
+    if (ascending ? start.value <= end.value : start.value >= end.value)
+        for (int iv = start.value;; iv += ascending ? 1 : -1) {
+            interpreter.frames.back()[varName] = {iv, false};
+            if (!interpreter.step() || !block->execute(interpreter)) {
+                ok = false;
+                break;
+            }
+            if (interpreter.flow == Interpreter::Flow::Exit)
+                break;
+            bool breaked = interpreter.flow == Interpreter::Flow::Break;
+            interpreter.flow = Interpreter::Flow::Next;
+            if (breaked || iv == end.value)
+                break;
+        }
+    if (shadowed)
+        interpreter.frames.back()[varName] = outer;
     else
-        NamedVars.erase(varName);
-    exited = false;
-    breaked = false;
+        interpreter.frames.back().erase(varName);
+    return ok;
+}
 
+void For::collectAssigned(set <string> & names) const {
+    block->collectAssigned(names);
+}
 
-    whereBreak = oldBreakPoint;
-    whereContinue = oldContinuePoint;
+void For::collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const {
+    startExpr->collectAddressTaken(names, module);
+    endExpr->collectAddressTaken(names, module);
+    block->collectAddressTaken(names, module);
 }
 
 While::While(shared_ptr <Block> block, shared_ptr <Expression> condition) : block(block), condition(condition) {}
@@ -345,31 +1236,39 @@ void While::translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::
     llvm::BasicBlock * oldBreakPoint = whereBreak;
     llvm::BasicBlock * oldContinuePoint = whereContinue;
     llvm::Function * TheFunction = builder->GetInsertBlock()->getParent();
+    if (debugScope)
+        sourceLoops.push_back({TheFunction->getName().str(), "while", location.line, block->end.line});
     llvm::BasicBlock * CondCheckBB = llvm::BasicBlock::Create(builder->getContext(), "while_condcheck", TheFunction);
-    llvm::BasicBlock * BodyBB = llvm::BasicBlock::Create(builder->getContext(), "while_body", TheFunction);
+    llvm::BasicBlock * BodyBB = llvm::BasicBlock::Create(builder->getContext(), "while_body");
 
 //INITIALIZE BREAK AND CONTINUE JUMP DESTINATIONS
-    llvm::BasicBlock * AfterBB = llvm::BasicBlock::Create(builder->getContext(), "while_after", TheFunction);
+    llvm::BasicBlock * AfterBB = llvm::BasicBlock::Create(builder->getContext(), "while_after");
+    llvm::GlobalVariable * iterations = createLoopCounter("while", module, builder);
     whereBreak = AfterBB;
     whereContinue = CondCheckBB;
 
     builder->CreateBr(CondCheckBB);
 //CHECK CONDITION
     builder->SetInsertPoint(CondCheckBB);
-    llvm::Value * EndCond = builder->CreateICmpNE(condition->getLLVMValue(module, builder),
-                                                  Number(0).getLLVMValue(module, builder), "while_cond");
-    builder->CreateCondBr(EndCond, BodyBB, AfterBB);
+    condition->createCondBr(BodyBB, AfterBB, module, builder);
+    ssaBuilder.sealBlock(BodyBB);
 
 // LOOP BODY
+    TheFunction->getBasicBlockList().push_back(BodyBB);
     builder->SetInsertPoint(BodyBB);
+    countIteration(iterations, builder);
     block->translateToLLVM(module, builder);
+    setDebugLocation(*this, builder);
 
 // IF EXIT, BREAK OR CONTINUE DON'T CREATE JUMP
     if (!exited && !breaked) {
         builder->CreateBr(CondCheckBB);
     }
+    ssaBuilder.sealBlock(CondCheckBB);
+    ssaBuilder.sealBlock(AfterBB);
 
 // AFTER LOOP
+    TheFunction->getBasicBlockList().push_back(AfterBB);
     builder->SetInsertPoint(AfterBB);
     breaked = false;
     exited = false;
@@ -377,6 +1276,33 @@ void While::translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::
     whereContinue = oldContinuePoint;
 }
 
+bool While::execute(Interpreter & interpreter) {
+    ConstValue value;
+    while (true) {
+        if (!interpreter.step() || !condition->evaluate(interpreter, value))
+            return false;
+        if (!value.value)
+            return true;
+        if (!block->execute(interpreter))
+            return false;
+        if (interpreter.flow == Interpreter::Flow::Exit)
+            return true;
+        bool breaked = interpreter.flow == Interpreter::Flow::Break;
+        interpreter.flow = Interpreter::Flow::Next;
+        if (breaked)
+            return true;
+    }
+}
+
+void While::collectAssigned(set <string> & names) const {
+    block->collectAssigned(names);
+}
+
+void While::collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const {
+    condition->collectAddressTaken(names, module);
+    block->collectAddressTaken(names, module);
+}
+
 
 If::If(shared_ptr <Block> ifBlock, shared_ptr <Block> elseBlock, shared_ptr <Expression> condition) : ifBlock(ifBlock),
                                                                                                       elseBlock(
@@ -385,21 +1311,21 @@ If::If(shared_ptr <Block> ifBlock, shared_ptr <Block> elseBlock, shared_ptr <Exp
                                                                                                               condition) {}
 
 void If::translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
-// Convert condition to a bool by comparing non-equal to 0.0.
-    llvm::Value * cond = builder->CreateICmpNE(condition->getLLVMValue(module, builder),
-                                               Number(0).getLLVMValue(module, builder), "if_cond");
     llvm::Function * TheFunction = builder->GetInsertBlock()->getParent();
 
-// Create blocks for the then and else cases.  Insert the 'then' block at the
-// end of the function.
-    llvm::BasicBlock * IfBB = llvm::BasicBlock::Create(builder->getContext(), "if", TheFunction);
-    llvm::BasicBlock * ElseBB = llvm::BasicBlock::Create(builder->getContext(), "else");
+// Create blocks for the then and else cases, without else branch the condition jumps straight to merge block.
+    llvm::BasicBlock * IfBB = llvm::BasicBlock::Create(builder->getContext(), "if");
+    llvm::BasicBlock * ElseBB = elseBlock != nullptr ? llvm::BasicBlock::Create(builder->getContext(), "else") : nullptr;
     llvm::BasicBlock * MergeBB = llvm::BasicBlock::Create(builder->getContext(), "if_after");
 
-    builder->CreateCondBr(cond, IfBB, ElseBB);
+// Branch on condition directly, boolean conditions need no comparison with 0.
+    condition->createCondBr(IfBB, ElseBB ? ElseBB : MergeBB, module, builder);
+    ssaBuilder.sealBlock(IfBB);
+    if (ElseBB)
+        ssaBuilder.sealBlock(ElseBB);
 
 // Emit then value.
-
+    TheFunction->getBasicBlockList().push_back(IfBB);
     builder->SetInsertPoint(IfBB);
     ifBlock->translateToLLVM(module, builder);
     if (!exited && !breaked)
@@ -408,122 +1334,659 @@ void If::translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRB
     exited = false;
     breaked = false;
 // Emit else block.
-    TheFunction->getBasicBlockList().push_back(ElseBB);
-    builder->SetInsertPoint(ElseBB);
-    if (elseBlock != nullptr) {
+    if (ElseBB) {
+        TheFunction->getBasicBlockList().push_back(ElseBB);
+        builder->SetInsertPoint(ElseBB);
         elseBlock->translateToLLVM(module, builder);
+        if (!exited && !breaked)
+            builder->CreateBr(MergeBB);
+        exited = false;
+        breaked = false;
     }
-    if (!exited && !breaked)
-        builder->CreateBr(MergeBB);
-    exited = false;
-    breaked = false;
 // Emit merge block.
     TheFunction->getBasicBlockList().push_back(MergeBB);
+    ssaBuilder.sealBlock(MergeBB);
     builder->SetInsertPoint(MergeBB);
 }
 
+bool If::execute(Interpreter & interpreter) {
+    ConstValue value;
+    if (!condition->evaluate(interpreter, value))
+        return false;
+    if (value.value)
+        return ifBlock->execute(interpreter);
+    return !elseBlock || elseBlock->execute(interpreter);
+}
+
+void If::collectAssigned(set <string> & names) const {
+    ifBlock->collectAssigned(names);
+    if (elseBlock != nullptr)
+        elseBlock->collectAssigned(names);
+}
+
+void If::collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const {
+    condition->collectAddressTaken(names, module);
+    ifBlock->collectAddressTaken(names, module);
+    if (elseBlock != nullptr)
+        elseBlock->collectAddressTaken(names, module);
+}
+
 FunctionCall::FunctionCall(string name, vector <shared_ptr<Expression>> params) : name(name), params(params) {}
 
+static bool isOpenArrayPointer(llvm::Type * type) {
+    return type->isPointerTy() && type->getPointerElementType()->isArrayTy() &&
+           type->getPointerElementType()->getArrayNumElements() == 0;
+}
+
+/**
+ * @brief Arguments of function which correspond to mila parameters, hidden high bounds of open arrays are skipped
+ */
+static vector <llvm::Argument *> getParamArgs(llvm::Function * F) {
+    vector <llvm::Argument *> args;
+    for (auto arg = F->arg_begin(); arg != F->arg_end(); ++arg) {
+        args.push_back(&*arg);
+        if (isOpenArrayPointer(arg->getType()))
+            ++arg;
+    }
+    return args;
+}
+
+/**
+ * @brief Call of runtime writing one item of write or writeln, integers and booleans as number, strings as they are
+ */
+static llvm::Value * writeItem(shared_ptr <Expression> item, bool newLine, shared_ptr <llvm::Module> module,
+                               shared_ptr <llvm::IRBuilder<>> builder) {
+    if (auto text = dynamic_pointer_cast<String>(item)) {
+        llvm::Value *& constant = stringConstants[text->getValue()];
+        if (!constant)
+            constant = builder->CreateGlobalStringPtr(text->getValue(), "&globalStr");
+        return builder->CreateCall(module->getFunction(newLine ? "writelnStr" : "writeStr"), {constant});
+    }
+    if (!item->getLLVMType(module, builder)->isIntegerTy())
+        throw invalid_argument("Only integers and strings can be written\n");
+    auto value = castToType(builder, item->getLLVMValue(module, builder), llvm::Type::getInt32Ty(builder->getContext()));
+    return builder->CreateCall(module->getFunction(newLine ? "writeln" : "write"), {value});
+}
+
+/**
+ * @brief Items of array or open array, nullptr for other types
+ */
+static shared_ptr <Type> getItemType(const shared_ptr <Type> & array) {
+    if (auto fixed = dynamic_pointer_cast<Array>(array))
+        return fixed->getElementType();
+    if (auto open = dynamic_pointer_cast<OpenArray>(array))
+        return open->getElementType();
+    return nullptr;
+}
+
+void FunctionCall::readArray(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+    auto array = params.size() == 3 ? dynamic_pointer_cast<Reference>(params[0]) : nullptr;
+    if (!array || !dynamic_pointer_cast<Integer>(getItemType(array->getArrayType())))
+        throw invalid_argument("readarray needs an array of integers and bounds of items to read\n");
+    if (constVars.count(array->getName()))
+        throw invalid_argument("Const parameter \"" + array->getName() + "\" can not be modified\n");
+    llvm::Type * i32 = llvm::Type::getInt32Ty(builder->getContext());
+    auto low = make_shared<LoweredValue>(castToType(builder, params[1]->getLLVMValue(module, builder), i32));
+    auto high = make_shared<LoweredValue>(castToType(builder, params[2]->getLLVMValue(module, builder), i32));
+
+//nothing is read and checked when high bound is below low one
+    llvm::Function * TheFunction = builder->GetInsertBlock()->getParent();
+    llvm::BasicBlock * ReadBB = llvm::BasicBlock::Create(builder->getContext(), "readarray", TheFunction);
+    llvm::BasicBlock * AfterBB = llvm::BasicBlock::Create(builder->getContext(), "readarray_after");
+    builder->CreateCondBr(builder->CreateICmpSLE(low->getLLVMValue(module, builder), high->getLLVMValue(module, builder)),
+                          ReadBB, AfterBB);
+    ssaBuilder.sealBlock(ReadBB);
+    builder->SetInsertPoint(ReadBB);
+    llvm::Value * first = ArrayItemReference(array, low).getLLVMAddress(module, builder);
+    if (arrayChecks)
+        ArrayItemReference(array, high).getLLVMAddress(module, builder);
+    llvm::Value * count = builder->CreateAdd(
+            builder->CreateSub(high->getLLVMValue(module, builder), low->getLLVMValue(module, builder)),
+            Number(1).getLLVMValue(module, builder));
+    builder->CreateCall(module->getFunction("readArray"), {first, count});
+    builder->CreateBr(AfterBB);
+    TheFunction->getBasicBlockList().push_back(AfterBB);
+    ssaBuilder.sealBlock(AfterBB);
+    builder->SetInsertPoint(AfterBB);
+}
 
 llvm::Value * FunctionCall::getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
     llvm::Value * result = nullptr;
 
 
-    if ((name == "write" || name == "writeln") && params.size() == 1) {
-        if (!strFormat || !strFormatNl) {
-            strFormat = builder->CreateGlobalStringPtr("%s", "&strFormat");
-            strFormatNl = builder->CreateGlobalStringPtr("%s\n", "&strFormatNl");
-        }
-        if (params[0]->getLLVMValue(module, builder)->getType() == llvm::Type::getInt32Ty(builder->getContext())) {
-            auto var = params[0]->getLLVMValue(module, builder);
-            result = builder->CreateCall(module->getFunction(name), {var});
-        } else {
-            auto var = builder->CreateGlobalStringPtr(((String *) params[0].get())->getValue(), "&globalStr");
-            result = builder->CreateCall(module->getFunction("printf"),
-                                         {name == "write" ? strFormat : strFormatNl, var});
-        }
+    if (name == "write" || name == "writeln") {
+//writeln(a, b, c) writes items one after another, only the last one ends the line, writeln() ends it only
+        if (params.empty() && name == "write")
+            throw invalid_argument("Call to function \"write\" with wrong number of parameters. Got 0 expected 1\n");
+        if (params.empty())
+            result = writeItem(make_shared<String>(""), true, module, builder);
+        for (size_t i = 0; i < params.size(); ++i)
+            result = writeItem(params[i], name == "writeln" && i + 1 == params.size(), module, builder);
+    } else if (name == "readln" && params.size() > 1) {
+//readln(a, b, c) reads variables one after another
+        for (auto & param: params)
+            result = FunctionCall(name, {param}).getLLVMValue(module, builder);
+    } else if (name == "readarray") {
+        readArray(module, builder);
     } else if (name == "dec" && params.size()) {
+        if (constVars.count(((Reference *) params[0].get())->getName()))
+            throw invalid_argument("Const parameter \"" + ((Reference *) params[0].get())->getName() + "\" can not be modified\n");
         llvm::Value * paramAddress = ((Reference *) params[0].get())->getLLVMAddress(module, builder);
         result = builder->CreateStore(
                 builder->CreateSub(params[0]->getLLVMValue(module, builder), Number(1).getLLVMValue(module, builder)),
                 paramAddress);
+    } else if ((name == "low" || name == "high") && params.size() == 1 && dynamic_pointer_cast<Reference>(params[0]) &&
+               ((Reference *) params[0].get())->getArrayType()) {
+//array bounds, open arrays are indexed from 0 and their high bound is known at runtime
+        auto array = ((Reference *) params[0].get())->getArrayType();
+        if (dynamic_pointer_cast<OpenArray>(array))
+            result = name == "low" ? Number(0).getLLVMValue(module, builder)
+                                   : openArrayHighs[((Reference *) params[0].get())->getName()];
+        else
+            result = Number(name == "low" ? static_pointer_cast<Array>(array)->getMinIndex()
+                                          : static_pointer_cast<Array>(array)->getMaxIndex()).getLLVMValue(module, builder);
     } else {
         auto F = module->getFunction(name);
         if (!F)
             throw invalid_argument("Call to unknown function \"" + name + "\"\n");
         vector < llvm::Value * > LLVMParams;
         int i = 0;
-        if (params.size() != F->arg_size())
-            throw invalid_argument("Call to function \"" + name + "\" with wrong number of parameters. Got " + to_string(params.size()) + " expected " + to_string(F->arg_size()) + "\n");
+        auto args = getParamArgs(F);
+        if (params.size() != args.size())
+            throw invalid_argument("Call to function \"" + name + "\" with wrong number of parameters. Got " + to_string(params.size()) + " expected " + to_string(args.size()) + "\n");
+
+//CONSTANT ARGUMENTS - function that only computes is run at compile time and the call replaced by its result
+        Interpreter interpreter;
+        auto body = functionBodies.find(name);
+        auto dropped = droppedBodies.find(name);
+        vector <ConstValue> constArgs(params.size());
+        bool constant = foldCalls && (body != functionBodies.end() || dropped != droppedBodies.end());
+        for (size_t j = 0; constant && j < params.size(); j++)
+            constant = params[j]->evaluate(interpreter, constArgs[j]);
+        if (constant) {
+            string call = name + "(";
+            for (auto & arg: constArgs)
+                call += (&arg == &constArgs.front() ? "" : ", ") + to_string(arg.value);
+            call += ")";
+            ConstValue value;
+            interpreter.failure.clear();
+            if (body == functionBodies.end())
+                interpreter.fail(dropped->second);
+            else if (body->second->call(interpreter, constArgs, value)) {
+                foldedCalls.push_back(call + " = " + to_string(value.value));
+                exited = false;
+                return llvm::ConstantInt::get(F->getReturnType(), value.value, true);
+            }
+            rejectedCalls.push_back(call + " (" + interpreter.failure + ")");
+        }
 
-        for (auto & x: F->args()) {
+        for (auto x: args) {
             auto param = params[i++];
+            if (!x->getType()->isPointerTy()) {
+                LLVMParams.push_back(castToType(builder, param->getLLVMValue(module, builder), x->getType()));
+                continue;
+            }
+//function expects pointer - var and const parameters, open arrays and readln
             auto ptr = dynamic_pointer_cast<Reference>(param);
-//is pointer and function expects pointer
-            if (ptr && x.getType()->isPointerTy()) {
-                LLVMParams.push_back(ptr->getLLVMAddress(module, builder));
-            } else
-                LLVMParams.push_back(param->getLLVMValue(module, builder));
+            if (!ptr)
+                throw invalid_argument("Parameter " + to_string(i) + " of \"" + name + "\" has to be a variable\n");
+            if (constVars.count(ptr->getName()) && !x->onlyReadsMemory())
+                throw invalid_argument("Const parameter \"" + ptr->getName() + "\" can not be modified by \"" + name + "\"\n");
+            llvm::Value * address = ptr->getLLVMAddress(module, builder);
+            llvm::Type * argType = x->getType()->getPointerElementType();
+            llvm::Type * varType = address->getType()->getPointerElementType();
+            if (isOpenArrayPointer(x->getType()) && varType->isArrayTy() &&
+                varType->getArrayElementType() == argType->getArrayElementType()) {
+//any array can be passed as open array, it is indexed from 0 so high bound is number of items - 1
+                LLVMParams.push_back(builder->CreateBitCast(address, x->getType()));
+                if (varType->getArrayNumElements() == 0)
+                    LLVMParams.push_back(openArrayHighs[ptr->getName()]);
+                else
+                    LLVMParams.push_back(Number(varType->getArrayNumElements() - 1).getLLVMValue(module, builder));
+            } else if (varType == argType)
+                LLVMParams.push_back(address);
+            else
+                throw invalid_argument("Parameter " + to_string(i) + " of \"" + name + "\" has wrong type\n");
         }
+//call in expression spanning more lines is at the line of its name
+        llvm::DebugLoc statementLocation = builder->getCurrentDebugLocation();
+        setDebugLocation(*this, builder);
         result = builder->CreateCall(module->getFunction(name), LLVMParams);
+        builder->SetCurrentDebugLocation(statementLocation);
     }
     exited = false;
     return result;
 }
 
+llvm::Type * FunctionCall::getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+    if (name == "dec" || name == "readarray")
+        return llvm::Type::getVoidTy(builder->getContext());
+    if (name == "low" || name == "high")
+        return llvm::Type::getInt32Ty(builder->getContext());
+    auto F = module->getFunction(name);
+    if (!F)
+        throw invalid_argument("Call to unknown function \"" + name + "\"\n");
+    return F->getReturnType();
+}
+
+bool FunctionCall::evaluate(Interpreter & interpreter, ConstValue & value) {
+    auto function = functionBodies.find(name);
+    auto dropped = droppedBodies.find(name);
+    if (function == functionBodies.end() && dropped == droppedBodies.end())
+        return false;
+    vector <ConstValue> args(params.size());
+    for (size_t i = 0; i < params.size(); i++)
+        if (!params[i]->evaluate(interpreter, args[i]))
+            return false;
+    if (function == functionBodies.end())
+        return interpreter.fail(dropped->second);
+    return function->second->call(interpreter, args, value);
+}
+
+void FunctionCall::collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const {
+    llvm::Function * F = module ? module->getFunction(name) : nullptr;
+    vector <llvm::Argument *> args;
+    if (F)
+        args = getParamArgs(F);
+    for (size_t i = 0; i < params.size(); ++i) {
+        auto var = dynamic_pointer_cast<VarReference>(params[i]);
+//dec and pointer parameters (readln, var and const parameters) are passed address of variable, without module
+//(bytecode) any variable passed to a function may be
+        if (var && (name == "dec" || name == "readln" || (i < args.size() && args[i]->getType()->isPointerTy()) ||
+                    (!module && name != "write" && name != "writeln")))
+            names.insert(var->getName());
+        params[i]->collectAddressTaken(names, module);
+    }
+}
+
 ProcedureCall::ProcedureCall(string name, vector <shared_ptr<Expression>> params) : name(name), params(params) {}
 
 void ProcedureCall::translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
     FunctionCall(name, params).getLLVMValue(module, builder);
 }
 
+void ProcedureCall::collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const {
+    FunctionCall(name, params).collectAddressTaken(names, module);
+}
+
+/**
+ * @brief Creates entry block of function body and resets per function code generation state
+ */
+static void beginFunctionBody(llvm::Function * F, shared_ptr <Block> block, shared_ptr <llvm::Module> module,
+                              shared_ptr <llvm::IRBuilder<>> builder) {
+    llvm::BasicBlock * BB = llvm::BasicBlock::Create(builder->getContext(), F->getName(), F);
+    builder->SetInsertPoint(BB);
+    ssaBuilder.reset();
+    ssaBuilder.sealBlock(BB);
+    addressTakenVars.clear();
+    block->collectAddressTaken(addressTakenVars, module);
+}
+
+/**
+ * @brief Subprogram of function body with -g, statements and variables of the body are in its scope
+ */
+static void beginDebugFunction(llvm::Function * F, const SourceLocation & location, shared_ptr <Type> returnType,
+                               const vector <shared_ptr<Var>> & params, shared_ptr <llvm::IRBuilder<>> builder) {
+    ssaDebugVars.clear();
+    if (!debugBuilder)
+        return;
+    vector <llvm::Metadata *> types = {returnType ? returnType->getDebugType(*debugBuilder) : nullptr};
+    for (auto & param: params) {
+        llvm::DIType * type = param->getType()->getDebugType(*debugBuilder);
+        types.push_back(param->isReference() ? debugBuilder->createReferenceType(llvm::dwarf::DW_TAG_reference_type, type)
+                                             : type);
+    }
+    llvm::DIFile * file = debugUnit->getFile();
+    llvm::DISubprogram * subprogram = debugBuilder->createFunction(
+            file, F->getName(), "", file, location.line,
+            debugBuilder->createSubroutineType(debugBuilder->getOrCreateTypeArray(types)), location.line,
+            llvm::DINode::FlagPrototyped, llvm::DISubprogram::SPFlagDefinition);
+    F->setSubprogram(subprogram);
+    debugScope = subprogram;
+    builder->SetCurrentDebugLocation(
+            llvm::DILocation::get(builder->getContext(), location.line, location.column, subprogram));
+}
+
+static void endDebugFunction(shared_ptr <llvm::IRBuilder<>> builder) {
+    debugScope = nullptr;
+    builder->SetCurrentDebugLocation(llvm::DebugLoc());
+}
+
+/**
+ * @brief Declares parameters and local variables of function and binds arguments to parameters
+ */
+static void initFunctionParams(llvm::Function * F, const vector <shared_ptr<Var>> & params,
+                               const vector <shared_ptr<Var>> & localVars, shared_ptr <llvm::Module> module,
+                               shared_ptr <llvm::IRBuilder<>> builder) {
+//initialize variables
+    auto arg = F->arg_begin();
+    for (auto & param: params)
+        param->bindArgument(arg, module, builder);
+//create local vars
+    for (auto & var: localVars)
+        var->translateToLLVM(module, builder);
+}
+
+/**
+ * @brief Names visible in function body, they are restored after the body so locals do not leak to other functions
+ */
+struct Scope {
+    map <string, llvm::Value *> vars;
+    map <string, int> ssaVars;
+    map <string, shared_ptr<Type>> arrays;
+    map <string, llvm::Value *> highs;
+    set <string> consts;
+};
+
+static Scope saveScope() {
+    return {NamedVars, NamedSSAVars, arrayTypes, openArrayHighs, constVars};
+}
+
+static void restoreScope(const Scope & scope) {
+    NamedVars = scope.vars;
+    NamedSSAVars = scope.ssaVars;
+    arrayTypes = scope.arrays;
+    openArrayHighs = scope.highs;
+    constVars = scope.consts;
+}
+
+/**
+ * @brief Creates function prototype, var and const parameters are pointers to variables of caller
+ *
+ * Reference parameters are never captured (mila has no pointers), const ones are readonly and arrays with known size
+ * dereferenceable. Open arrays are followed by hidden parameter with their high bound.
+ */
+static llvm::Function * createPrototype(const string & name, llvm::Type * returnType, const vector <shared_ptr<Var>> & params,
+                                        shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+    vector < llvm::Type * > llvmParams;
+    for (auto & x: params) {
+        llvm::Type * type = x->getType()->getLLVMType(builder);
+        if (x->isReference()) {
+            if (x->getMode() == ParamMode::Value)
+                throw invalid_argument("Open array parameter \"" + x->getName() + "\" of \"" + name + "\" has to be var or const\n");
+            llvmParams.push_back(type->getPointerTo());
+            if (dynamic_pointer_cast<OpenArray>(x->getType()))
+                llvmParams.push_back(llvm::Type::getInt32Ty(builder->getContext()));
+        } else
+            llvmParams.push_back(type);
+    }
+    llvm::FunctionType * FT = llvm::FunctionType::get(returnType, llvmParams, false);
+    llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, name, module.get());
+
+    auto arg = F->arg_begin();
+    for (auto & param: params) {
+        arg->setName(param->getName());
+        if (param->isReference()) {
+            uint64_t size = module->getDataLayout().getTypeAllocSize(arg->getType()->getPointerElementType());
+            arg->addAttr(llvm::Attribute::NoCapture);
+            arg->addAttr(llvm::Attribute::NonNull);
+            if (size)
+                arg->addAttr(llvm::Attribute::getWithDereferenceableBytes(builder->getContext(), size));
+            if (param->getMode() == ParamMode::Const)
+                arg->addAttr(llvm::Attribute::ReadOnly);
+            if (dynamic_pointer_cast<OpenArray>(param->getType()))
+                (++arg)->setName(param->getName() + ".high");
+        }
+        ++arg;
+    }
+    return F;
+}
+
 Function::Function(string name, vector <shared_ptr<Var>> params, shared_ptr <Type> returnType, shared_ptr <Block> block,
-                   vector <shared_ptr<Var>> localVars) : name(name), params(params), returnType(returnType),
-                                                         block(block), localVars(localVars) {}
+                   vector <shared_ptr<Var>> localVars, bool pure) : name(name), params(params), returnType(returnType),
+                                                                    block(block), localVars(localVars), pure(pure) {}
+
+/**
+ * @brief Puts cache of results in front of pure function, thread local direct mapped table indexed by hash of arguments
+ *
+ * Slot is {valid, result, arguments...}. Lookup which hits returns without running the body, every return of the body
+ * fills the slot of its arguments. Tables are thread local, so parallel callers need no locking.
+ */
+static void memoize(llvm::Function * F, shared_ptr <llvm::Module> module) {
+    llvm::LLVMContext & context = F->getContext();
+    vector <llvm::Type *> fields = {llvm::Type::getInt8Ty(context), F->getReturnType()};
+    for (llvm::Argument & arg: F->args())
+        fields.push_back(arg.getType());
+    llvm::StructType * slotType = llvm::StructType::get(context, fields);
+    llvm::ArrayType * tableType = llvm::ArrayType::get(slotType, memoSize);
+    auto table = new llvm::GlobalVariable(*module, tableType, false, llvm::GlobalValue::InternalLinkage,
+                                          llvm::ConstantAggregateZero::get(tableType), F->getName() + ".memo", nullptr,
+                                          llvm::GlobalValue::LocalExecTLSModel);
+    vector <llvm::ReturnInst *> returns;
+    for (llvm::BasicBlock & BB: *F)
+        if (auto ret = llvm::dyn_cast<llvm::ReturnInst>(BB.getTerminator()))
+            returns.push_back(ret);
+
+//LOOKUP - after allocas of entry block, fibonacci hashing takes the best mixed top bits of hash
+    llvm::BasicBlock * entry = &F->getEntryBlock();
+    auto body = entry->begin();
+    while (llvm::isa<llvm::AllocaInst>(*body))
+        ++body;
+    llvm::BasicBlock * MissBB = entry->splitBasicBlock(body, "memo_miss");
+    entry->getTerminator()->eraseFromParent();
+    llvm::IRBuilder<> builder(entry);
+    llvm::Value * hash = builder.getInt32(0);
+    for (llvm::Argument & arg: F->args())
+        hash = builder.CreateMul(builder.CreateXor(hash, &arg), builder.getInt32(0x9E3779B1u));
+    int bits = 0;
+    while ((1 << bits) < memoSize)
+        ++bits;
+    llvm::Value * index = bits ? builder.CreateLShr(hash, 32 - bits) : builder.getInt32(0);
+    llvm::Value * slot = builder.CreateInBoundsGEP(tableType, table, {builder.getInt32(0), index}, "memo_slot");
+    auto field = [&](llvm::IRBuilder<> & at, int i) {
+        return at.CreateStructGEP(slotType, slot, i);
+    };
+    llvm::Value * valid = builder.CreateLoad(builder.getInt8Ty(), field(builder, 0));
+    llvm::Value * hit = builder.CreateICmpNE(valid, builder.getInt8(0));
+    for (llvm::Argument & arg: F->args())
+        hit = builder.CreateAnd(hit, builder.CreateICmpEQ(
+                builder.CreateLoad(arg.getType(), field(builder, arg.getArgNo() + 2)), &arg), "memo_hit");
+    llvm::BasicBlock * HitBB = llvm::BasicBlock::Create(context, "memo_hit", F);
+    builder.CreateCondBr(hit, HitBB, MissBB);
+    builder.SetInsertPoint(HitBB);
+    builder.CreateRet(builder.CreateLoad(F->getReturnType(), field(builder, 1)));
+
+//FILL - before returns of body
+    for (llvm::ReturnInst * ret: returns) {
+        builder.SetInsertPoint(ret);
+        if (memoEviction == MemoEviction::Keep) {
+            llvm::BasicBlock * BB = ret->getParent();
+            llvm::BasicBlock * DoneBB = BB->splitBasicBlock(ret, "memo_done");
+            llvm::BasicBlock * FillBB = llvm::BasicBlock::Create(context, "memo_fill", F, DoneBB);
+            BB->getTerminator()->eraseFromParent();
+            builder.SetInsertPoint(BB);
+            llvm::Value * empty = builder.CreateICmpEQ(builder.CreateLoad(builder.getInt8Ty(), field(builder, 0)),
+                                                       builder.getInt8(0));
+            builder.CreateCondBr(empty, FillBB, DoneBB);
+            builder.SetInsertPoint(FillBB);
+            builder.SetInsertPoint(builder.CreateBr(DoneBB));
+        }
+        builder.CreateStore(ret->getReturnValue(), field(builder, 1));
+        for (llvm::Argument & arg: F->args())
+            builder.CreateStore(&arg, field(builder, arg.getArgNo() + 2));
+        builder.CreateStore(builder.getInt8(1), field(builder, 0));
+    }
+}
+
+void Function::checkPurity(llvm::Function * F) const {
+    for (llvm::Instruction & I: llvm::instructions(F)) {
+        llvm::Value * address = nullptr;
+        if (auto load = llvm::dyn_cast<llvm::LoadInst>(&I))
+            address = load->getPointerOperand();
+        else if (auto store = llvm::dyn_cast<llvm::StoreInst>(&I))
+            address = store->getPointerOperand();
+//counters of --instrument do not change results
+        if (address && llvm::isa<llvm::GlobalVariable>(getBaseObject(address)) &&
+            none_of(loopCounters.begin(), loopCounters.end(), [address](const LoopCounter & loop) {
+                return loop.counter == address;
+            }))
+            throw invalid_argument("Pure function \"" + name + "\" uses global variable \"" +
+                                   getBaseObject(address)->getName().str() + "\"\n");
+//debug info describes variables, range error stops the program, they do not change the result of any call
+        if (llvm::isa<llvm::DbgInfoIntrinsic>(&I))
+            continue;
+        if (auto call = llvm::dyn_cast<llvm::CallInst>(&I)) {
+            llvm::Function * callee = call->getCalledFunction();
+            if (callee && (pureFunctions.count(callee->getName().str()) || callee->getName() == "rangeError"))
+                continue;
+            throw invalid_argument("Pure function \"" + name + "\" calls \"" +
+                                   (callee ? callee->getName().str() : string("")) + "\" which is not pure\n");
+        }
+    }
+}
 
 void Function::translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+    if (pure) {
+        for (auto & param: params)
+            if (!dynamic_pointer_cast<Integer>(param->getType()) || param->isReference())
+                throw invalid_argument("Pure function \"" + name + "\" can only have integer value parameters\n");
+        if (returnType->getLLVMType(builder)->isArrayTy())
+            throw invalid_argument("Pure function \"" + name + "\" can not return array\n");
+        pureFunctions.insert(name);
+    }
     if (!module->getFunction(name))
         initFunction(module, builder);
+    if (block == nullptr)
+        forwardFunctions.insert(name);
     if (block != nullptr) {
+        functionBodies[name] = this;
         llvm::Function * F = module->getFunction(name);
         auto oldInsert = builder->GetInsertBlock();
-        builder->SetInsertPoint(&F->getEntryBlock());
+        Scope oldScope = saveScope();
+        beginFunctionBody(F, block, module, builder);
+        beginDebugFunction(F, location, returnType, params, builder);
+//result variable
+        auto result = make_shared<Var>(name, returnType, false);
+        result->location = location;
+        result->translateToLLVM(module, builder);
+        initFunctionParams(F, params, localVars, module, builder);
         block->translateToLLVM(module, builder);
-        builder->CreateRet(builder->CreateLoad(NamedVars[name]));
+        builder->CreateRet(VarReference(name).getLLVMValue(module, builder));
+        if (pureFunctions.count(name)) {
+            checkPurity(F);
+            memoize(F, module);
+        }
+        endDebugFunction(builder);
+        restoreScope(oldScope);
         builder->SetInsertPoint(oldInsert);
     }
 }
 
 void Function::initFunction(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
-    vector < llvm::Type * > llvmParams;
-    for (auto & x: params) {
-        llvmParams.push_back(x->getType()->getLLVMType(builder));
-    }
-    llvm::FunctionType * FT = llvm::FunctionType::get(returnType->getLLVMType(builder), llvmParams, false);
-    llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, name, module.get());
+    createPrototype(name, returnType->getLLVMType(builder), params, module, builder);
+}
 
-    int idx = 0;
-    for (auto & arg: F->args()) {
-        arg.setName(this->params[idx++]->getName());
+Function::~Function() {
+    auto body = functionBodies.find(name);
+    if (body != functionBodies.end() && body->second == this)
+        functionBodies.erase(body);
+}
+
+static bool isScalar(const shared_ptr <Type> & type) {
+    return dynamic_pointer_cast<Integer>(type) || dynamic_pointer_cast<Boolean>(type);
+}
+
+bool Function::canBeInterpreted() const {
+    if (!block || !isScalar(returnType))
+        return false;
+    for (auto & param: params)
+        if (param->isReference() || !isScalar(param->getType()))
+            return false;
+    for (auto & var: localVars)
+        if (!isScalar(var->getType()))
+            return false;
+    return true;
+}
+
+static string notInterpretable(const string & name) {
+    return "\"" + name + "\" has array or var parameters, result or variables";
+}
+
+bool Function::keepForFolding(shared_ptr <llvm::Module> module) {
+    llvm::Function * F = module->getFunction(name);
+    if (!foldCalls || !F)
+        return false;
+    if (!canBeInterpreted()) {
+        droppedBodies[name] = notInterpretable(name);
+        return false;
     }
+//pure functions passed checkPurity already, their only global is the memo table
+    bool pure = pureFunctions.count(name);
+    for (llvm::Instruction & I: llvm::instructions(*F)) {
+        bool global = false;
+        for (llvm::Value * operand: I.operands())
+            global |= !pure && llvm::isa<llvm::GlobalVariable>(operand);
+        auto call = llvm::dyn_cast<llvm::CallInst>(&I);
+        llvm::Function * callee = call ? call->getCalledFunction() : nullptr;
+        if (global || (call && !(callee && (callee == F || callee->isIntrinsic() ||
+                                            functionBodies.count(callee->getName().str()) ||
+                                            (callee->isDeclaration() &&
+                                             forwardFunctions.count(callee->getName().str())))))) {
+            droppedBodies[name] = "body not kept by --stream, it uses global variables, procedures, input or output";
+            return false;
+        }
+    }
+    return true;
+}
 
-    llvm::BasicBlock * BB = llvm::BasicBlock::Create(builder->getContext(), name, F);
-    builder->SetInsertPoint(BB);
-    NamedVars[name] = builder->CreateAlloca(returnType->getLLVMType(builder),
-                                            llvm::ConstantInt::get(llvm::Type::getInt32Ty(builder->getContext()), 0,
-                                                                   false), name);
+bool Interpreter::step() {
+    if (interpreterFuelLeft <= 0)
+        return fail("out of " + to_string(interpreterFuel) + " steps");
+    --interpreterFuelLeft;
+    return true;
+}
 
-//initialize variables
-    int i = 0;
-    for (auto & x: F->args()) {
-        auto param = params[i++];
-        param->translateToLLVM(module, builder);
-        auto varRef = make_shared<VarReference>(param->getName());
-        builder->CreateStore(&x, varRef->getLLVMAddress(module, builder));
+bool Interpreter::fail(const string & reason) {
+    if (failure.empty())
+        failure = reason;
+    return false;
+}
+
+bool Function::call(Interpreter & interpreter, const vector <ConstValue> & args, ConstValue & result) {
+    if (args.size() != params.size())
+        return false;
+//the same call of any call site or caller is evaluated once
+    vector <int> key;
+    for (size_t i = 0; i < args.size(); i++)
+        key.push_back(dynamic_pointer_cast<Boolean>(params[i]->getType()) ? args[i].value != 0 : args[i].value);
+    auto evaluated = evaluatedCalls.find({name, key});
+    if (evaluated != evaluatedCalls.end()) {
+        result = evaluated->second.result;
+        return evaluated->second.ok || interpreter.fail(evaluated->second.failure);
+    }
+    if (!interpreter.step())
+        return false;
+    if (!canBeInterpreted()) {
+        string reason = notInterpretable(name);
+        evaluatedCalls[{name, key}] = {false, {0, false}, reason};
+        return interpreter.fail(reason);
+    }
+//nesting depends on the caller, only the outermost call gives up for good
+    size_t depth = interpreter.frames.size();
+    if (depth >= interpreterMaxDepth)
+        return interpreter.fail(tooDeep);
+//result variable, parameters and local variables, only scalars can be interpreted
+    map <string, ConstValue> frame;
+    auto declare = [&frame](const string & name, shared_ptr <Type> type) {
+        frame[name] = {0, dynamic_pointer_cast<Boolean>(type) != nullptr};
+    };
+    declare(name, returnType);
+    for (size_t i = 0; i < params.size(); i++) {
+        declare(params[i]->getName(), params[i]->getType());
+        ConstValue & param = frame[params[i]->getName()];
+        param.value = key[i];
     }
-//create local vars
     for (auto & var: localVars)
-        var->translateToLLVM(module, builder);
+        declare(var->getName(), var->getType());
+    interpreter.frames.push_back(move(frame));
+    bool ok = block->execute(interpreter) || interpreter.fail("uses global variables, arrays, input or output");
+    result = interpreter.frames.back()[name];
+    interpreter.frames.pop_back();
+//exit leaves only this call
+    interpreter.flow = Interpreter::Flow::Next;
+    if (ok || depth == 0 || interpreter.failure != tooDeep)
+        evaluatedCalls[{name, key}] = {ok, result, interpreter.failure};
+    return ok;
 }
 
 Procedure::Procedure(string name, vector <shared_ptr<Var>> params, shared_ptr <Block> block,
@@ -536,47 +1999,38 @@ void Procedure::translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <ll
     if (block != nullptr) {
         llvm::Function * F = module->getFunction(name);
         auto oldInsert = builder->GetInsertBlock();
-        builder->SetInsertPoint(&F->getEntryBlock());
+        Scope oldScope = saveScope();
+        beginFunctionBody(F, block, module, builder);
+        beginDebugFunction(F, location, nullptr, params, builder);
+        initFunctionParams(F, params, localVars, module, builder);
         block->translateToLLVM(module, builder);
         builder->CreateRetVoid();
+        endDebugFunction(builder);
+        restoreScope(oldScope);
         builder->SetInsertPoint(oldInsert);
     }
 }
 
 void Procedure::initProcedure(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
-    vector < llvm::Type * > llvmParams;
-    for (auto & x: params) {
-        llvmParams.push_back(x->getType()->getLLVMType(builder));
-    }
-    llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getVoidTy(builder->getContext()), llvmParams, false);
-    llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, name, module.get());
-    int idx = 0;
-    for (auto & arg: F->args()) {
-        arg.setName(this->params[idx++]->getName());
-    }
-
-    llvm::BasicBlock * BB = llvm::BasicBlock::Create(builder->getContext(), name, F);
-    builder->SetInsertPoint(BB);
-
-//initialize variables
-    int i = 0;
-    for (auto & x: F->args()) {
-        auto param = params[i];
-        param->translateToLLVM(module, builder);
-        auto varRef = make_shared<VarReference>(param->getName());
-        builder->CreateStore(&x, varRef->getLLVMAddress(module, builder));
-        i++;
-    }
-//create local vars
-    for (auto & var: localVars)
-        var->translateToLLVM(module, builder);
-
+    createPrototype(name, llvm::Type::getVoidTy(builder->getContext()), params, module, builder);
 }
 
 void Program::initFunctions(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
+    stringConstants.clear();
+    loopCounters.clear();
+    if (arrayChecks) {   //rangeError
+        std::vector<llvm::Type *> Ints(3, llvm::Type::getInt32Ty(builder->getContext()));
+        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getVoidTy(builder->getContext()), Ints, false);
+        llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "rangeError", module.get());
+        F->addFnAttr(llvm::Attribute::NoReturn);
+        F->addFnAttr(llvm::Attribute::Cold);
+    }
+//predefined boolean constants
+    NamedConsts["true"] = llvm::ConstantInt::getTrue(builder->getContext());
+    NamedConsts["false"] = llvm::ConstantInt::getFalse(builder->getContext());
     {
         std::vector<llvm::Type *> Ints(1, llvm::Type::getInt32Ty(builder->getContext()));
-        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getInt32Ty(builder->getContext()), Ints, true);
+        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getInt32Ty(builder->getContext()), Ints, false);
         {   //write
             llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "write", module.get());
             for (auto & Arg: F->args())
@@ -588,14 +2042,19 @@ void Program::initFunctions(shared_ptr <llvm::Module> module, shared_ptr <llvm::
                 Arg.setName("x");
         }
     }
-    {   //printf
-        std::vector<llvm::Type *> IntPtrs(2, llvm::Type::getInt8PtrTy(builder->getContext()));
-        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getInt32Ty(builder->getContext()), IntPtrs,
-                                                          false);
-        llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "printf", module.get());
-        for (auto & Arg: F->args())
-            Arg.setName("x");
-        F->setCallingConv(llvm::CallingConv::C);
+    {
+        std::vector<llvm::Type *> Texts(1, llvm::Type::getInt8PtrTy(builder->getContext()));
+        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getInt32Ty(builder->getContext()), Texts, false);
+        {   //writeStr
+            llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "writeStr", module.get());
+            for (auto & Arg: F->args())
+                Arg.setName("x");
+        }
+        {   //writelnStr
+            llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "writelnStr", module.get());
+            for (auto & Arg: F->args())
+                Arg.setName("x");
+        }
     }
     {   //readln
         std::vector<llvm::Type *> IntPtrs(1, llvm::Type::getInt32PtrTy(builder->getContext()));
@@ -605,8 +2064,650 @@ void Program::initFunctions(shared_ptr <llvm::Module> module, shared_ptr <llvm::
         for (auto & Arg: F->args())
             Arg.setName("x");
     }
+    {   //readArray
+        std::vector<llvm::Type *> Params = {llvm::Type::getInt32PtrTy(builder->getContext()),
+                                            llvm::Type::getInt32Ty(builder->getContext())};
+        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getInt32Ty(builder->getContext()), Params, false);
+        llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "readArray", module.get());
+        F->getArg(0)->setName("items");
+        F->getArg(1)->setName("count");
+    }
+    {   //eof, C _Bool
+        llvm::FunctionType * FT = llvm::FunctionType::get(llvm::Type::getInt1Ty(builder->getContext()), false);
+        llvm::Function * F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, "eof", module.get());
+        F->addRetAttr(llvm::Attribute::ZExt);
+    }
 }
 
 void Program::translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) {
     initFunctions(module, builder);
-}
\ No newline at end of file
+    if (!debugInfo && !debugLocations)
+        return;
+    debugBuilder = make_unique<llvm::DIBuilder>(*module);
+    auto slash = sourceName.rfind('/');
+    llvm::DIFile * file = slash == string::npos ? debugBuilder->createFile(sourceName, ".")
+                                                : debugBuilder->createFile(sourceName.substr(slash + 1),
+                                                                           sourceName.substr(0, slash));
+    debugUnit = debugBuilder->createCompileUnit(llvm::dwarf::DW_LANG_Pascal83, file, "mila", true, "", 0, "",
+                                                debugInfo ? llvm::DICompileUnit::FullDebug
+                                                          : llvm::DICompileUnit::NoDebug);
+    if (debugInfo)
+        module->addModuleFlag(llvm::Module::Warning, "Dwarf Version", 4);
+    module->addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+}
+
+void Program::finishDebugInfo(shared_ptr <llvm::Module> module) {
+    if (!debugBuilder)
+        return;
+    debugBuilder->finalize();
+    debugBuilder.reset();
+    debugUnit = nullptr;
+}
+
+/**
+ * @brief Function can call itself directly or through other functions
+ */
+static bool mayRecurse(llvm::Function * F) {
+    set <llvm::Function *> visited;
+    vector <llvm::Function *> stack = {F};
+    while (!stack.empty()) {
+        llvm::Function * caller = stack.back();
+        stack.pop_back();
+        for (llvm::Instruction & I: llvm::instructions(caller))
+            if (auto call = llvm::dyn_cast<llvm::CallInst>(&I))
+                if (llvm::Function * callee = call->getCalledFunction()) {
+                    if (callee == F)
+                        return true;
+                    if (visited.insert(callee).second)
+                        stack.push_back(callee);
+                }
+    }
+    return false;
+}
+
+/**
+ * @brief Instructions using constant expression, possibly nested in other constant expressions
+ */
+static void collectInstructionUsers(llvm::ConstantExpr * expr, set <llvm::Instruction *> & instructions) {
+    for (llvm::User * user: expr->users())
+        if (auto I = llvm::dyn_cast<llvm::Instruction>(user))
+            instructions.insert(I);
+        else if (auto outer = llvm::dyn_cast<llvm::ConstantExpr>(user))
+            collectInstructionUsers(outer, instructions);
+}
+
+void Program::demoteRecursiveStaticLocals(shared_ptr <llvm::Module> module) {
+    for (auto & local: staticLocals) {
+        llvm::GlobalVariable * gVar = local.first;
+        llvm::Function * F = local.second;
+        if (!mayRecurse(F))
+            continue;
+//every activation needs its own copy, address arithmetic folded into constants is rebuilt as instructions
+        llvm::IRBuilder<> frameBuilder(&F->getEntryBlock(), F->getEntryBlock().begin());
+        llvm::AllocaInst * alloca = frameBuilder.CreateAlloca(gVar->getValueType(), nullptr, gVar->getName());
+        vector <llvm::User *> users(gVar->user_begin(), gVar->user_end());
+        for (llvm::User * user: users)
+            if (auto expr = llvm::dyn_cast<llvm::ConstantExpr>(user)) {
+                set <llvm::Instruction *> instructions;
+                collectInstructionUsers(expr, instructions);
+                for (llvm::Instruction * I: instructions)
+                    llvm::convertConstantExprsToInstructions(I, expr);
+            }
+        gVar->removeDeadConstantUsers();
+        gVar->replaceAllUsesWith(alloca);
+        gVar->eraseFromParent();
+    }
+    staticLocals.clear();
+}
+
+static void collectGlobals(llvm::Value * value, set <llvm::GlobalVariable *> & globals) {
+    if (auto global = llvm::dyn_cast<llvm::GlobalVariable>(value))
+        globals.insert(global);
+    else if (auto expr = llvm::dyn_cast<llvm::ConstantExpr>(value))
+        for (llvm::Value * op: expr->operands())
+            collectGlobals(op, globals);
+}
+
+void Program::markNoAliasParams(shared_ptr <llvm::Module> module) {
+//GLOBALS EVERY FUNCTION CAN ACCESS, directly or through functions it calls
+    map <llvm::Function *, set<llvm::GlobalVariable *>> usedGlobals;
+    for (llvm::Function & F: *module)
+        for (llvm::Instruction & I: llvm::instructions(F))
+            for (llvm::Value * op: I.operands())
+                collectGlobals(op, usedGlobals[&F]);
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (llvm::Function & F: *module)
+            for (llvm::Instruction & I: llvm::instructions(F))
+                if (auto call = llvm::dyn_cast<llvm::CallInst>(&I))
+                    if (llvm::Function * callee = call->getCalledFunction())
+                        for (llvm::GlobalVariable * global: usedGlobals[callee])
+                            changed |= usedGlobals[&F].insert(global).second;
+    }
+
+//CANDIDATES - reference parameters, optimistically noalias until some call passes memory which is reachable otherwise
+    set <llvm::Argument *> candidates;
+    for (llvm::Function & F: *module)
+        if (!F.isDeclaration())
+            for (llvm::Argument & arg: F.args())
+                if (arg.hasNoCaptureAttr())
+                    candidates.insert(&arg);
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto it = candidates.begin(); it != candidates.end();) {
+            llvm::Argument * arg = *it;
+            llvm::Function * F = arg->getParent();
+            bool noAlias = true;
+            for (llvm::User * user: F->users()) {
+                auto call = llvm::dyn_cast<llvm::CallInst>(user);
+                if (!call || call->getCalledFunction() != F) {
+                    noAlias = false;
+                    break;
+                }
+                llvm::Value * base = getBaseObject(call->getArgOperand(arg->getArgNo()));
+                auto global = llvm::dyn_cast<llvm::GlobalVariable>(base);
+                auto baseArg = llvm::dyn_cast<llvm::Argument>(base);
+                noAlias = llvm::isa<llvm::AllocaInst>(base) || (global && !usedGlobals[F].count(global)) ||
+                          (baseArg && candidates.count(baseArg));
+//the same variable passed twice
+                for (unsigned i = 0; noAlias && i < call->arg_size(); ++i)
+                    if (i != arg->getArgNo() && call->getArgOperand(i)->getType()->isPointerTy() &&
+                        getBaseObject(call->getArgOperand(i)) == base)
+                        noAlias = false;
+                if (!noAlias)
+                    break;
+            }
+            if (noAlias)
+                ++it;
+            else {
+                it = candidates.erase(it);
+                changed = true;
+            }
+        }
+    }
+    for (llvm::Argument * arg: candidates)
+        arg->addAttr(llvm::Attribute::NoAlias);
+}
+
+/**
+ * @brief Call of program function whose result is returned by ret
+ *
+ * The result may go through the result variable of the function, i.e. call, store to variable, load of it and ret.
+ * Debug info of variables (-g) may be between them.
+ */
+static llvm::CallInst * getTailCall(llvm::ReturnInst * ret) {
+    llvm::Instruction * prev = ret->getPrevNonDebugInstruction();
+    llvm::CallInst * call = nullptr;
+    if (!ret->getReturnValue() || (ret->getReturnValue() == prev && llvm::isa<llvm::CallInst>(prev)))
+        call = llvm::dyn_cast_or_null<llvm::CallInst>(prev);
+    else if (auto load = llvm::dyn_cast_or_null<llvm::LoadInst>(prev))
+        if (load == ret->getReturnValue())
+            if (auto store = llvm::dyn_cast_or_null<llvm::StoreInst>(load->getPrevNonDebugInstruction()))
+                if (store->getPointerOperand() == load->getPointerOperand() &&
+                    store->getValueOperand() == store->getPrevNonDebugInstruction())
+                    call = llvm::dyn_cast<llvm::CallInst>(store->getValueOperand());
+    if (!call || !call->getCalledFunction() || call->getCalledFunction()->isDeclaration() ||
+        call->getType() != ret->getFunction()->getReturnType())
+        return nullptr;
+//callee must not see stack frame of caller, it is released or reused by the tail call
+    for (llvm::Value * arg: call->args())
+        if (arg->getType()->isPointerTy() && llvm::isa<llvm::AllocaInst>(getBaseObject(arg)))
+            return nullptr;
+    return call;
+}
+
+/**
+ * @brief Moves return from block which only returns to predecessors ending with call, so the call is in tail position
+ *
+ * Predecessors without other instructions get the return too, so returns climb out of nested ifs.
+ */
+static bool duplicateReturns(llvm::Function & F) {
+    bool changed = false;
+    for (llvm::BasicBlock & BB: F) {
+        auto ret = llvm::dyn_cast<llvm::ReturnInst>(BB.getTerminator());
+        if (!ret)
+            continue;
+//only phis, debug info and load of result may precede return
+        bool onlyReturns = true;
+        for (llvm::Instruction & I: BB)
+            if (!llvm::isa<llvm::PHINode>(I) && !llvm::isa<llvm::DbgInfoIntrinsic>(I) && &I != ret &&
+                !(llvm::isa<llvm::LoadInst>(I) && I.getNextNonDebugInstruction() == ret && ret->getReturnValue() == &I))
+                onlyReturns = false;
+        if (!onlyReturns)
+            continue;
+        vector <llvm::BasicBlock *> preds(llvm::pred_begin(&BB), llvm::pred_end(&BB));
+        for (llvm::BasicBlock * pred: preds) {
+            auto br = llvm::dyn_cast<llvm::BranchInst>(pred->getTerminator());
+            if (!br || br->isConditional())
+                continue;
+            llvm::Instruction * last = br->getPrevNonDebugInstruction();
+            if (last && !llvm::isa<llvm::CallInst>(last) &&
+                !(llvm::isa<llvm::StoreInst>(last) && llvm::isa<llvm::CallInst>(last->getOperand(0))))
+                continue;
+            map <llvm::Value *, llvm::Value *> copies;
+            for (llvm::Instruction & I: BB) {
+                if (auto phi = llvm::dyn_cast<llvm::PHINode>(&I)) {
+                    copies[phi] = phi->getIncomingValueForBlock(pred);
+                    continue;
+                }
+                llvm::Instruction * copy = I.clone();
+                for (unsigned i = 0; i < copy->getNumOperands(); ++i)
+                    if (copies.count(copy->getOperand(i)))
+                        copy->setOperand(i, copies[copy->getOperand(i)]);
+                copy->insertBefore(br);
+                copies[&I] = copy;
+            }
+            br->eraseFromParent();
+            BB.removePredecessor(pred);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+void Program::eliminateTailCalls(shared_ptr <llvm::Module> module) {
+    for (llvm::Function & F: *module) {
+        if (F.isDeclaration())
+            continue;
+        while (duplicateReturns(F));
+        vector <llvm::ReturnInst *> selfCalls;
+        for (llvm::BasicBlock & BB: F) {
+            auto ret = llvm::dyn_cast<llvm::ReturnInst>(BB.getTerminator());
+            llvm::CallInst * call = ret ? getTailCall(ret) : nullptr;
+            if (!call)
+                continue;
+            llvm::Function * callee = call->getCalledFunction();
+            if (callee == &F) {
+                selfCalls.push_back(ret);
+                tailCalls.push_back({F.getName().str(), callee->getName().str(), "loop"});
+                continue;
+            }
+//musttail needs the call right before ret and the same prototype and calling convention
+            if (ret->getReturnValue() && ret->getReturnValue() != call) {
+                auto load = llvm::cast<llvm::Instruction>(ret->getReturnValue());
+                ret->setOperand(0, call);
+                load->eraseFromParent();
+                call->getNextNonDebugInstruction()->eraseFromParent();
+            }
+            bool mustTail = callee->getFunctionType() == F.getFunctionType() &&
+                            callee->getCallingConv() == F.getCallingConv();
+            while (mustTail && call->getNextNode() != ret)
+                call->getNextNode()->eraseFromParent();
+            call->setTailCallKind(mustTail ? llvm::CallInst::TCK_MustTail : llvm::CallInst::TCK_Tail);
+            tailCalls.push_back({F.getName().str(), callee->getName().str(), mustTail ? "musttail" : "tail"});
+        }
+        if (selfCalls.empty())
+            continue;
+
+//SELF CALLS BECOME LOOP - arguments are phis of a header placed after allocas, every self call jumps back to it
+        llvm::BasicBlock * entry = &F.getEntryBlock();
+        auto body = entry->begin();
+        while (llvm::isa<llvm::AllocaInst>(*body))
+            ++body;
+        llvm::BasicBlock * header = entry->splitBasicBlock(body, "tailrecurse");
+        vector <llvm::PHINode *> args;
+        for (llvm::Argument & arg: F.args()) {
+            llvm::PHINode * phi = llvm::PHINode::Create(arg.getType(), 2, arg.getName() + ".tr",
+                                                        header->getFirstNonPHI());
+            arg.replaceAllUsesWith(phi);
+            phi->addIncoming(&arg, entry);
+            args.push_back(phi);
+        }
+        for (llvm::ReturnInst * ret: selfCalls) {
+            llvm::BasicBlock * BB = ret->getParent();
+            llvm::CallInst * call = getTailCall(ret);
+            for (unsigned i = 0; i < args.size(); ++i)
+                args[i]->addIncoming(call->getArgOperand(i), BB);
+            while (&BB->back() != call)
+                BB->back().eraseFromParent();
+            call->eraseFromParent();
+            llvm::BranchInst::Create(header, BB);
+        }
+    }
+}
+
+void Program::internalizeFunctions(shared_ptr <llvm::Module> module) {
+//REACHABLE FROM MAIN, the rest can never run
+    set <llvm::Function *> reachable;
+    vector <llvm::Function *> stack = {module->getFunction("main")};
+    reachable.insert(stack.back());
+    while (!stack.empty()) {
+        llvm::Function * caller = stack.back();
+        stack.pop_back();
+        for (llvm::Instruction & I: llvm::instructions(caller))
+            if (auto call = llvm::dyn_cast<llvm::CallInst>(&I))
+                if (llvm::Function * callee = call->getCalledFunction())
+                    if (reachable.insert(callee).second)
+                        stack.push_back(callee);
+    }
+    vector <llvm::Function *> unreachable;
+    for (llvm::Function & F: *module)
+        if (!F.isDeclaration() && !reachable.count(&F))
+            unreachable.push_back(&F);
+//bodies may call each other, references are dropped before any of them is erased
+    for (llvm::Function * F: unreachable)
+        F->dropAllReferences();
+    for (llvm::Function * F: unreachable)
+        F->eraseFromParent();
+
+//INTERNAL FASTCC - nothing outside of the program calls its functions, runtime is only declared
+    for (llvm::Function & F: *module) {
+        if (F.isDeclaration() || F.getName() == "main")
+            continue;
+        F.setLinkage(llvm::GlobalValue::InternalLinkage);
+        F.setCallingConv(llvm::CallingConv::Fast);
+        for (llvm::User * user: F.users())
+            if (auto call = llvm::dyn_cast<llvm::CallInst>(user))
+                call->setCallingConv(llvm::CallingConv::Fast);
+    }
+}
+
+void Program::inferFunctionAttributes(shared_ptr <llvm::Module> module) {
+//MEMORY EFFECTS - optimistically none, grown by accesses to memory which is not local and by callees until fixpoint
+    enum {
+        ReadsMemory = 1, WritesMemory = 2
+    };
+    map<llvm::Function *, int> effects;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (llvm::Function & F: *module) {
+            if (F.isDeclaration())
+                continue;
+            int effect = 0;
+            for (llvm::Instruction & I: llvm::instructions(F)) {
+                if (auto call = llvm::dyn_cast<llvm::CallInst>(&I)) {
+                    llvm::Function * callee = call->getCalledFunction();
+                    if (callee && !callee->isDeclaration())
+                        effect |= effects[callee];
+                    else if (!callee || !callee->doesNotAccessMemory())
+                        effect |= callee && callee->onlyReadsMemory() ? ReadsMemory : ReadsMemory | WritesMemory;
+                } else if (auto load = llvm::dyn_cast<llvm::LoadInst>(&I)) {
+                    if (!llvm::isa<llvm::AllocaInst>(getBaseObject(load->getPointerOperand())))
+                        effect |= ReadsMemory;
+                } else if (auto store = llvm::dyn_cast<llvm::StoreInst>(&I)) {
+                    if (!llvm::isa<llvm::AllocaInst>(getBaseObject(store->getPointerOperand())))
+                        effect |= WritesMemory;
+                } else {
+                    if (I.mayReadFromMemory())
+                        effect |= ReadsMemory;
+                    if (I.mayWriteToMemory())
+                        effect |= WritesMemory;
+                }
+            }
+            if (effect != effects[&F]) {
+                effects[&F] = effect;
+                changed = true;
+            }
+        }
+    }
+
+    for (llvm::Function & F: *module) {
+        if (F.isDeclaration())
+            continue;
+//mila has no exceptions and runtime does not throw
+        F.addFnAttr(llvm::Attribute::NoUnwind);
+        if (!mayRecurse(&F))
+            F.addFnAttr(llvm::Attribute::NoRecurse);
+        if (effects[&F] == 0)
+            F.addFnAttr(llvm::Attribute::ReadNone);
+        else if (effects[&F] == ReadsMemory)
+            F.addFnAttr(llvm::Attribute::ReadOnly);
+    }
+}
+
+/**
+ * @brief Conditional branches of function in order of its blocks, counters of profile are matched to them by position
+ */
+static vector <llvm::BranchInst *> getConditionalBranches(llvm::Function & F) {
+    vector <llvm::BranchInst *> branches;
+    for (llvm::BasicBlock & BB: F)
+        if (auto branch = llvm::dyn_cast<llvm::BranchInst>(BB.getTerminator()))
+            if (branch->isConditional())
+                branches.push_back(branch);
+    return branches;
+}
+
+/**
+ * @brief FNV-1a hash of control flow graph of function, profile of function whose code changed is not used
+ */
+static uint64_t getCFGChecksum(llvm::Function & F) {
+    map <llvm::BasicBlock *, uint64_t> numbers;
+    for (llvm::BasicBlock & BB: F)
+        numbers.emplace(&BB, numbers.size());
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](uint64_t value) {
+        hash = (hash ^ value) * 1099511628211ull;
+    };
+    for (llvm::BasicBlock & BB: F) {
+        llvm::Instruction * terminator = BB.getTerminator();
+        mix(terminator->getNumSuccessors());
+        for (unsigned i = 0; i < terminator->getNumSuccessors(); ++i)
+            mix(numbers[terminator->getSuccessor(i)]);
+    }
+    return hash;
+}
+
+void Program::addBranchCounters(shared_ptr <llvm::Module> module) {
+    llvm::LLVMContext & context = module->getContext();
+    llvm::IRBuilder<> builder(context);
+    llvm::Type * i64 = builder.getInt64Ty();
+    llvm::Type * text = builder.getInt8PtrTy();
+//record is the same as FunctionCounters of fce.c, counters are entry and then taken and not taken of every branch
+    llvm::StructType * recordType = llvm::StructType::get(context, {text, i64, i64, i64->getPointerTo()});
+    vector <llvm::Constant *> records;
+    vector <llvm::Function *> functions;
+    for (llvm::Function & F: *module) {
+        if (F.isDeclaration())
+            continue;
+        vector <llvm::BranchInst *> branches = getConditionalBranches(F);
+        llvm::ArrayType * countersType = llvm::ArrayType::get(i64, 1 + 2 * branches.size());
+        auto counters = new llvm::GlobalVariable(*module, countersType, false, llvm::GlobalValue::InternalLinkage,
+                                                 llvm::ConstantAggregateZero::get(countersType),
+                                                 F.getName() + ".counters");
+        records.push_back(llvm::ConstantStruct::get(recordType, {
+                builder.CreateGlobalStringPtr(F.getName(), "", 0, module.get()), builder.getInt64(getCFGChecksum(F)),
+                builder.getInt64(countersType->getNumElements()),
+                llvm::ConstantExpr::getInBoundsGetElementPtr(countersType, counters, llvm::ArrayRef<llvm::Constant *>{
+                        builder.getInt32(0), builder.getInt32(0)})}));
+        functions.push_back(&F);
+        auto count = [&](llvm::Value * index) {
+            llvm::Value * counter = builder.CreateInBoundsGEP(countersType, counters, {builder.getInt32(0), index});
+            builder.CreateStore(builder.CreateAdd(builder.CreateLoad(i64, counter), builder.getInt64(1)), counter);
+        };
+        auto body = F.getEntryBlock().begin();
+        while (llvm::isa<llvm::AllocaInst>(*body))
+            ++body;
+        builder.SetInsertPoint(&*body);
+        count(builder.getInt32(0));
+        for (size_t i = 0; i < branches.size(); ++i) {
+            builder.SetInsertPoint(branches[i]);
+            count(builder.CreateSelect(branches[i]->getCondition(), builder.getInt32(1 + 2 * i),
+                                       builder.getInt32(2 + 2 * i)));
+        }
+    }
+    llvm::ArrayType * tableType = llvm::ArrayType::get(recordType, records.size());
+    auto table = new llvm::GlobalVariable(*module, tableType, false, llvm::GlobalValue::InternalLinkage,
+                                          llvm::ConstantArray::get(tableType, records), "mila.counters");
+    llvm::Function * main = module->getFunction("main");
+    if (!main || main->isDeclaration())
+        return;
+    auto body = main->getEntryBlock().begin();
+    while (llvm::isa<llvm::AllocaInst>(*body))
+        ++body;
+    builder.SetInsertPoint(&*body);
+    llvm::FunctionCallee registerCounters = module->getOrInsertFunction(
+            "countersRegister", builder.getVoidTy(), text, builder.getInt32Ty());
+    builder.CreateCall(registerCounters, {builder.CreateBitCast(table, text), builder.getInt32(records.size())});
+}
+
+void Program::applyProfile(shared_ptr <llvm::Module> module) {
+//RAW PROFILES - header line, then name, checksum and number of counters of every function followed by the counters
+    map <string, pair<uint64_t, vector<uint64_t>>> profile;
+    set <string> otherSizes;    // functions with records of another number of counters than they have
+    for (auto & file: profileUse) {
+        ifstream in(file);
+        string header;
+        if (!getline(in, header) || header != "mila raw profile 1")
+            throw invalid_argument("Can not read profile \"" + file + "\"\n");
+        string name;
+        uint64_t checksum;
+        size_t size;
+        while (in >> name >> checksum >> size) {
+//size comes from the file, counters are only stored for a function of the module with that many of them
+            llvm::Function * F = module->getFunction(name);
+            bool sized = F && !F->isDeclaration() && size == 1 + 2 * getConditionalBranches(*F).size();
+            vector <uint64_t> counts(sized ? size : 0);
+            for (auto & count: counts)
+                in >> count;
+            uint64_t skipped;
+            for (size_t i = 0; !sized && i < size && in >> skipped; ++i);
+            if (!in)
+                throw invalid_argument("Profile \"" + file + "\" is truncated or malformed\n");
+            if (!sized) {
+                otherSizes.insert(name);
+                continue;
+            }
+            auto known = profile.find(name);
+            if (known == profile.end())
+                profile[name] = {checksum, counts};
+            else if (known->second.first == checksum && known->second.second.size() == size)
+                for (size_t i = 0; i < size; ++i)
+                    known->second.second[i] += counts[i];
+        }
+        if (!in.eof())
+            throw invalid_argument("Can not read profile \"" + file + "\"\n");
+    }
+
+//weights replace the ones of array checks, branches which never ran keep theirs
+    llvm::LLVMContext & context = module->getContext();
+    llvm::MDBuilder weights(context);
+    llvm::InstrProfSummaryBuilder summary(llvm::ProfileSummaryBuilder::DefaultCutoffs);
+    for (llvm::Function & F: *module) {
+        auto found = profile.find(F.getName().str());
+        if (!F.isDeclaration() && found == profile.end() && otherSizes.count(F.getName().str()))
+            profileMismatches.push_back(F.getName().str());
+        if (F.isDeclaration() || found == profile.end())
+            continue;
+        vector <llvm::BranchInst *> branches = getConditionalBranches(F);
+        const vector <uint64_t> & counts = found->second.second;
+        if (found->second.first != getCFGChecksum(F) || counts.size() != 1 + 2 * branches.size()) {
+            profileMismatches.push_back(F.getName().str());
+            continue;
+        }
+        F.setEntryCount(counts[0]);
+        summary.addRecord(llvm::InstrProfRecord(counts));
+        for (size_t i = 0; i < branches.size(); ++i) {
+            uint64_t taken = counts[1 + 2 * i], notTaken = counts[2 + 2 * i];
+            if (!taken && !notTaken)
+                continue;
+//weights are 32 bit
+            uint64_t scale = max(taken, notTaken) / UINT32_MAX + 1;
+            branches[i]->setMetadata(llvm::LLVMContext::MD_prof,
+                                     weights.createBranchWeights(taken / scale, notTaken / scale));
+        }
+    }
+    module->setProfileSummary(summary.getSummary()->getMD(context), llvm::ProfileSummary::PSK_Instr);
+}
+
+void Program::instrumentFunctions(shared_ptr <llvm::Module> module) {
+    llvm::LLVMContext & context = module->getContext();
+    llvm::IRBuilder<> builder(context);
+    llvm::Type * i64 = builder.getInt64Ty();
+    llvm::Type * text = builder.getInt8PtrTy();
+//records are the same as FunctionProfile and LoopProfile of fce.c
+    llvm::StructType * functionType = llvm::StructType::get(context, {text, i64, i64, i64, i64});
+    llvm::StructType * loopType = llvm::StructType::get(context, {text, text, i64, i64});
+
+    vector <llvm::Function *> functions;
+    vector <llvm::Constant *> functionRecords;
+    for (llvm::Function & F: *module)
+        if (!F.isDeclaration()) {
+            functions.push_back(&F);
+            llvm::Constant * zero = builder.getInt64(0);
+            functionRecords.push_back(llvm::ConstantStruct::get(functionType, {
+                    builder.CreateGlobalStringPtr(F.getName(), "", 0, module.get()), zero, zero, zero, zero}));
+        }
+    llvm::ArrayType * functionsType = llvm::ArrayType::get(functionType, functions.size());
+    auto functionTable = new llvm::GlobalVariable(*module, functionsType, false, llvm::GlobalValue::InternalLinkage,
+                                                  llvm::ConstantArray::get(functionsType, functionRecords),
+                                                  "mila.profile.functions");
+
+//LOOPS - counters of loops in functions which are still there move to records, numbered in every function from 1
+    vector <llvm::Constant *> loopRecords;
+    vector <llvm::GlobalVariable *> counters;
+    map <string, int> loopNumbers;
+    for (auto & loop: loopCounters) {
+        if (loop.counter->use_empty()) {
+            loop.counter->eraseFromParent();
+            continue;
+        }
+        loopRecords.push_back(llvm::ConstantStruct::get(loopType, {
+                builder.CreateGlobalStringPtr(loop.function, "", 0, module.get()),
+                builder.CreateGlobalStringPtr(loop.kind, "", 0, module.get()),
+                builder.getInt64(++loopNumbers[loop.function]), builder.getInt64(0)}));
+        counters.push_back(loop.counter);
+    }
+    loopCounters.clear();
+    llvm::ArrayType * loopsType = llvm::ArrayType::get(loopType, loopRecords.size());
+    auto loopTable = new llvm::GlobalVariable(*module, loopsType, false, llvm::GlobalValue::InternalLinkage,
+                                              llvm::ConstantArray::get(loopsType, loopRecords), "mila.profile.loops");
+    auto field = [&](llvm::GlobalVariable * table, size_t record, int index) {
+        return llvm::ConstantExpr::getInBoundsGetElementPtr(table->getValueType(), table, llvm::ArrayRef<llvm::Constant *>{
+                builder.getInt32(0), builder.getInt32(record), builder.getInt32(index)});
+    };
+    for (size_t i = 0; i < counters.size(); ++i) {
+        counters[i]->replaceAllUsesWith(field(loopTable, i, 3));
+        counters[i]->eraseFromParent();
+    }
+
+//FUNCTIONS - cycles of callees are summed to children, exclusive time of a call is its time without them. Inclusive
+// time is added only when the outermost active call of function returns, so recursion does not count it twice
+    auto children = new llvm::GlobalVariable(*module, i64, false, llvm::GlobalValue::InternalLinkage,
+                                             builder.getInt64(0), "mila.profile.children");
+    llvm::Function * readCycles = llvm::Intrinsic::getDeclaration(module.get(), llvm::Intrinsic::readcyclecounter);
+    auto add = [&](llvm::Value * address, llvm::Value * value) {
+        llvm::Value * sum = builder.CreateAdd(builder.CreateLoad(i64, address), value);
+        builder.CreateStore(sum, address);
+        return sum;
+    };
+    for (size_t i = 0; i < functions.size(); ++i) {
+        llvm::Function * F = functions[i];
+        vector <llvm::ReturnInst *> returns;
+        for (llvm::BasicBlock & BB: *F)
+            if (auto ret = llvm::dyn_cast<llvm::ReturnInst>(BB.getTerminator()))
+                returns.push_back(ret);
+
+//ENTRY - after allocas, tail calls turned to loops jump back behind it
+        auto body = F->getEntryBlock().begin();
+        while (llvm::isa<llvm::AllocaInst>(*body))
+            ++body;
+        builder.SetInsertPoint(&*body);
+        if (F->getName() == "main") {
+            llvm::FunctionCallee registerProfile = module->getOrInsertFunction(
+                    "profileRegister", builder.getVoidTy(), text, builder.getInt32Ty(), text, builder.getInt32Ty());
+            builder.CreateCall(registerProfile, {
+                    builder.CreateBitCast(functionTable, text), builder.getInt32(functions.size()),
+                    builder.CreateBitCast(loopTable, text), builder.getInt32(loopRecords.size())});
+        }
+        add(field(functionTable, i, 1), builder.getInt64(1));
+        add(field(functionTable, i, 4), builder.getInt64(1));
+        llvm::Value * start = builder.CreateCall(readCycles, {}, "profile_start");
+        llvm::Value * outerChildren = builder.CreateLoad(i64, children, "profile_children");
+        builder.CreateStore(builder.getInt64(0), children);
+
+//EXIT - before every return, musttail call has to stay right before its return, so its callee is not counted
+        for (llvm::ReturnInst * ret: returns) {
+            llvm::Instruction * exit = ret;
+            if (auto call = llvm::dyn_cast_or_null<llvm::CallInst>(ret->getPrevNode()))
+                if (call->isMustTailCall())
+                    exit = call;
+            builder.SetInsertPoint(exit);
+            llvm::Value * elapsed = builder.CreateSub(builder.CreateCall(readCycles, {}), start, "profile_elapsed");
+            add(field(functionTable, i, 3), builder.CreateSub(elapsed, builder.CreateLoad(i64, children)));
+            llvm::Value * active = add(field(functionTable, i, 4), builder.getInt64(-1));
+            add(field(functionTable, i, 2), builder.CreateSelect(builder.CreateICmpEQ(active, builder.getInt64(0)),
+                                                                 elapsed, builder.getInt64(0)));
+            builder.CreateStore(builder.CreateAdd(outerChildren, elapsed), children);
+        }
+    }
+}
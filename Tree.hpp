@@ -6,11 +6,14 @@
 #define MILA_TREE_HPP
 
 #include "Lexer.hpp"
+#include "SSABuilder.hpp"
+#include "Bytecode.hpp"
 #include <llvm/IR/Value.h>
 #include "llvm/ADT/APFloat.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
@@ -21,27 +24,158 @@
 #include "llvm/IR/Instructions.h"
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/GenericValue.h>
-#include <llvm-10/llvm/IR/IRBuilder.h>
-#include <llvm-10/llvm/IR/BasicBlock.h>
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/raw_ostream.h"
-#include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/ADT/IndexedMap.h"
 
+class Type;
+class Function;
+
 static map<string, llvm::Value *> NamedConsts;
 static map<string, llvm::Value *> NamedVars;
-static map <string, pair<int, int>> arrayBounds;
+static map <string, shared_ptr<Type>> arrayTypes;  // declared types of array variables, they give bounds of indexes
 static bool exited = false;
 static bool breaked = false;
 static llvm::BasicBlock * whereBreak = nullptr;
 static llvm::BasicBlock * whereContinue = nullptr;
-static llvm::Value * strFormat = nullptr;
-static llvm::Value * strFormatNl = nullptr;
+static map<string, llvm::Value *> stringConstants;  // texts of write and writeln, each one is in module once
+static map<string, int> NamedSSAVars;   // scalar locals kept in registers, see SSABuilder
+static set<string> addressTakenVars;    // locals of current function which have to stay in memory
+static SSABuilder ssaBuilder;
+static map<string, llvm::Value *> openArrayHighs;  // hidden high bound parameters of open arrays
+static set<string> constVars;                      // const parameters, they can not be modified
+static set<string> pureFunctions;                  // functions declared pure, their calls are memoized
+static map<string, Function *> functionBodies;     // functions defined so far, calls of them can be evaluated
+
+// array accesses indexed by for loop variable, their range check is done once before the loop
+struct HoistedChecks {
+    set <tuple<int, llvm::Value *, int>> accesses;  // bounds of indexed dimension and constant added to loop variable
+    int count = 0;                      // accesses generated without check
+};
+static map<string, HoistedChecks *> hoistedChecks;  // loop variables of for loops being versioned
+
+// build SSA form directly instead of storing scalar locals to allocas, set by --ssa
+extern bool directSSA;
+
+// check array indexes against declared bounds, set by --array-checks
+extern bool arrayChecks;
+
+// names of LLVM values other than globals are not kept, set by --discard-value-names
+extern bool discardValueNames;
+
+// program is closed world around main, functions are internal and fastcc, set by --whole-program
+extern bool wholeProgram;
+
+// runtime (fce.c) is linked into module from bitcode embedded in compiler, set by --link-runtime
+extern bool linkRuntime;
+
+// entry counters and cycle timers of functions and iteration counters of loops, set by --instrument
+extern bool instrument;
+
+// iteration counter of loop generated with --instrument, counters get their place in the profile table at the end
+struct LoopCounter {
+    llvm::GlobalVariable * counter;
+    string function;
+    string kind;    // "for" with loop variable or "while"
+};
+static vector <LoopCounter> loopCounters;
+
+// DWARF line table, subprograms and variables of program, so debuggers and profilers map code to source lines, set
+// by -g; compile unit names the program sourceName
+extern bool debugInfo;
+extern string sourceName;
+
+// positions of statements and subprograms without types and variables, the compile unit emits no DWARF; optimization
+// remarks get source lines from them without -g
+extern bool debugLocations;
+
+// loop of program with its lines, recorded while positions are tracked, remarks of optimizations are summarized by
+// the innermost loop containing their line
+struct SourceLoop {
+    string function;
+    string kind;    // "for" with loop variable or "while"
+    int line;
+    int endLine;    // line of end of its block
+};
+extern vector <SourceLoop> sourceLoops;
+
+// counters of function entries and both edges of conditional branches written as raw profile by the program, set by
+// --profile-generate
+extern bool profileGenerate;
+
+// raw profiles which give branch weights and entry counts, counts of several files are summed, set by --profile-use;
+// functions whose code does not match their profile are listed in profileMismatches
+extern vector <string> profileUse;
+extern vector <string> profileMismatches;
+
+// memo tables of pure functions, direct mapped with memoSize slots, set by --memo-size and --memo-eviction
+enum class MemoEviction {
+    Replace,    // new result replaces the one in its slot
+    Keep        // results are stored only to empty slots
+};
+extern int memoSize;
+extern MemoEviction memoEviction;
+
+// value computed at compile time, booleans are 0 or 1
+struct ConstValue {
+    int value;
+    bool boolean;
+};
+
+// compile time interpreter of function bodies, calls with constant arguments are replaced by their results
+struct Interpreter {
+    vector <map<string, ConstValue>> frames;   // variables of called functions, innermost last
+    string failure;                            // why evaluation gave up, the innermost reason
+    enum class Flow {
+        Next, Exit, Break, Continue
+    } flow = Flow::Next;
+
+    // statement, loop iteration or call, false when the fuel of the whole program is spent
+    bool step();
+
+    // gives up evaluation for the reason unless an inner one is known, always false
+    bool fail(const string & reason);
+};
+const size_t interpreterMaxDepth = 100;
+const int interpreterFuel = 1000000;   // steps of all evaluations of a program together, not per call site
+extern int interpreterFuelLeft;
+
+// calls with constant arguments of functions defined before them are evaluated at compile time, off by --no-fold
+extern bool foldCalls;
+extern vector <string> foldedCalls;
+extern vector <string> rejectedCalls;  // calls with constant arguments left to runtime, with the reason
+
+// calls in tail position, self calls become loops and the rest are emitted as tail calls
+struct TailCall {
+    string caller;
+    string callee;
+    string kind;    // loop, musttail or tail
+};
+extern vector <TailCall> tailCalls;
+
+// where local arrays larger than largeLocalArraySize bytes are stored, set by --local-arrays
+enum class LocalArrays {
+    Stack,  // stack frame of the function, like every other local
+    Static  // zero-initialized static storage in .bss, functions which may recurse keep them in stack frame
+};
+extern LocalArrays localArrays;
+const uint64_t largeLocalArraySize = 64 * 1024;
+// integers and booleans of an array, high bound of open array and addresses of the VM are integers
+const int64_t maxArrayScalars = INT32_MAX;
+static map<llvm::GlobalVariable *, llvm::Function *> staticLocals;  // large local arrays placed in static storage
+
+struct ArrayCheckStats {
+    int inserted = 0;   // checks left in code
+    int removed = 0;    // checks proven unnecessary at compile time
+    int hoisted = 0;    // checks replaced by loop pre-check
+    int preChecks = 0;  // loops versioned by pre-check
+};
+extern ArrayCheckStats arrayCheckStats;
 
 class UnknownVarException : public exception {
     string varName;
@@ -66,6 +200,11 @@ public:
     virtual llvm::Type * getLLVMType(shared_ptr <llvm::IRBuilder<>> builder) = 0;
 
     virtual llvm::Constant * getInitConstant(shared_ptr <llvm::IRBuilder<>> builder) = 0;
+
+    // number of integers or booleans the type consists of
+    virtual int64_t getScalarCount() const { return 1; }
+
+    virtual llvm::DIType * getDebugType(llvm::DIBuilder & debugBuilder) = 0;
 };
 
 class Integer : public Type {
@@ -73,6 +212,17 @@ public:
     llvm::Type * getLLVMType(shared_ptr <llvm::IRBuilder<>> builder) override;
 
     llvm::Constant * getInitConstant(shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    llvm::DIType * getDebugType(llvm::DIBuilder & debugBuilder) override;
+};
+
+class Boolean : public Type {
+public:
+    llvm::Type * getLLVMType(shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    llvm::Constant * getInitConstant(shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    llvm::DIType * getDebugType(llvm::DIBuilder & debugBuilder) override;
 };
 
 class Array : public Type {
@@ -86,24 +236,91 @@ public:
 
     llvm::Constant * getInitConstant(shared_ptr <llvm::IRBuilder<>> builder) override;
 
+    int64_t getScalarCount() const override;
+
+    llvm::DIType * getDebugType(llvm::DIBuilder & debugBuilder) override;
+
     int getMinIndex() const;
 
     int getMaxIndex() const;
+
+    shared_ptr <Type> getElementType() const;
+};
+
+// array parameter without bounds, indexed from 0, high bound is passed as hidden parameter
+class OpenArray : public Type {
+    shared_ptr <Type> type;
+public:
+    OpenArray(shared_ptr <Type> type);
+
+    llvm::Type * getLLVMType(shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    llvm::Constant * getInitConstant(shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    // bounds are not known, debuggers show it as array of unknown size
+    llvm::DIType * getDebugType(llvm::DIBuilder & debugBuilder) override;
+
+    shared_ptr <Type> getElementType() const;
+};
+
+// how parameter is passed, var and const parameters are passed by reference
+enum class ParamMode {
+    Value,
+    Var,
+    Const
 };
 
 class Node {
 public:
+    // token the construct starts with, set by parser for statements, declarations and identifiers
+    SourceLocation location;
+
+    // collect names of variables whose address is needed (readln, dec, var and const parameters), module is nullptr
+    // when compiling to bytecode
+    virtual void collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const {}
 
+    // collect names of variables assigned by := statements
+    virtual void collectAssigned(set <string> & names) const {}
 };
 
 class Statement : public Node {
 public:
     virtual void translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) = 0;
+
+    // run statement at compile time, false when it does anything but computing with local variables
+    virtual bool execute(Interpreter & interpreter) { return false; }
+
+    virtual void compileBytecode(BytecodeCompiler & compiler) = 0;
 };
 
 class Expression : public Node {
 public:
     virtual llvm::Value * getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) = 0;
+
+    // type of value without generating any code, i1 for boolean expressions
+    virtual llvm::Type * getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) = 0;
+
+    // branch to trueBB or falseBB depending on value of expression used as condition
+    virtual void createCondBr(llvm::BasicBlock * trueBB, llvm::BasicBlock * falseBB, shared_ptr <llvm::Module> module,
+                              shared_ptr <llvm::IRBuilder<>> builder);
+
+    // number or named constant
+    virtual bool getConstValue(int & value) { return false; }
+
+    // variable plus or minus constant
+    virtual bool getVarOffset(string & var, int & offset) { return false; }
+
+    // value at compile time, false when it depends on anything but constants and local variables
+    virtual bool evaluate(Interpreter & interpreter, ConstValue & value) { return false; }
+
+    // register with value of expression
+    virtual int compileBytecode(BytecodeCompiler & compiler) = 0;
+
+    // declared type in bytecode compiler scope, nullptr for strings and procedures
+    virtual shared_ptr <Type> getBytecodeType(BytecodeCompiler & compiler) = 0;
+
+    // jumps added to jumps are taken when value of condition is when, otherwise code falls through
+    virtual void compileBranch(BytecodeCompiler & compiler, bool when, vector <int> & jumps);
 };
 
 class Number : public Expression {
@@ -115,7 +332,35 @@ public:
 
     llvm::Value * getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
 
+    llvm::Type * getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    bool getConstValue(int & value) override;
+
+    bool evaluate(Interpreter & interpreter, ConstValue & value) override;
+
     void neg();
+
+    int compileBytecode(BytecodeCompiler & compiler) override;
+
+    shared_ptr <Type> getBytecodeType(BytecodeCompiler & compiler) override;
+};
+
+// integer generated already, builtins lowered to other nodes pass their arguments this way to evaluate them once
+class LoweredValue : public Expression {
+    llvm::Value * value = nullptr;
+    int reg = -1;
+public:
+    LoweredValue(llvm::Value * value);
+
+    LoweredValue(int reg);
+
+    llvm::Value * getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    llvm::Type * getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    int compileBytecode(BytecodeCompiler & compiler) override;
+
+    shared_ptr <Type> getBytecodeType(BytecodeCompiler & compiler) override;
 };
 
 class String : public Expression {
@@ -126,28 +371,60 @@ public:
     string getValue() const;
 
     llvm::Value * getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    llvm::Type * getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    int compileBytecode(BytecodeCompiler & compiler) override;
+
+    shared_ptr <Type> getBytecodeType(BytecodeCompiler & compiler) override;
 };
 
 class Block : public Statement {
     vector <shared_ptr<Statement>> statements;
 public:
+    SourceLocation end;     // position of its end, unknown for blocks without begin .. end
+
     Block(vector <shared_ptr<Statement>> statements);
 
     void translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    bool execute(Interpreter & interpreter) override;
+
+    void collectAssigned(set <string> & names) const override;
+
+    void collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const override;
+
+    void compileBytecode(BytecodeCompiler & compiler) override;
 };
 
 class Var : public Statement {
     string name;
     shared_ptr <Type> type;
     bool global;
+    ParamMode mode;
+    unsigned argNo = 0;     // parameter number in debug info, 0 for variables
+
+    // variable of debug info with -g, storage is alloca, global or null for variable of SSABuilder
+    void describe(llvm::Value * storage, shared_ptr <llvm::IRBuilder<>> builder);
 public:
-    Var(string name, shared_ptr <Type> type, bool global);
+    Var(string name, shared_ptr <Type> type, bool global, ParamMode mode = ParamMode::Value);
 
     shared_ptr <Type> getType() const;
 
     string getName() const;
 
+    ParamMode getMode() const;
+
+    // parameter is passed as pointer to variable of caller
+    bool isReference() const;
+
     void translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    // declare parameter and bind it to argument(s) of current function, arg is moved past them
+    void bindArgument(llvm::Function::arg_iterator & arg, shared_ptr <llvm::Module> module,
+                      shared_ptr <llvm::IRBuilder<>> builder);
+
+    void compileBytecode(BytecodeCompiler & compiler) override;
 };
 
 class Const : public Statement {
@@ -157,6 +434,8 @@ public:
     Const(string name, int value);
 
     void translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    void compileBytecode(BytecodeCompiler & compiler) override;
 };
 
 class Special : public Statement {
@@ -165,16 +444,40 @@ public:
     Special(Token token);
 
     void translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    bool execute(Interpreter & interpreter) override;
+
+    void compileBytecode(BytecodeCompiler & compiler) override;
 };
 
 class BinOp : public Expression {
     int token;
     shared_ptr <Expression> left;
     shared_ptr <Expression> right;
+
+    // and/or of two boolean operands, right operand is evaluated only when needed
+    bool isShortCircuit(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder);
 public:
     BinOp(int token, shared_ptr <Expression> left, shared_ptr <Expression> right);
 
     llvm::Value * getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    llvm::Type * getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    void createCondBr(llvm::BasicBlock * trueBB, llvm::BasicBlock * falseBB, shared_ptr <llvm::Module> module,
+                      shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    bool getVarOffset(string & var, int & offset) override;
+
+    bool evaluate(Interpreter & interpreter, ConstValue & value) override;
+
+    void collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const override;
+
+    int compileBytecode(BytecodeCompiler & compiler) override;
+
+    shared_ptr <Type> getBytecodeType(BytecodeCompiler & compiler) override;
+
+    void compileBranch(BytecodeCompiler & compiler, bool when, vector <int> & jumps) override;
 };
 
 class UnOp : public Expression {
@@ -184,6 +487,21 @@ public:
     UnOp(int token, shared_ptr <Expression> expr);
 
     llvm::Value * getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    llvm::Type * getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    bool evaluate(Interpreter & interpreter, ConstValue & value) override;
+
+    void createCondBr(llvm::BasicBlock * trueBB, llvm::BasicBlock * falseBB, shared_ptr <llvm::Module> module,
+                      shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    void collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const override;
+
+    int compileBytecode(BytecodeCompiler & compiler) override;
+
+    shared_ptr <Type> getBytecodeType(BytecodeCompiler & compiler) override;
+
+    void compileBranch(BytecodeCompiler & compiler, bool when, vector <int> & jumps) override;
 };
 
 class Reference : public Expression {
@@ -197,6 +515,14 @@ public:
     string getName() const;
 
     virtual llvm::Value * getLLVMAddress(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) = 0;
+
+    // declared type when the referenced value is an array, nullptr otherwise
+    virtual shared_ptr <Type> getArrayType() const;
+
+    virtual void setLLVMValue(llvm::Value * value, shared_ptr <llvm::Module> module,
+                              shared_ptr <llvm::IRBuilder<>> builder);
+
+    virtual Place compilePlace(BytecodeCompiler & compiler) = 0;
 };
 
 class VarReference : public Reference {
@@ -205,18 +531,63 @@ public:
 
     llvm::Value * getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
 
+    llvm::Type * getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    bool getConstValue(int & value) override;
+
+    bool evaluate(Interpreter & interpreter, ConstValue & value) override;
+
+    bool getVarOffset(string & var, int & offset) override;
+
     llvm::Value * getLLVMAddress(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    shared_ptr <Type> getArrayType() const override;
+
+    void setLLVMValue(llvm::Value * value, shared_ptr <llvm::Module> module,
+                      shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    int compileBytecode(BytecodeCompiler & compiler) override;
+
+    shared_ptr <Type> getBytecodeType(BytecodeCompiler & compiler) override;
+
+    Place compilePlace(BytecodeCompiler & compiler) override;
 };
 
 class ArrayItemReference : public Reference {
     shared_ptr <Reference> var;
     shared_ptr <Expression> index;
+
+    // bounds of the dimension indexed by this reference
+    void getBounds(int & low, llvm::Value *& high, shared_ptr <llvm::IRBuilder<>> builder) const;
+
+    // range check of index, skipped when proven or hoisted to loop pre-check
+    void createRangeCheck(llvm::Value * idx, shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder);
+
+    // array addressed by the whole chain of indexes, offset of the item in scalars is accumulated in 64 bits without
+    // lower bounds
+    llvm::Value * getItemOffset(llvm::Value *& offset, int64_t & adjustment, shared_ptr <llvm::Module> module,
+                                shared_ptr <llvm::IRBuilder<>> builder);
+
+    // bytecode counterpart of getItemOffset, offset is -1 while all indexes are constant
+    Place compileItem(BytecodeCompiler & compiler, int & offset, int & adjustment);
 public:
     ArrayItemReference(shared_ptr <Reference> var, shared_ptr <Expression> index);
 
     llvm::Value * getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
 
+    llvm::Type * getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
     llvm::Value * getLLVMAddress(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    shared_ptr <Type> getArrayType() const override;
+
+    void collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const override;
+
+    int compileBytecode(BytecodeCompiler & compiler) override;
+
+    shared_ptr <Type> getBytecodeType(BytecodeCompiler & compiler) override;
+
+    Place compilePlace(BytecodeCompiler & compiler) override;
 };
 
 class Assign : public Statement {
@@ -226,6 +597,14 @@ public:
     Assign(shared_ptr <Reference> left, shared_ptr <Expression> right);
 
     void translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    bool execute(Interpreter & interpreter) override;
+
+    void collectAssigned(set <string> & names) const override;
+
+    void collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const override;
+
+    void compileBytecode(BytecodeCompiler & compiler) override;
 };
 
 class For : public Statement {
@@ -234,11 +613,25 @@ class For : public Statement {
     shared_ptr <Expression> startExpr;
     shared_ptr <Expression> endExpr;
     const bool ascending;
+
+    // loop from current block to AfterBB running trips (i64) times, induction variable is already initialized,
+    // iterations are counted to counter of --instrument unless it is null
+    void translateLoop(llvm::Value * EnterCond, llvm::Value * trips, llvm::BasicBlock * AfterBB,
+                       llvm::GlobalVariable * iterations, shared_ptr <llvm::Module> module,
+                       shared_ptr <llvm::IRBuilder<>> builder);
 public:
     For(const string varName, shared_ptr <Block> block, shared_ptr <Expression> startExpr,
         shared_ptr <Expression> endExpr, const bool ascending);
 
     void translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    bool execute(Interpreter & interpreter) override;
+
+    void collectAssigned(set <string> & names) const override;
+
+    void collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const override;
+
+    void compileBytecode(BytecodeCompiler & compiler) override;
 };
 
 class While : public Statement {
@@ -248,6 +641,14 @@ public:
     While(shared_ptr <Block> block, shared_ptr <Expression> condition);
 
     void translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    bool execute(Interpreter & interpreter) override;
+
+    void collectAssigned(set <string> & names) const override;
+
+    void collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const override;
+
+    void compileBytecode(BytecodeCompiler & compiler) override;
 };
 
 class If : public Statement {
@@ -258,15 +659,36 @@ public:
     If(shared_ptr <Block> ifBlock, shared_ptr <Block> elseBlock, shared_ptr <Expression> condition);
 
     void translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    bool execute(Interpreter & interpreter) override;
+
+    void collectAssigned(set <string> & names) const override;
+
+    void collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const override;
+
+    void compileBytecode(BytecodeCompiler & compiler) override;
 };
 
 class FunctionCall : public Expression {
     string name;
     vector <shared_ptr<Expression>> params;
+
+    // readarray(a, low, high), items low .. high of array of integers are read by one call of runtime
+    void readArray(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder);
 public:
     FunctionCall(string name, vector <shared_ptr<Expression>> params);
 
     llvm::Value * getLLVMValue(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    llvm::Type * getLLVMType(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    bool evaluate(Interpreter & interpreter, ConstValue & value) override;
+
+    void collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const override;
+
+    int compileBytecode(BytecodeCompiler & compiler) override;
+
+    shared_ptr <Type> getBytecodeType(BytecodeCompiler & compiler) override;
 };
 
 class ProcedureCall : public Statement {
@@ -276,6 +698,10 @@ public:
     ProcedureCall(string name, vector <shared_ptr<Expression>> params);
 
     void translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    void collectAddressTaken(set <string> & names, shared_ptr <llvm::Module> module) const override;
+
+    void compileBytecode(BytecodeCompiler & compiler) override;
 };
 
 class Function : public Statement {
@@ -284,13 +710,33 @@ class Function : public Statement {
     shared_ptr <Type> returnType;
     shared_ptr <Block> block;
     vector <shared_ptr<Var>> localVars;
+    bool pure;
+
+    // result depends only on integer arguments, no global variables, input or output and only pure callees
+    void checkPurity(llvm::Function * F) const;
 public:
     Function(string name, vector <shared_ptr<Var>> params, shared_ptr <Type> returnType, shared_ptr <Block> block,
-             vector <shared_ptr<Var>> localVars);
+             vector <shared_ptr<Var>> localVars, bool pure = false);
+
+    // body is no longer available for evaluation of calls
+    ~Function();
 
     void translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
 
     void initFunction(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder);
+
+    // body exists and has only scalar parameters, result and local variables, so calls may be evaluated
+    bool canBeInterpreted() const;
+
+    // body is kept by --stream for evaluation of later calls: it can be interpreted and its lowered code uses no global
+    // variables and calls only itself, kept functions and forward declared ones; otherwise the reason is recorded and
+    // calls report it
+    bool keepForFolding(shared_ptr <llvm::Module> module);
+
+    // run body at compile time, false when the call can not be evaluated
+    bool call(Interpreter & interpreter, const vector <ConstValue> & args, ConstValue & result);
+
+    void compileBytecode(BytecodeCompiler & compiler) override;
 };
 
 class Procedure : public Statement {
@@ -305,6 +751,8 @@ public:
     void translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
 
     void initProcedure(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder);
+
+    void compileBytecode(BytecodeCompiler & compiler) override;
 };
 
 class Program : public Statement {
@@ -312,6 +760,37 @@ public:
     void initFunctions(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder);
 
     void translateToLLVM(shared_ptr <llvm::Module> module, shared_ptr <llvm::IRBuilder<>> builder) override;
+
+    // moves static local arrays of functions which may call themselves back to their stack frame
+    void demoteRecursiveStaticLocals(shared_ptr <llvm::Module> module);
+
+    // adds noalias to reference parameters which are never passed memory the callee can reach otherwise
+    void markNoAliasParams(shared_ptr <llvm::Module> module);
+
+    // self calls in tail position become loops, other calls in tail position are marked musttail or tail
+    void eliminateTailCalls(shared_ptr <llvm::Module> module);
+
+    // functions except main become internal fastcc, functions main can not reach are removed
+    void internalizeFunctions(shared_ptr <llvm::Module> module);
+
+    // nounwind, norecurse and readnone/readonly of functions defined in program
+    void inferFunctionAttributes(shared_ptr <llvm::Module> module);
+
+    // counters of entry and both edges of every conditional branch of functions defined in program, main registers them
+    // in runtime which writes them as raw profile at exit
+    void addBranchCounters(shared_ptr <llvm::Module> module);
+
+    // branch weights, entry counts and profile summary from raw profiles of --profile-use
+    void applyProfile(shared_ptr <llvm::Module> module);
+
+    // entry counters and cycle timers of functions defined in program, their records and records of loop counters
+    // form the profile table which main registers in runtime
+    void instrumentFunctions(shared_ptr <llvm::Module> module);
+
+    // subprograms get lists of their variables, debug info is complete
+    void finishDebugInfo(shared_ptr <llvm::Module> module);
+
+    void compileBytecode(BytecodeCompiler & compiler) override;
 };
 
 #endif //MILA_TREE_HPP
@@ -1,17 +1,895 @@
+// runtime of compiled programs. It is built on C library by default. With MILA_FREESTANDING it is the whole
+// environment of a statically linked program instead: Linux system calls, _start, thread local storage of memo tables
+// and the memory functions which compiled code may call
+#ifdef MILA_FREESTANDING
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__)
+#define SYSTEM_READ 0
+#define SYSTEM_WRITE 1
+#define SYSTEM_CLOSE 3
+#define SYSTEM_LSEEK 8
+#define SYSTEM_MMAP 9
+#define SYSTEM_MADVISE 28
+#define SYSTEM_ARCH_PRCTL 158
+#define SYSTEM_EXIT_GROUP 231
+#define SYSTEM_OPENAT 257
+#define ARCH_SET_FS 0x1002
+
+static long systemCall(long number, long a, long b, long c, long d, long e, long f) {
+    register long r10 __asm__("r10") = d;
+    register long r8 __asm__("r8") = e;
+    register long r9 __asm__("r9") = f;
+    long result;
+    __asm__ volatile("syscall" : "=a"(result) : "a"(number), "D"(a), "S"(b), "d"(c), "r"(r10), "r"(r8), "r"(r9)
+                     : "rcx", "r11", "memory");
+    return result;
+}
+
+// stack of the program starts with argc, argv, environment and auxiliary vector, it is aligned to 16 bytes already
+__asm__(".text\n"
+        ".global _start\n"
+        ".type _start, @function\n"
+        "_start:\n"
+        "    xor %ebp, %ebp\n"
+        "    mov %rsp, %rdi\n"
+        "    and $-16, %rsp\n"
+        "    call startProgram\n"
+        "    hlt\n");
+#elif defined(__aarch64__)
+#define SYSTEM_OPENAT 56
+#define SYSTEM_CLOSE 57
+#define SYSTEM_LSEEK 62
+#define SYSTEM_READ 63
+#define SYSTEM_WRITE 64
+#define SYSTEM_EXIT_GROUP 94
+#define SYSTEM_MMAP 222
+#define SYSTEM_MADVISE 233
+
+static long systemCall(long number, long a, long b, long c, long d, long e, long f) {
+    register long x8 __asm__("x8") = number;
+    register long x0 __asm__("x0") = a;
+    register long x1 __asm__("x1") = b;
+    register long x2 __asm__("x2") = c;
+    register long x3 __asm__("x3") = d;
+    register long x4 __asm__("x4") = e;
+    register long x5 __asm__("x5") = f;
+    __asm__ volatile("svc 0" : "+r"(x0) : "r"(x8), "r"(x1), "r"(x2), "r"(x3), "r"(x4), "r"(x5) : "memory");
+    return x0;
+}
+
+__asm__(".text\n"
+        ".global _start\n"
+        ".type _start, %function\n"
+        "_start:\n"
+        "    mov x29, #0\n"
+        "    mov x30, #0\n"
+        "    mov x0, sp\n"
+        "    bl startProgram\n"
+        "    brk #0\n");
+#else
+#error "Freestanding runtime supports only Linux on x86_64 and aarch64"
+#endif
+
+#define EINTR 4
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+#define PROT_READ 1
+#define PROT_WRITE 2
+#define MAP_PRIVATE 2
+#define MAP_ANONYMOUS 0x20
+#define MADV_SEQUENTIAL 2
+#define AT_FDCWD (-100)
+#define O_WRONLY 1
+#define O_CREAT 0100
+#define O_TRUNC 01000
+
+// errors come back as -errno
+static int failed(long result) {
+    return (unsigned long) result > -4096ul;
+}
+
+// calls of these may be emitted by LLVM and C compilers even to freestanding code, loops of byte copies would be
+// turned to calls of the functions themselves
+void * memcpy(void * destination, const void * source, size_t size) {
+    void * result = destination;
+#if defined(__x86_64__)
+    __asm__ volatile("rep movsb" : "+D"(destination), "+S"(source), "+c"(size) : : "memory");
+#else
+    char * to = destination;
+    const char * from = source;
+    while (size--) {
+        *to++ = *from++;
+        __asm__ volatile("" : "+r"(to) : : "memory");
+    }
+#endif
+    return result;
+}
+
+void * memmove(void * destination, const void * source, size_t size) {
+    char * to = destination;
+    const char * from = source;
+    if (to <= from || to >= from + size)
+        return memcpy(destination, source, size);
+    while (size--) {
+        to[size] = from[size];
+        __asm__ volatile("" : "+r"(to) : : "memory");
+    }
+    return destination;
+}
+
+void * memset(void * destination, int c, size_t size) {
+    void * result = destination;
+#if defined(__x86_64__)
+    __asm__ volatile("rep stosb" : "+D"(destination), "+c"(size) : "a"(c) : "memory");
+#else
+    char * to = destination;
+    while (size--) {
+        *to++ = (char) c;
+        __asm__ volatile("" : "+r"(to) : : "memory");
+    }
+#endif
+    return result;
+}
+
+int memcmp(const void * a, const void * b, size_t size) {
+    const unsigned char * x = a, * y = b;
+    for (size_t i = 0; i < size; ++i)
+        if (x[i] != y[i])
+            return x[i] - y[i];
+    return 0;
+}
+
+size_t strlen(const char * text) {
+    const char * end = text;
+    while (*end)
+        ++end;
+    return end - text;
+}
+
+// -ffreestanding implies -fno-builtin, copies of a few bytes are inlined again as the hosted runtime has them
+#define memcpy(destination, source, size) __builtin_memcpy(destination, source, size)
+#define strlen(text) __builtin_strlen(text)
+
+#define STDIN_FILENO 0
+#define STDOUT_FILENO 1
+#define STDERR_FILENO 2
+
+static void writeAll(int fd, const char * data, size_t size) {
+    while (size) {
+        long written = systemCall(SYSTEM_WRITE, fd, (long) data, (long) size, 0, 0, 0);
+        if (written == -EINTR)
+            continue;
+        if (written <= 0)
+            return;
+        data += written;
+        size -= written;
+    }
+}
+
+static long readSome(char * buffer, size_t size) {
+    long got;
+    while ((got = systemCall(SYSTEM_READ, STDIN_FILENO, (long) buffer, (long) size, 0, 0, 0)) == -EINTR);
+    return got;
+}
+
+// whole rest of stdin, only a regular file (or a device) can seek to its end, position of stdin stays
+static const char * mapInput(size_t * size) {
+    long offset = systemCall(SYSTEM_LSEEK, STDIN_FILENO, 0, SEEK_CUR, 0, 0, 0);
+    if (failed(offset))
+        return NULL;
+    long end = systemCall(SYSTEM_LSEEK, STDIN_FILENO, 0, SEEK_END, 0, 0, 0);
+    systemCall(SYSTEM_LSEEK, STDIN_FILENO, offset, SEEK_SET, 0, 0, 0);
+    if (failed(end) || end <= offset)
+        return NULL;
+    long data = systemCall(SYSTEM_MMAP, 0, end, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+    if (failed(data))
+        return NULL;
+    systemCall(SYSTEM_MADVISE, data, end, MADV_SEQUENTIAL, 0, 0, 0);
+    *size = end - offset;
+    return (const char *) data + offset;
+}
+
+// environment of the program, set by _start
+static char ** programEnvironment = NULL;
+
+static const char * environmentValue(const char * name) {
+    for (char ** variable = programEnvironment; variable && *variable; ++variable) {
+        const char * a = name, * b = *variable;
+        while (*a && *a == *b) {
+            ++a;
+            ++b;
+        }
+        if (!*a && *b == '=')
+            return b + 1;
+    }
+    return NULL;
+}
+
+static void * allocateMemory(size_t size) {
+    long data = systemCall(SYSTEM_MMAP, 0, (long) size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return failed(data) ? NULL : (void *) data;
+}
+
+static int writeFile(const char * path, const char * data, size_t size) {
+    long fd = systemCall(SYSTEM_OPENAT, AT_FDCWD, (long) path, O_WRONLY | O_CREAT | O_TRUNC, 0644, 0, 0);
+    if (failed(fd))
+        return 0;
+    writeAll((int) fd, data, size);
+    systemCall(SYSTEM_CLOSE, fd, 0, 0, 0, 0, 0);
+    return 1;
+}
+
+__attribute__((noreturn)) static void exitProgram(int status) {
+    while (1)
+        systemCall(SYSTEM_EXIT_GROUP, status, 0, 0, 0, 0, 0);
+}
+
+#else
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// write of the program replaces write of C library, declaration of the other one is hidden
+#define write systemWrite
+#include <unistd.h>
+#undef write
+
+// write of the program replaces write of C library, so output goes through stdio which calls its own internal one
+static void writeAll(int fd, const char * data, size_t size) {
+    FILE * stream = fd == STDERR_FILENO ? stderr : stdout;
+    fwrite(data, 1, size, stream);
+    fflush(stream);
+}
+
+static long readSome(char * buffer, size_t size) {
+    ssize_t got;
+    while ((got = read(STDIN_FILENO, buffer, size)) < 0 && errno == EINTR);
+    return got;
+}
+
+// rest of stdin when it is a regular file
+static const char * mapInput(size_t * size) {
+    struct stat info;
+    if (fstat(STDIN_FILENO, &info) != 0 || !S_ISREG(info.st_mode))
+        return NULL;
+//input may be read partly by the parent process already
+    off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    if (offset < 0 || offset >= info.st_size)
+        return NULL;
+    void * data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+    if (data == MAP_FAILED)
+        return NULL;
+    madvise(data, info.st_size, MADV_SEQUENTIAL);
+    *size = info.st_size - offset;
+    return (const char *) data + offset;
+}
+
+static const char * environmentValue(const char * name) {
+    return getenv(name);
+}
+
+static void * allocateMemory(size_t size) {
+    return malloc(size);
+}
+
+static int writeFile(const char * path, const char * data, size_t size) {
+    FILE * file = fopen(path, "w");
+    if (!file)
+        return 0;
+    fwrite(data, 1, size, file);
+    return fclose(file) == 0;
+}
+
+static void exitProgram(int status) {
+    exit(status);
+}
+
+#endif
+
+// output of write and writeln, written to stdout when full, before reading and at exit
+#define OUTPUT_SIZE (1 << 16)
+// the longest integer with sign and new line
+#define INTEGER_SIZE 12
+
+static char output[OUTPUT_SIZE];
+static size_t outputUsed = 0;
+
+// two decimal digits of every number below 100
+static const char digitPairs[201] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
+static void flushOutput(void) {
+    writeAll(STDOUT_FILENO, output, outputUsed);
+    outputUsed = 0;
+}
+
+static void writeProfile(void);
+
+#ifndef MILA_FREESTANDING
+// exit from main and by exit() of rangeError
+__attribute__((destructor)) static void flushAtExit(void) {
+    flushOutput();
+    writeProfile();
+}
+#endif
+
+static char * reserveOutput(size_t size) {
+    if (outputUsed + size > OUTPUT_SIZE)
+        flushOutput();
+    return output + outputUsed;
+}
+
+// decimal digits of x end before end, returns the first one, two digits per division
+static char * formatInteger(char * end, int x) {
+    unsigned int value = x < 0 ? 0u - (unsigned int) x : (unsigned int) x;
+    while (value >= 100) {
+        unsigned int pair = value % 100;
+        value /= 100;
+        end -= 2;
+        memcpy(end, digitPairs + 2 * pair, 2);
+    }
+    if (value >= 10) {
+        end -= 2;
+        memcpy(end, digitPairs + 2 * value, 2);
+    } else
+        *--end = (char) ('0' + value);
+    if (x < 0)
+        *--end = '-';
+    return end;
+}
+
+static void writeInteger(int x, int newLine) {
+    char digits[INTEGER_SIZE];
+    char * end = digits + INTEGER_SIZE;
+    if (newLine)
+        *--end = '\n';
+    char * begin = formatInteger(end, x);
+    size_t size = digits + INTEGER_SIZE - begin;
+    memcpy(reserveOutput(size), begin, size);
+    outputUsed += size;
+}
+
+static void writeString(const char * text, int newLine) {
+    size_t size = strlen(text);
+    if (size >= OUTPUT_SIZE) {
+        flushOutput();
+        writeAll(STDOUT_FILENO, text, size);
+    } else {
+        memcpy(reserveOutput(size), text, size);
+        outputUsed += size;
+    }
+    if (newLine) {
+        *reserveOutput(1) = '\n';
+        ++outputUsed;
+    }
+}
 
 int writeln(int x) {
-    printf("%d\n", x);
+    writeInteger(x, 1);
     return 0;
 }
 
 int write(int x) {
-    printf("%d", x);
+    writeInteger(x, 0);
+    return 0;
+}
+
+int writelnStr(const char * text) {
+    writeString(text, 1);
+    return 0;
+}
+
+int writeStr(const char * text) {
+    writeString(text, 0);
+    return 0;
+}
+
+// input of readln, readarray and eof, stdin is mapped to memory when it is a regular file, otherwise it is read in
+// blocks as they come
+#define INPUT_SIZE (1 << 16)
+
+static char input[INPUT_SIZE];
+static const char * inputNext = input;
+static const char * inputEnd = input;
+static enum { INPUT_NEW, INPUT_BLOCKS, INPUT_DONE } inputState = INPUT_NEW;
+
+// next part of input, 0 at its end
+static int refillInput(void) {
+    size_t mapped;
+    const char * data;
+    if (inputState == INPUT_NEW && (data = mapInput(&mapped))) {
+        inputNext = data;
+        inputEnd = data + mapped;
+        inputState = INPUT_DONE;
+        return 1;
+    }
+    if (inputState == INPUT_DONE)
+        return 0;
+    inputState = INPUT_BLOCKS;
+//prompts are seen before the program waits for input
+    flushOutput();
+    long got = readSome(input, INPUT_SIZE);
+    if (got <= 0) {
+        inputState = INPUT_DONE;
+        return 0;
+    }
+    inputNext = input;
+    inputEnd = input + got;
+    return 1;
+}
+
+static int isSpace(char c) {
+    return c == ' ' || (unsigned char) (c - '\t') <= '\r' - '\t';
+}
+
+// 0 when only white space is left
+static int skipSpace(void) {
+    do {
+        while (inputNext < inputEnd && isSpace(*inputNext))
+            ++inputNext;
+        if (inputNext < inputEnd)
+            return 1;
+    } while (refillInput());
     return 0;
 }
 
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// number of digits at the start of 8 characters, 0x30 .. 0x39 are the only bytes with zero high nibble and low nibble
+// below 10 after xor with 0x30
+static int countDigits(uint64_t chunk) {
+    uint64_t nonDigits = (chunk & 0xF0F0F0F0F0F0F0F0u) | (((chunk & 0x0F0F0F0F0F0F0F0Fu) + 0x0606060606060606u) &
+                                                         0x1010101010101010u);
+    return nonDigits ? __builtin_ctzll(nonDigits) / 8 : 8;
+}
+
+// value of 8 digits, the first one is in the lowest byte, multiplications combine pairs, quads and halves
+static uint32_t eightDigits(uint64_t digits) {
+    digits = digits * 10 + (digits >> 8);
+    digits = ((digits & 0x000000FF000000FFu) * (100 + (1000000ull << 32)) +
+              ((digits >> 16) & 0x000000FF000000FFu) * (1 + (10000ull << 32))) >> 32;
+    return (uint32_t) digits;
+}
+
+static const uint32_t powersOf10[9] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+
+// number of at most 15 digits after a few white space characters, which is far enough from the end of input to be read
+// without any check of the end and with the sign without a branch, 0 when the input goes on otherwise
+static int readShortInteger(int * x) {
+    const char * next = inputNext;
+    for (int spaces = 0; isSpace(*next); ++next)
+        if (++spaces == 8)
+            return 0;
+    int negative = *next == '-';
+    next += negative | (*next == '+');
+    uint64_t first, second;
+    memcpy(&first, next, 8);
+    memcpy(&second, next + 8, 8);
+    first ^= 0x3030303030303030u;
+    second ^= 0x3030303030303030u;
+    int count = countDigits(first);
+    uint32_t value;
+    if (count < 8) {
+        if (!count)
+            return 0;
+        value = eightDigits(first << (64 - 8 * count));
+        next += count;
+    } else {
+        int more = countDigits(second);
+        if (more == 8)
+            return 0;
+        value = eightDigits(first);
+        if (more)
+            value = value * powersOf10[more] + eightDigits(second << (64 - 8 * more));
+        next += 8 + more;
+    }
+    *x = (int) (negative ? 0u - value : value);
+    inputNext = next;
+    return 1;
+}
+#endif
+
+// integer like scanf("%d"), x is left as it is when input does not go on with a number, too long numbers wrap
+static void readInteger(int * x) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (inputEnd - inputNext >= 32 && readShortInteger(x))
+        return;
+#endif
+    if (!skipSpace())
+        return;
+    int negative = *inputNext == '-';
+    if (*inputNext == '-' || *inputNext == '+') {
+        ++inputNext;
+        if (inputNext == inputEnd && !refillInput())
+            return;
+    }
+    uint32_t value = 0;
+    int digits = 0;
+    do {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+//8 characters at once without a branch per digit while they fit to the rest of input
+        while (inputEnd - inputNext >= 8) {
+            uint64_t chunk;
+            memcpy(&chunk, inputNext, 8);
+            chunk ^= 0x3030303030303030u;
+            int count = countDigits(chunk);
+            if (count) {
+                value = value * powersOf10[count] + eightDigits(chunk << (64 - 8 * count));
+                inputNext += count;
+                digits += count;
+            }
+            if (count < 8)
+                goto parsed;
+        }
+#endif
+        while (inputNext < inputEnd && (unsigned char) (*inputNext - '0') < 10) {
+            value = value * 10 + (*inputNext++ - '0');
+            ++digits;
+        }
+    } while (inputNext == inputEnd && refillInput());
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+parsed:
+#endif
+    if (digits)
+        *x = (int) (negative ? 0u - value : value);
+}
+
 int readln(int * x) {
-    scanf("%d", x);
+    readInteger(x);
+    return 0;
+}
+
+// count items of array from items
+int readArray(int * items, int count) {
+    for (int i = 0; i < count; ++i)
+        readInteger(items + i);
     return 0;
 }
 
+_Bool eof(void) {
+    return !skipSpace();
+}
+
+// profile of --instrument, records are in the program and filled by its instrumented code, main registers them at
+// its start. Cycles come from the cycle counter of the processor (rdtsc on x86_64). Reports are written at exit to
+// $MILA_PROFILE.txt and $MILA_PROFILE.json, mila-profile.txt and mila-profile.json by default
+struct FunctionProfile {
+    const char * name;
+    uint64_t calls;
+    uint64_t inclusive;     // cycles of outermost calls together with their callees
+    uint64_t exclusive;     // cycles without callees
+    uint64_t active;        // calls which did not return yet, their cycles are not counted
+};
+
+struct LoopProfile {
+    const char * function;
+    const char * kind;      // for with loop variable or while
+    uint64_t number;        // loops of function are numbered from 1 in source order
+    uint64_t iterations;
+};
+
+static struct FunctionProfile * profiledFunctions = NULL;
+static int profiledFunctionCount = 0;
+static struct LoopProfile * profiledLoops = NULL;
+static int profiledLoopCount = 0;
+
+void profileRegister(struct FunctionProfile * functions, int functionCount, struct LoopProfile * loops,
+                     int loopCount) {
+    profiledFunctions = functions;
+    profiledFunctionCount = functionCount;
+    profiledLoops = loops;
+    profiledLoopCount = loopCount;
+}
+
+// decimal digits of 64 bit counter end before end, returns the first one
+static char * formatCounter(char * end, uint64_t value) {
+    do
+        *--end = (char) ('0' + value % 10);
+    while (value /= 10);
+    return end;
+}
+
+static char * appendText(char * at, const char * text) {
+    size_t size = strlen(text);
+    memcpy(at, text, size);
+    return at + size;
+}
+
+// text aligned to the right of column of width characters
+static char * appendColumn(char * at, const char * text, int width) {
+    for (int i = (int) strlen(text); i < width; ++i)
+        *at++ = ' ';
+    return appendText(at, text);
+}
+
+static char * appendCounter(char * at, uint64_t value, int width) {
+    char digits[21];
+    digits[20] = 0;
+    return appendColumn(at, formatCounter(digits + 20, value), width);
+}
+
+// percents of total with one decimal, 8 characters
+static char * appendShare(char * at, uint64_t value, uint64_t total) {
+    uint64_t tenths = total ? (uint64_t) ((double) value * 1000 / (double) total + 0.5) : 0;
+    at = appendCounter(at, tenths / 10, 6);
+    *at++ = '.';
+    *at++ = (char) ('0' + tenths % 10);
+    *at++ = '%';
+    return at;
+}
+
+static const char * profilePath(char * path, const char * prefix, const char * suffix) {
+    *appendText(appendText(path, prefix), suffix) = 0;
+    return path;
+}
+
+// indexes of records from the largest key, keys are read from records of size bytes at offset
+static int * sortProfile(const void * records, int count, size_t size, size_t offset) {
+    int * order = allocateMemory((count + 1) * sizeof(int));
+    if (!order)
+        return NULL;
+    for (int i = 0; i < count; ++i) {
+        uint64_t key = *(const uint64_t *) ((const char *) records + i * size + offset);
+        int j = i;
+        for (; j > 0 && *(const uint64_t *) ((const char *) records + order[j - 1] * size + offset) < key; --j)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+    return order;
+}
+
+// text report is a table of functions by exclusive cycles and of loops by iterations, JSON has the same order. Names
+// of functions are mila identifiers, they need no escaping in JSON
+static void writeReport(void) {
+    struct FunctionProfile * functions = profiledFunctions;
+    struct LoopProfile * loops = profiledLoops;
+    if (!functions)
+        return;
+//written once, also when the program stops at range error
+    profiledFunctions = NULL;
+    const char * prefix = environmentValue("MILA_PROFILE");
+    if (!prefix || !*prefix)
+        prefix = "mila-profile";
+    size_t size = 1024;
+    uint64_t total = 0;
+    for (int i = 0; i < profiledFunctionCount; ++i) {
+        size += 2 * strlen(functions[i].name) + 256;
+        total += functions[i].exclusive;
+    }
+    for (int i = 0; i < profiledLoopCount; ++i)
+        size += 2 * (strlen(loops[i].function) + strlen(loops[i].kind)) + 256;
+    int * functionOrder = sortProfile(functions, profiledFunctionCount, sizeof(struct FunctionProfile),
+                                      offsetof(struct FunctionProfile, exclusive));
+    int * loopOrder = sortProfile(loops, profiledLoopCount, sizeof(struct LoopProfile),
+                                  offsetof(struct LoopProfile, iterations));
+    char * report = allocateMemory(size);
+    char * path = allocateMemory(strlen(prefix) + sizeof(".json"));
+    if (!functionOrder || !loopOrder || !report || !path)
+        return;
+
+//TEXT
+    char * at = appendText(report, "Profile of mila program, ");
+    at = appendCounter(at, total, 0);
+    at = appendText(at, " cycles\n\n");
+    at = appendColumn(at, "calls", 12);
+    at = appendColumn(at, "inclusive cycles", 20);
+    at = appendColumn(at, "", 9);
+    at = appendColumn(at, "exclusive cycles", 20);
+    at = appendColumn(at, "", 9);
+    at = appendText(at, "  function\n");
+    for (int i = 0; i < profiledFunctionCount; ++i) {
+        struct FunctionProfile * function = functions + functionOrder[i];
+        at = appendCounter(at, function->calls, 12);
+        at = appendCounter(at, function->inclusive, 20);
+        at = appendShare(at, function->inclusive, total);
+        at = appendCounter(at, function->exclusive, 20);
+        at = appendShare(at, function->exclusive, total);
+        at = appendText(appendText(at, "  "), function->name);
+        *at++ = '\n';
+    }
+    if (profiledLoopCount) {
+        *at++ = '\n';
+        at = appendColumn(at, "iterations", 12);
+        at = appendText(at, "  loop\n");
+    }
+    for (int i = 0; i < profiledLoopCount; ++i) {
+        struct LoopProfile * loop = loops + loopOrder[i];
+        at = appendCounter(at, loop->iterations, 12);
+        at = appendText(appendText(at, "  "), loop->function);
+        at = appendCounter(appendText(at, " loop "), loop->number, 0);
+        at = appendText(appendText(at, " ("), loop->kind);
+        at = appendText(at, ")\n");
+    }
+    if (!writeFile(profilePath(path, prefix, ".txt"), report, at - report))
+        writeAll(STDERR_FILENO, "Profile can not be written\n", 27);
+
+//JSON
+    at = appendCounter(appendText(report, "{\n  \"cycles\": "), total, 0);
+    at = appendText(at, ",\n  \"functions\": [");
+    for (int i = 0; i < profiledFunctionCount; ++i) {
+        struct FunctionProfile * function = functions + functionOrder[i];
+        at = appendText(at, i ? ",\n    {\"name\": \"" : "\n    {\"name\": \"");
+        at = appendText(at, function->name);
+        at = appendCounter(appendText(at, "\", \"calls\": "), function->calls, 0);
+        at = appendCounter(appendText(at, ", \"inclusiveCycles\": "), function->inclusive, 0);
+        at = appendCounter(appendText(at, ", \"exclusiveCycles\": "), function->exclusive, 0);
+        at = appendText(at, "}");
+    }
+    at = appendText(at, "\n  ],\n  \"loops\": [");
+    for (int i = 0; i < profiledLoopCount; ++i) {
+        struct LoopProfile * loop = loops + loopOrder[i];
+        at = appendText(at, i ? ",\n    {\"function\": \"" : "\n    {\"function\": \"");
+        at = appendText(at, loop->function);
+        at = appendCounter(appendText(at, "\", \"loop\": "), loop->number, 0);
+        at = appendText(appendText(at, ", \"kind\": \""), loop->kind);
+        at = appendCounter(appendText(at, "\", \"iterations\": "), loop->iterations, 0);
+        at = appendText(at, "}");
+    }
+    at = appendText(at, "\n  ]\n}\n");
+    if (!writeFile(profilePath(path, prefix, ".json"), report, at - report))
+        writeAll(STDERR_FILENO, "Profile can not be written\n", 27);
+}
+
+// raw profile of --profile-generate, counters of entry and of both edges of every conditional branch of functions,
+// registered by main. It is written at exit to $MILA_PROFILE_FILE, mila.profdata.txt by default, and --profile-use reads
+// it. The text is the header line "mila raw profile 1", then for every function its name, checksum and number of
+// counters on one line and the counters on the next one
+struct FunctionCounters {
+    const char * name;
+    uint64_t checksum;      // control flow graph the counters belong to
+    uint64_t count;
+    uint64_t * counters;
+};
+
+static struct FunctionCounters * countedFunctions = NULL;
+static int countedFunctionCount = 0;
+
+void countersRegister(struct FunctionCounters * functions, int count) {
+    countedFunctions = functions;
+    countedFunctionCount = count;
+}
+
+static void writeCounters(void) {
+    struct FunctionCounters * functions = countedFunctions;
+    if (!functions)
+        return;
+    countedFunctions = NULL;
+    const char * path = environmentValue("MILA_PROFILE_FILE");
+    if (!path || !*path)
+        path = "mila.profdata.txt";
+    size_t size = 64;
+    for (int i = 0; i < countedFunctionCount; ++i)
+        size += strlen(functions[i].name) + 64 + 21 * functions[i].count;
+    char * profile = allocateMemory(size);
+    if (!profile)
+        return;
+    char * at = appendText(profile, "mila raw profile 1\n");
+    for (int i = 0; i < countedFunctionCount; ++i) {
+        at = appendText(at, functions[i].name);
+        at = appendCounter(appendText(at, " "), functions[i].checksum, 0);
+        at = appendCounter(appendText(at, " "), functions[i].count, 0);
+        for (uint64_t j = 0; j < functions[i].count; ++j)
+            at = appendCounter(appendText(at, j ? " " : "\n"), functions[i].counters[j], 0);
+        *at++ = '\n';
+    }
+    if (!writeFile(path, profile, at - profile))
+        writeAll(STDERR_FILENO, "Profile can not be written\n", 27);
+}
+
+// reports of --instrument and --profile-generate at exit
+static void writeProfile(void) {
+    writeReport();
+    writeCounters();
+}
+
+// text before end, returns its start
+static char * prependText(char * end, const char * text) {
+    size_t size = strlen(text);
+    return memcpy(end - size, text, size);
+}
+
+void rangeError(int index, int low, int high) {
+    flushOutput();
+//the same as printf("Array index %d out of bounds %d..%d\n"), the freestanding runtime has no printf
+    char message[3 * INTEGER_SIZE + 32];
+    char * end = message + sizeof(message);
+    *--end = '\n';
+    char * begin = formatInteger(end, high);
+    begin = formatInteger(prependText(begin, ".."), low);
+    begin = formatInteger(prependText(begin, " out of bounds "), index);
+    begin = prependText(begin, "Array index ");
+    writeAll(STDERR_FILENO, begin, message + sizeof(message) - begin);
+    writeProfile();
+    exitProgram(1);
+}
+
+#ifdef MILA_FREESTANDING
+// program header of 64 bit ELF, the auxiliary vector points to the ones of the program
+struct ProgramHeader {
+    uint32_t type;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t address;
+    uint64_t physicalAddress;
+    uint64_t fileSize;
+    uint64_t memorySize;
+    uint64_t align;
+};
+
+#define AT_PHDR 3
+#define AT_PHNUM 5
+#define PT_PHDR 6
+#define PT_TLS 7
+
+// thread local memo tables of pure functions are accessed relative to the thread pointer (local exec model), so it
+// gets a block initialized from the TLS segment of the program. On x86_64 the block ends at the thread pointer, which
+// points to itself, on aarch64 it starts after 16 bytes reserved at the thread pointer
+static void setupThreadArea(const unsigned long * auxiliary) {
+    const struct ProgramHeader * headers = NULL;
+    unsigned long count = 0;
+    for (; auxiliary[0]; auxiliary += 2)
+        if (auxiliary[0] == AT_PHDR)
+            headers = (const struct ProgramHeader *) auxiliary[1];
+        else if (auxiliary[0] == AT_PHNUM)
+            count = auxiliary[1];
+    const struct ProgramHeader * tls = NULL;
+    uintptr_t base = 0;
+    for (unsigned long i = 0; i < count; ++i)
+        if (headers[i].type == PT_PHDR)
+            base = (uintptr_t) headers - headers[i].address;
+        else if (headers[i].type == PT_TLS)
+            tls = headers + i;
+    if (!tls)
+        return;
+    size_t align = tls->align ? tls->align : 1;
+    size_t pointerAlign = align > 16 ? align : 16;
+    size_t size = (tls->memorySize + align - 1) & -align;
+    long area = systemCall(SYSTEM_MMAP, 0, size + 2 * pointerAlign + 64, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (failed(area))
+        exitProgram(127);
+#if defined(__x86_64__)
+    uintptr_t pointer = ((uintptr_t) area + size + pointerAlign - 1) & -pointerAlign;
+    char * block = (char *) pointer - size;
+    *(uintptr_t *) pointer = pointer;
+    systemCall(SYSTEM_ARCH_PRCTL, ARCH_SET_FS, pointer, 0, 0, 0, 0);
+#else
+    uintptr_t pointer = ((uintptr_t) area + pointerAlign - 1) & -pointerAlign;
+    char * block = (char *) pointer + ((16 + align - 1) & -align);
+    __asm__ volatile("msr tpidr_el0, %0" : : "r"(pointer));
+#endif
+    memcpy(block, (const char *) base + tls->address, tls->fileSize);
+}
+
+int main(void);
+
+// called by _start with its stack, output is flushed and the status of main is the exit status
+__attribute__((used, noreturn)) void startProgram(long * stack) {
+    char ** environment = programEnvironment = (char **) stack + stack[0] + 2;
+    while (*environment)
+        ++environment;
+    setupThreadArea((const unsigned long *) (environment + 1));
+    int status = main();
+    flushOutput();
+    writeProfile();
+    exitProgram(status);
+}
+#endif
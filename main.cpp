@@ -1,14 +1,202 @@
+#include "Jit.hpp"
+#include "Optimizer.hpp"
 #include "Parser.hpp"
+#include "Server.hpp"
+#include "Stats.hpp"
 
 // Use tutorials in: https://llvm.org/docs/tutorial/
 
-int main(int argc, char * argv[]) {
+static int compile(int argc, char * argv[]) {
+    bool reportTailCalls = false;
+    bool reportFoldedCalls = false;
+    bool vm = false;
+    bool dumpBytecode = false;
+    bool tiered = false;
+    bool tierLog = false;
+    uint32_t tierUpCalls = 1000;
+    uint32_t tierUpLoops = 100000;
+    bool stats = false;
+    bool streaming = false;
+    string statsFile;   // stats go to stderr unless file is given
+    string sourceFile;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--ssa")
+            directSSA = true;
+        else if (arg == "--array-checks")
+            arrayChecks = true;
+        else if (arg == "--report-tail-calls")
+            reportTailCalls = true;
+        else if (arg == "--report-folded-calls")
+            reportFoldedCalls = true;
+        else if (arg == "--no-fold")
+            foldCalls = false;
+        else if (arg == "--vm")
+            vm = true;
+        else if (arg == "--dump-bytecode")
+            dumpBytecode = true;
+        else if (arg == "--tiered")
+            tiered = vm = true;
+        else if (arg == "--tier-log")
+            tierLog = true;
+        else if (arg.rfind("--tier-up-calls=", 0) == 0)
+            tierUpCalls = strtoul(arg.c_str() + strlen("--tier-up-calls="), nullptr, 10);
+        else if (arg.rfind("--tier-up-loops=", 0) == 0)
+            tierUpLoops = strtoul(arg.c_str() + strlen("--tier-up-loops="), nullptr, 10);
+        else if (arg == "--whole-program")
+            wholeProgram = true;
+        else if (arg == "--link-runtime")
+            linkRuntime = true;
+        else if (arg == "--instrument")
+            instrument = true;
+        else if (arg == "--profile-generate")
+            profileGenerate = true;
+        else if (arg.rfind("--profile-use=", 0) == 0)
+            profileUse.push_back(arg.substr(strlen("--profile-use=")));
+        else if (arg == "-g")
+            debugInfo = true;
+        else if (arg == "-O1" || arg == "-O2" || arg == "-O3")
+            optimizationLevel = arg[2] - '0';
+        else if (arg.rfind("-Rpass=", 0) == 0)
+            remarkOptions.passed = arg.substr(strlen("-Rpass="));
+        else if (arg.rfind("-Rpass-missed=", 0) == 0)
+            remarkOptions.missed = arg.substr(strlen("-Rpass-missed="));
+        else if (arg.rfind("-Rpass-analysis=", 0) == 0)
+            remarkOptions.analysis = arg.substr(strlen("-Rpass-analysis="));
+        else if (arg.rfind("--opt-report=", 0) == 0)
+            remarkOptions.reportFile = arg.substr(strlen("--opt-report="));
+        else if (arg == "--stream")
+            streaming = true;
+        else if (arg == "--stats")
+            stats = true;
+        else if (arg.rfind("--stats=", 0) == 0) {
+            stats = true;
+            statsFile = arg.substr(strlen("--stats="));
+        } else if (arg == "--discard-value-names")
+            discardValueNames = true;
+        else if (arg.rfind("--memo-size=", 0) == 0) {
+            memoSize = atoi(arg.c_str() + strlen("--memo-size="));
+            if (memoSize <= 0 || (memoSize & (memoSize - 1))) {
+                cerr << "Memo size has to be a power of two: " << arg << endl;
+                return 1;
+            }
+        } else if (arg == "--memo-eviction=replace")
+            memoEviction = MemoEviction::Replace;
+        else if (arg == "--memo-eviction=keep")
+            memoEviction = MemoEviction::Keep;
+        else if (arg == "--local-arrays=stack")
+            localArrays = LocalArrays::Stack;
+        else if (arg == "--local-arrays=static")
+            localArrays = LocalArrays::Static;
+        else if (arg.rfind("-", 0) != 0 && sourceFile.empty())
+            sourceFile = arg;
+        else {
+            cerr << "Unknown option: " << arg << endl;
+            return 1;
+        }
+    }
+
+//remarks come from the pipeline and point to lines of the program
+    if (remarkOptions.requested()) {
+        if (!optimizationLevel)
+            optimizationLevel = 2;
+        debugLocations = true;
+    }
+
+//program is read from stdin unless file is given, with --vm stdin is input of the program
+    if (!sourceFile.empty()) {
+        FILE * source = fopen(sourceFile.c_str(), "r");
+        if (!source) {
+            cerr << "Can not open " << sourceFile << endl;
+            return 1;
+        }
+        Lexer::setSource(source);
+        sourceName = sourceFile;
+    }
+
+    unique_ptr <CompileStats> collectedStats;
+    if (stats)
+        compileStats = (collectedStats = make_unique<CompileStats>()).get();
+    auto writeStats = [&]() {
+        if (!compileStats)
+            return 0;
+        if (statsFile.empty()) {
+            compileStats->write(llvm::errs());
+            return 0;
+        }
+        error_code error;
+        llvm::raw_fd_ostream out(statsFile, error);
+        if (error) {
+            cerr << "Can not write " << statsFile << ": " << error.message() << endl;
+            return 1;
+        }
+        compileStats->write(out);
+        return 0;
+    };
+
     Parser parser;
+    parser.streaming = streaming;
     if (!parser.Parse()) {
         return 1;
     }
     try {
-        parser.Generate().print(llvm::outs(), nullptr);
+        if (vm || dumpBytecode) {
+//native code of tiered execution calls runtime of VM, which has no profile
+            linkRuntime = false;
+            instrument = false;
+            profileGenerate = false;
+            debugInfo = false;
+            debugLocations = false;
+            optimizationLevel = 0;
+            BytecodeProgram program = parser.Compile(tiered);
+            if (arrayChecks)
+                cerr << "array checks: " << arrayCheckStats.inserted << " inserted, " << arrayCheckStats.removed
+                     << " removed" << endl;
+            if (dumpBytecode)
+                program.dump(cerr);
+            if (compileStats)
+                compileStats->countBytecode(program);
+            if (!vm)
+                return writeStats();
+            statsPhase("run");
+            int result;
+            if (tiered) {
+                TieredJit jit(parser, program, tierUpCalls, tierUpLoops, tierLog);
+                result = runBytecode(program, &jit);
+            } else
+                result = runBytecode(program);
+            fflush(stdout);
+            return writeStats() ? 1 : result;
+        }
+        const llvm::Module & module = parser.Generate();
+        if (compileStats)
+            compileStats->countModule(module);
+        statsPhase("print");
+        module.print(llvm::outs(), nullptr);
+        llvm::outs().flush();
+        if (arrayChecks)
+            cerr << "array checks: " << arrayCheckStats.inserted << " inserted, " << arrayCheckStats.removed
+                 << " removed, " << arrayCheckStats.hoisted << " hoisted to " << arrayCheckStats.preChecks
+                 << " loop pre-checks" << endl;
+        if (reportTailCalls)
+            for (auto & call: tailCalls)
+                cerr << "tail call: " << call.caller << " -> " << call.callee << " (" << call.kind << ")" << endl;
+        if (reportFoldedCalls) {
+            for (auto & call: foldedCalls)
+                cerr << "folded call: " << call << endl;
+            for (auto & call: rejectedCalls)
+                cerr << "not folded: " << call << endl;
+//the budget is shared by all calls in source order, calls after it is spent fold only with known results
+            if (foldCalls)
+                cerr << "folding: " << interpreterFuel - interpreterFuelLeft << " of " << interpreterFuel
+                     << " steps spent, only calls of functions defined before the call are evaluated" << endl;
+            else
+                cerr << "folding: off (--no-fold)" << endl;
+        }
+        for (auto & function: profileMismatches)
+            cerr << "profile of \"" << function << "\" does not match its code, it is not used" << endl;
+        writeRemarkSummary(llvm::errs());
+        return writeStats();
     } catch (exception & e) {
         cout << "Error during parsing:" << endl;
         cout << e.what() << endl;
@@ -18,3 +206,24 @@ int main(int argc, char * argv[]) {
 
     return 0;
 }
+
+int main(int argc, char * argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg.rfind("--server=", 0) == 0) {
+            if (argc != 2) {
+                cerr << "Compile server takes no other options: " << arg << endl;
+                return 1;
+            }
+//target machine and optimization pipelines are shared by all forked compilations
+            prepareOptimizer();
+            return runServer(arg.substr(strlen("--server=")), compile);
+        }
+        if (arg.rfind("--client=", 0) == 0) {
+            vector <char *> forwarded(argv + 1, argv + i);
+            forwarded.insert(forwarded.end(), argv + i + 1, argv + argc);
+            return runClient(arg.substr(strlen("--client=")), forwarded.size(), forwarded.data());
+        }
+    }
+    return compile(argc, argv);
+}